@@ -0,0 +1,104 @@
+#!/bin/bash
+# AID 훅 오버헤드 벤치마크 (printk on/off, verdict cache on/off, 에이전트 특화 프로그램 off/on,
+# flight recorder off/on 비교)
+# 각 단계마다 syscall 지연과 함께 프로그램별 verifier 명령어 수, ns/run 출력
+# 사용법: sudo ./bench_aid.sh <agentname> <file>
+#         TRACE=<경로 목록 파일>이 있으면 bloom filter off/on, specialize off/on 상태에서 trace 재생도 비교
+
+set -e
+
+if [ "$EUID" -ne 0 ]; then
+    echo "❌ 이 스크립트는 root 권한으로 실행해야 합니다."
+    echo "   sudo $0 <agentname> <file>"
+    exit 1
+fi
+
+if [ $# -ne 2 ]; then
+    echo "Usage: $0 <agentname> <file>"
+    exit 1
+fi
+
+AGENT=$1
+FILE=$2
+ITERS=${ITERS:-200000}
+
+ORIG_VERBOSITY=$(./src/aid_ctl status | awk '/^verbosity:/ {print $2}')
+ORIG_CACHE=$(./src/aid_ctl status | awk '/^cache:/ {print $2}')
+ORIG_BLOOM=$(./src/aid_ctl status | awk '/^bloom:/ {print $2}')
+ORIG_SPECIALIZE=$(./src/aid_ctl status | awk '/^specialize:/ {print $2}')
+ORIG_RECORDER=$(./src/aid_ctl status | awk '/^recorder:/ {print $2}')
+
+run_bench() {
+    ./src/aid_bench -u "$AGENT" -n "$ITERS" "$@" "$FILE"
+    echo
+}
+
+echo "=== AID syscall latency benchmark (agent=$AGENT file=$FILE) ==="
+echo
+
+echo "[1/8] verbosity=all (모든 판정에 bpf_printk)"
+./src/aid_ctl verbosity all > /dev/null
+run_bench
+
+echo "[2/8] verbosity=off (production)"
+./src/aid_ctl verbosity off > /dev/null
+run_bench
+
+echo "[3/8] 순차 4 KiB read, verdict cache off (매 read마다 전체 평가)"
+./src/aid_ctl cache off > /dev/null
+run_bench -S -s 4096
+
+echo "[4/8] 순차 4 KiB read, verdict cache on (open 시 1회 평가)"
+./src/aid_ctl cache on > /dev/null
+run_bench -S -s 4096
+
+# 특화 프로그램은 latency/hot 샘플링이 켜져 있으면 generic 경로로 넘김
+if ./src/aid_ctl status | grep -Eq '^latency: +on|^hot: +1/'; then
+    echo "⚠️  latency/hot 중 켜진 항목이 있어 [6/8], [8/8]도 generic 경로로 평가됩니다."
+fi
+
+echo "[5/8] 순차 4 KiB read, cache off, specialize off (generic file_permission)"
+./src/aid_ctl cache off > /dev/null
+./src/aid_ctl specialize off > /dev/null
+run_bench -S -s 4096
+
+echo "[6/8] 순차 4 KiB read, cache off, specialize on (에이전트 특화 프로그램으로 tail call)"
+./src/aid_ctl specialize on > /dev/null
+run_bench -S -s 4096
+
+# 기본으로 켜져 있는 flight recorder의 판정당 고정 비용 (맵 조회 2회 + 시각 읽기)
+for SPECIALIZE in off on; do
+    STEP=$([ "$SPECIALIZE" = off ] && echo 7 || echo 8)
+    ./src/aid_ctl specialize "$SPECIALIZE" > /dev/null
+    for RECORDER in off on; do
+        echo "[$STEP/8] 순차 4 KiB read, cache off, specialize $SPECIALIZE, recorder $RECORDER"
+        ./src/aid_ctl recorder "$RECORDER" > /dev/null
+        run_bench -S -s 4096
+    done
+done
+./src/aid_ctl recorder "$ORIG_RECORDER" > /dev/null
+
+if [ -n "$TRACE" ]; then
+    ./src/aid_ctl cache off > /dev/null
+    ./src/aid_ctl specialize off > /dev/null
+    for BLOOM in off on; do
+        echo "[trace] $TRACE 재생, bloom=$BLOOM (정책 hit/miss별 open+read 지연)"
+        ./src/aid_ctl bloom "$BLOOM" > /dev/null
+        ./src/aid_bench -u "$AGENT" -T -n "$ITERS" "$TRACE"
+        echo
+    done
+    ./src/aid_ctl bloom "$ORIG_BLOOM" > /dev/null
+    for SPECIALIZE in off on; do
+        echo "[trace] $TRACE 재생, specialize=$SPECIALIZE"
+        ./src/aid_ctl specialize "$SPECIALIZE" > /dev/null
+        ./src/aid_bench -u "$AGENT" -T -n "$ITERS" "$TRACE"
+        echo
+    done
+fi
+
+./src/aid_ctl verbosity "$ORIG_VERBOSITY" > /dev/null
+./src/aid_ctl cache "$ORIG_CACHE" > /dev/null
+./src/aid_ctl bloom "$ORIG_BLOOM" > /dev/null
+./src/aid_ctl specialize "$ORIG_SPECIALIZE" > /dev/null
+echo "=== 완료 (verbosity=$ORIG_VERBOSITY cache=$ORIG_CACHE bloom=$ORIG_BLOOM specialize=$ORIG_SPECIALIZE"
+echo "    recorder=$ORIG_RECORDER 복원) ==="
@@ -0,0 +1,218 @@
+// bpf/aid_agent.bpf.c
+// SPDX-License-Identifier: GPL-2.0
+//
+// file_permission specialized for one agent. addagent fills spec from the
+// agent's manifest before loading, so the verifier sees its entries and
+// profile as constants and drops what the agent does not use (the subtree
+// walk, the exec-bit heuristic). aid_enforce_file_permission tail-calls
+// here through agent_progs. What this program cannot allow on its own goes
+// back to aid_file_permission_generic: denials, fs rules, labels, suffix
+// classes, logging, sampling and timing. Allows are written to the flight
+// recorder here, at the same fixed cost as on the generic path.
+
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_tracing.h>
+#include <bpf/bpf_core_read.h>
+
+#include "../include/aid_shared.h"
+// The maps are aid_lsm.bpf.o's: addagent reuses the pinned ones
+#include "aid_maps.bpf.h"
+
+char LICENSE[] SEC("license") = "GPL";
+
+// Written by addagent before load, frozen after
+const volatile struct aid_spec spec = {};
+
+// Per baked entry, read back by addagent
+struct aid_spec_usage usage[AID_SPEC_MAX];
+
+// First baked entry not below (dev, ino): AID_SPEC_STEPS probes whatever the
+// agent's size, the unused entries (all ones) sorting last
+static __always_inline __u32 aid_spec_lower(__u32 dev, __u64 ino)
+{
+    __u32 lo = 0;
+
+    for (int i = AID_SPEC_STEPS - 1; i >= 0; i--) {
+        __u32 step = 1U << i;
+        const volatile struct aid_spec_entry *e = &spec.entry[(lo + step - 1) & (AID_SPEC_MAX - 1)];
+        if (e->dev < dev || (e->dev == dev && e->ino < ino))
+            lo += step;
+    }
+    return lo & (AID_SPEC_MAX - 1);
+}
+
+// Index of the baked entry for (dev, ino), -1 if there is none
+static __always_inline int aid_spec_find(__u32 dev, __u64 ino)
+{
+    __u32 i = aid_spec_lower(dev, ino);
+
+    if (spec.entry[i].dev == dev && spec.entry[i].ino == ino)
+        return i;
+    return -1;
+}
+
+// aid_policy_hit() for a baked entry
+static __always_inline void aid_spec_hit(int i)
+{
+    struct aid_spec_usage *u = &usage[i & (AID_SPEC_MAX - 1)];
+    __u32 now = (__u32)(bpf_ktime_get_boot_ns() / 1000000000ULL);
+
+    __sync_fetch_and_add(&u->hits, 1);
+    if (now - u->last_use >= AID_USE_GRANULARITY)
+        u->last_use = now;
+}
+
+// The enforcement mode the generic program would apply, for when it cannot
+// be reached: the task's cached profile, else the agent's slot
+static __always_inline int aid_spec_mode(void)
+{
+    struct aid_task *task = bpf_task_storage_get(&aid_tasks, bpf_get_current_task_btf(), 0, 0);
+    __u32 uid = task ? task->agent : bpf_get_current_uid_gid() & 0xffffffff;
+    __u32 zero = 0, idx = uid - AID_UID_BASE;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile *prof;
+
+    if (!cfg)
+        return AID_MODE_ENFORCE;
+    if (task && task->loaded)
+        prof = &task->prof;
+    else
+        prof = bpf_map_lookup_elem(&agent_profiles, &idx);
+    return prof ? aid_enforce_mode(cfg, prof) : cfg->enforce_mode;
+}
+
+// 0 if the access is allowed (or AID is disabled for the agent) by what is
+// baked in, -1 if the generic evaluation has to decide. A baked hit needs
+// neither the label nor the bloom check: the generic path consults labels
+// only when no inode entry matched, and the bloom filter only skips probes
+// for keys that are absent.
+static __always_inline int aid_spec_decide(struct file *file, int mask)
+{
+    struct aid_task *task = bpf_task_storage_get(&aid_tasks, bpf_get_current_task_btf(), 0, 0);
+    __u32 uid = task ? task->agent : bpf_get_current_uid_gid() & 0xffffffff;
+    __u32 zero = 0, idx = uid - AID_UID_BASE;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile *prof;
+
+    // A changed fs rule may now cover a baked filesystem. The entries were
+    // baked from inode_policies: with the inode store, epochs and revokes
+    // would not reach them.
+    if (uid != spec.uid || idx >= AID_NR_UIDS || !cfg || cfg->fs_gen != spec.fs_gen ||
+        cfg->policy_store != AID_STORE_MAP)
+        return -1;
+    if (cfg->verbosity >= AID_LOG_ALL || (cfg->debug_uids[idx / 64] & (1ULL << (idx % 64))) ||
+        cfg->latency_hist || cfg->hh_sample)
+        return -1;
+
+    // The profile the generic path cached for this task, else the agent's
+    // slot. Any other than the one baked in (aid_ctl profile, a session
+    // override) is not what this program was built for.
+    if (task) {
+        if (!task->loaded || task->gen != cfg->policy_gen)
+            return -1;
+        prof = &task->prof;
+    } else {
+        prof = bpf_map_lookup_elem(&agent_profiles, &idx);
+        if (!prof)
+            return -1;
+    }
+    if (prof->flags != spec.flags)
+        return -1;
+    if (aid_enforce_mode(cfg, prof) == AID_MODE_DISABLED)
+        return 0;
+    if (mask & MAY_EXEC)
+        return -1;
+
+    struct dentry *dentry = file->f_path.dentry;
+    struct inode *inode = dentry ? dentry->d_inode : 0;
+    if (!inode)
+        return -1;
+
+    struct aid_verdict_stats *stats = aid_stats(uid);
+    umode_t imode = inode->i_mode;
+    __u32 dev = inode->i_sb->s_dev;
+    __u64 ino = inode->i_ino;
+    if (S_ISCHR(imode) || S_ISBLK(imode)) {
+        aid_count(AID_REASON_DEVICE);
+        aid_record(cfg, uid, ino, dev, mask, AID_REASON_DEVICE, AID_VERDICT_ALLOW);
+        return 0;
+    }
+    if (S_ISSOCK(imode)) {
+        aid_count(AID_REASON_SOCKET);
+        aid_record(cfg, uid, ino, dev, mask, AID_REASON_SOCKET, AID_VERDICT_ALLOW);
+        return 0;
+    }
+
+    int need = mask;
+    if ((mask & MAY_WRITE) && (file->f_flags & O_APPEND))
+        need = (mask & ~MAY_WRITE) | MAY_APPEND;
+
+    int i = aid_spec_find(dev, ino);
+    if (i >= 0) {
+        if (need & ~spec.entry[i].allow)
+            return -1;
+        aid_spec_hit(i);
+        aid_count(AID_REASON_POLICY_MATCH);
+        aid_record(cfg, uid, ino, dev, mask, AID_REASON_POLICY_MATCH, AID_VERDICT_ALLOW);
+        return 0;
+    }
+
+    if (!spec.subtrees && !(spec.flags & AID_PROFILE_EXEC_BIT))
+        return -1;
+
+    // Files the agent created since addagent ran have inherited entries
+    // this program does not know, and those come before a subtree
+    struct inode_key key = {};
+    void *inner = bpf_map_lookup_elem(&inode_policies, &uid);
+    aid_policy_key(&key, ino, dev);
+    if (inner && bpf_map_lookup_elem(inner, &key))
+        return -1;
+
+    if (spec.subtrees) {
+        struct dentry *d = dentry;
+
+        for (int depth = 1; depth <= AID_SUBTREE_DEPTH; depth++) {
+            struct dentry *parent = d->d_parent;
+            if (!parent || parent == d)
+                break;  // reached the filesystem root
+            d = parent;
+
+            struct inode *dir = d->d_inode;
+            if (!dir)
+                continue;
+            int j = aid_spec_find(dev, dir->i_ino);
+            if (j >= 0 && (spec.entry[j].flags & AID_POLICY_SUBTREE)) {
+                if (need & ~spec.entry[j].allow)
+                    return -1;
+                aid_spec_hit(j);
+                aid_count(AID_REASON_POLICY_MATCH);
+                aid_record(cfg, uid, ino, dev, mask, AID_REASON_POLICY_MATCH,
+                           AID_VERDICT_ALLOW);
+                return 0;
+            }
+        }
+    }
+
+    // No policy: plain reads of executables, on a filesystem the agent has
+    // entries on (so no fs rule), unless a label could still grant one
+    if ((spec.flags & AID_PROFILE_EXEC_BIT) && mask == MAY_READ && (imode & 0111) &&
+        !cfg->xattr_labels && spec.entry[aid_spec_lower(dev, 0)].dev == dev) {
+        aid_count(AID_REASON_EXEC_BIT);
+        aid_record(cfg, uid, ino, dev, mask, AID_REASON_EXEC_BIT, AID_VERDICT_ALLOW);
+        return 0;
+    }
+    return -1;
+}
+
+SEC("lsm/file_permission")
+int BPF_PROG(aid_agent_file_permission, struct file *file, int mask)
+{
+    if (aid_spec_decide(file, mask) == 0)
+        return 0;
+
+    bpf_tail_call(ctx, &agent_progs, AID_SPEC_GENERIC);
+    // Only reached if the loader's generic program is missing: deny what
+    // the baked entries did not allow, unless the agent is not enforced
+    return aid_spec_mode() == AID_MODE_ENFORCE ? -EACCES : 0;
+}
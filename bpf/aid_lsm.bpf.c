@@ -5,221 +5,1371 @@
 #include <bpf/bpf_helpers.h>
 #include <bpf/bpf_tracing.h>
 #include <bpf/bpf_core_read.h>
+#include <bpf/bpf_endian.h>
 
 #include "../include/aid_shared.h"
+#include "aid_maps.bpf.h"
 
-#define MAY_EXEC  0x00000001
-#define MAY_WRITE 0x00000002
-#define MAY_READ  0x00000004
+char LICENSE[] SEC("license") = "GPL";
 
-#define EACCES 13
+// printk only when the current log level allows it; with AID_LOG_OFF the
+// fast path never reaches bpf_printk.
+#define aid_log(lvl, fmt, ...)                      \
+    do {                                            \
+        if (log_level >= (lvl))                     \
+            bpf_printk(fmt, ##__VA_ARGS__);         \
+    } while (0)
 
-// File type macros (from linux/stat.h)
-#define S_IFMT   00170000
-#define S_IFBLK  0060000
-#define S_IFCHR  0020000
-#define S_IFSOCK 0140000
+#define aid_deny() (permissive ? 0 : -EACCES)
 
-#define S_ISBLK(m)  (((m) & S_IFMT) == S_IFBLK)
-#define S_ISCHR(m)  (((m) & S_IFMT) == S_IFCHR)
-#define S_ISSOCK(m) (((m) & S_IFMT) == S_IFSOCK)
+// policy_store = inode: the agents' grants on an inode, kept with the inode
+// and freed when it is evicted; see struct aid_inode_policy
+struct {
+    __uint(type, BPF_MAP_TYPE_INODE_STORAGE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, int);
+    __type(value, struct aid_inode_policy);
+} inode_store SEC(".maps");
 
-char LICENSE[] SEC("license") = "GPL";
+// xattr labels: each inode's AID_LABEL_XATTR as read by aid_file_label
+struct {
+    __uint(type, BPF_MAP_TYPE_INODE_STORAGE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, int);
+    __type(value, struct aid_label_cache);
+} label_cache SEC(".maps");
 
-// inode + uid -> file_perm
+// {uid, label} -> the grant for every file carrying label
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, struct inode_uid_key);
+    __type(key, struct label_key);
     __type(value, struct file_perm);
-    __uint(max_entries, 16384);
-} inode_policies SEC(".maps");
+    __uint(max_entries, 4096);
+} label_rules SEC(".maps");
+
+// Only aid_file_label uses these, and it is loaded only with
+// xattr_labels = true. struct bpf_dynptr is in vmlinux.h from 5.19 on (the
+// Makefile checks), the kfunc is not declared anywhere we include.
+#ifndef AID_HAVE_BPF_DYNPTR
+struct bpf_dynptr {
+    __u64 __opaque[2];
+} __attribute__((aligned(8)));
+#endif
+
+extern int bpf_get_file_xattr(struct file *file, const char *name__str,
+                              struct bpf_dynptr *value_p) __ksym __weak;
+
+// Not in this vmlinux.h (5.16+)
+#ifndef BPF_MAP_TYPE_BLOOM_FILTER
+#define BPF_MAP_TYPE_BLOOM_FILTER 30
+#endif
+
+// Every inode_key registered for any agent; see AID_BLOOM_HASHES
+struct {
+    __uint(type, BPF_MAP_TYPE_BLOOM_FILTER);
+    __type(value, struct inode_key);
+    __uint(max_entries, 65536);
+    __uint(map_extra, AID_BLOOM_HASHES);
+} policy_bloom SEC(".maps");
+
+// {AID_FS_KIND_*, magic or dev} -> fs_rule, for every agent
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, struct fs_rule_key);
+    __type(value, struct fs_rule);
+    __uint(max_entries, 256);
+} fs_rules SEC(".maps");
 
-// uid -> network_perm
+// {uid, port, address prefix} -> net_rule, checked at connect()/sendmsg()
+struct {
+    __uint(type, BPF_MAP_TYPE_LPM_TRIE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, struct net_rule_key);
+    __type(value, struct net_rule);
+    __uint(max_entries, 4096);
+} net_rules SEC(".maps");
+
+// {uid or AID_SUFFIX_GLOBAL, ".ext"} -> suffix_class
 struct {
     __uint(type, BPF_MAP_TYPE_HASH);
-    __type(key, __u32);  // uid
-    __type(value, struct network_perm);
+    __type(key, struct suffix_key);
+    __type(value, struct suffix_class);
     __uint(max_entries, 1024);
-} network_policies SEC(".maps");
+} suffix_classes SEC(".maps");
 
-// LSM: file_permission - called on every file access
-SEC("lsm/file_permission")
-int BPF_PROG(aid_enforce_file_permission, struct file *file, int mask)
+// hire session id -> aid_session (aid_ctl session)
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __type(key, __u32);
+    __type(value, struct aid_session);
+    __uint(max_entries, 1024);
+} session_profiles SEC(".maps");
+
+// Open-time evaluation of one file for one agent: everything the per-I/O
+// check needs, independent of the access mask.
+struct file_verdict {
+    __u32 uid;
+    __u32 gen;          // aid_config.policy_gen the verdict was computed under
+    __u8  type_reason;  // NO_INODE/DEVICE/SOCKET/SOCKET_DENIED, else AID_REASON_MAX
+    __u8  read_reason;  // NOT_SENSITIVE/EXEC_BIT if a plain read needs no policy, else AID_REASON_MAX
+    __u8  has_policy;
+    __u8  allow;        // AID_PERM_* granted by the policy
+    __u8  fs_rule;      // policy is an fs_rules entry, not a per-inode one
+    __u64 ino;          // for the flight recorder, 0 without an inode
+    __u32 dev;
+};
+
+// struct file * -> verdict. Filled in file_open, dropped in file_free_security.
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, __u64);
+    __type(value, struct file_verdict);
+    __uint(max_entries, 65536);
+} file_verdicts SEC(".maps");
+
+// Binary audit events (struct aid_event), drained by aid_auditd
+struct {
+    __uint(type, BPF_MAP_TYPE_RINGBUF);
+    __uint(max_entries, 256 * 1024);
+} aid_events SEC(".maps");
+
+// Per-uid audit token bucket, GCRA style: one theoretical arrival time
+struct aid_ratelimit {
+    __u64 tat;
+    __u64 dropped;
+};
+
+// (uid - AID_UID_BASE) -> aid_ratelimit
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct aid_ratelimit);
+    __uint(max_entries, AID_NR_UIDS);
+} audit_ratelimit SEC(".maps");
+
+// Hot-inode count-min sketch, one row per slot; see AID_CMS_DEPTH
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct aid_cms_row);
+    __uint(max_entries, AID_CMS_DEPTH);
+} hh_sketch SEC(".maps");
+
+// (uid, dev, ino) seen by the sampler; the sketch holds their counts
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __type(key, struct aid_hh_key);
+    __type(value, __u8);
+    __uint(max_entries, 4096);
+} hh_candidates SEC(".maps");
+
+// AID_REASON_* -> per-CPU duration histogram of file_permission
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct aid_latency_hist);
+    __uint(max_entries, AID_REASON_MAX);
+} latency_hist SEC(".maps");
+
+// floor(log2(v)), v > 0, without a loop
+static __always_inline __u32 aid_log2(__u64 v)
+{
+    __u32 r, shift;
+
+    r = (v > 0xffffffff) << 5; v >>= r;
+    shift = (v > 0xffff) << 4; v >>= shift; r |= shift;
+    shift = (v > 0xff) << 3; v >>= shift; r |= shift;
+    shift = (v > 0xf) << 2; v >>= shift; r |= shift;
+    shift = (v > 0x3) << 1; v >>= shift; r |= shift;
+    return r | (__u32)(v >> 1);
+}
+
+// Add the time since start to reason's histogram; start 0 means timing is off
+static __always_inline void aid_latency(__u64 start, __u32 reason)
+{
+    if (!start)
+        return;
+
+    __u64 delta = bpf_ktime_get_ns() - start;
+    struct aid_latency_hist *hist = bpf_map_lookup_elem(&latency_hist, &reason);
+    if (!hist)
+        return;
+
+    __u32 slot = delta ? aid_log2(delta) : 0;
+    if (slot >= AID_HIST_SLOTS)
+        slot = AID_HIST_SLOTS - 1;
+    hist->slot[slot]++;
+    hist->total_ns += delta;
+}
+
+// Feed 1 in cfg->hh_sample accesses to the hot-inode sketch. With sampling
+// off this is one load and a branch.
+static __always_inline void aid_hh_sample(const struct aid_config *cfg, __u32 uid,
+                                          __u64 ino, __u32 dev)
 {
-    __u64 uid_gid = bpf_get_current_uid_gid();
-    __u32 uid = uid_gid & 0xffffffff;
+    if (!cfg || !cfg->hh_sample || !ino)
+        return;
+    if (bpf_get_prandom_u32() % cfg->hh_sample)
+        return;
+
+    for (__u32 row = 0; row < AID_CMS_DEPTH; row++) {
+        struct aid_cms_row *r = bpf_map_lookup_elem(&hh_sketch, &row);
+        if (r)
+            r->count[aid_cms_slot(uid, dev, ino, row)]++;
+    }
 
-    // Ignore non-AID users
-    if (uid < AID_UID_BASE || uid >= AID_UID_MAX) {
+    struct aid_hh_key key = { .uid = uid, .dev = dev, .ino = ino };
+    __u8 seen = 1;
+    // Candidates already present are left alone: no write per sample
+    if (!bpf_map_lookup_elem(&hh_candidates, &key))
+        bpf_map_update_elem(&hh_candidates, &key, &seen, BPF_NOEXIST);
+}
+
+// Effective log level for uid: global verbosity, raised to AID_LOG_ALL when
+// the uid's bit is set in the debug mask.
+static __always_inline int aid_log_level(const struct aid_config *cfg, __u32 uid)
+{
+    __u32 idx = uid - AID_UID_BASE;
+
+    if (idx >= AID_NR_UIDS)
+        return cfg->verbosity;
+    if (cfg->debug_uids[idx / 64] & (1ULL << (idx % 64)))
+        return AID_LOG_ALL;
+    return cfg->verbosity;
+}
+
+// The calling task's aid_tasks entry, NULL unless hire started it
+static __always_inline struct aid_task *aid_current_task(void)
+{
+    return bpf_task_storage_get(&aid_tasks, bpf_get_current_task_btf(), 0, 0);
+}
+
+// Policy key of the caller: the agent hire recorded, else the task's uid
+// (agents started some other way)
+static __always_inline __u32 aid_current_agent(const struct aid_task *task)
+{
+    return task ? task->agent : bpf_get_current_uid_gid() & 0xffffffff;
+}
+
+// uid's profile: its hire session's override, the agent's slot, or the
+// built-in behaviour for an agent addagent has not given one (suffix
+// classes and exec-bit reads on, fail closed, global audit level and
+// mode). A task hire started keeps the result in its aid_tasks entry and
+// reuses it until policy_gen moves.
+static __always_inline void aid_load_profile(const struct aid_config *cfg, struct aid_task *task,
+                                             __u32 uid, struct agent_profile *prof)
+{
+    __u32 gen = cfg ? cfg->policy_gen : 0;
+
+    if (task && task->loaded && task->gen == gen) {
+        *prof = task->prof;
+        return;
+    }
+
+    __u32 idx = uid - AID_UID_BASE;
+    struct agent_profile *p = bpf_map_lookup_elem(&agent_profiles, &idx);
+    struct aid_session *s = task ? bpf_map_lookup_elem(&session_profiles, &task->session) : 0;
+
+    if (s && s->agent == uid && (s->prof.flags & AID_PROFILE_ACTIVE)) {
+        *prof = s->prof;
+    } else if (p && (p->flags & AID_PROFILE_ACTIVE)) {
+        *prof = *p;
+    } else {
+        prof->flags = AID_PROFILE_DEFAULT_FLAGS;
+        prof->audit_level = AID_PROFILE_INHERIT;
+        prof->enforce_mode = AID_PROFILE_INHERIT;
+        prof->_pad = 0;
+    }
+    // The epochs are the agent's registration, whatever the session says.
+    // A revoked agent keeps its epochs, which rule out all of its slots.
+    prof->epoch = p ? p->epoch : 0;
+    prof->base_epoch = p ? p->base_epoch : 0;
+
+    if (task) {
+        task->prof = *prof;
+        task->gen = gen;
+        task->loaded = 1;
+    }
+}
+
+// Take one token from uid's bucket. Updates race across CPUs, which at
+// worst lets a few extra events through during a storm.
+static __always_inline int aid_audit_allowed(const struct aid_config *cfg, __u32 uid)
+{
+    __u32 idx = uid - AID_UID_BASE;
+    struct aid_ratelimit *rl = bpf_map_lookup_elem(&audit_ratelimit, &idx);
+    if (!rl)
+        return 0;
+
+    __u64 rate = cfg->audit_rate ? cfg->audit_rate : AID_AUDIT_DEFAULT_RATE;
+    __u64 burst = cfg->audit_burst ? cfg->audit_burst : AID_AUDIT_DEFAULT_BURST;
+    __u64 interval = 1000000000ULL / rate;
+    __u64 now = bpf_ktime_get_ns();
+    __u64 tat = rl->tat;
+
+    if (tat < now)
+        tat = now;
+    if (tat - now >= burst * interval) {
+        __sync_fetch_and_add(&rl->dropped, 1);
         return 0;
     }
+    rl->tat = tat + interval;
+    return 1;
+}
+
+// Reserve an audit event for a denial (or a would-be denial in permissive
+// mode) with everything but ino, dev and name filled in; NULL if the agent
+// is not audited, is over its rate or the ring buffer is full
+static __always_inline struct aid_event *aid_audit_reserve(const struct aid_config *cfg,
+                                                           const struct agent_profile *prof,
+                                                           __u32 uid, int mask, __u8 reason,
+                                                           int permissive)
+{
+    if (!cfg)
+        return 0;
+    int level = prof->audit_level == AID_PROFILE_INHERIT ? cfg->audit_level : prof->audit_level;
+    if (level < AID_AUDIT_DENY)
+        return 0;
+    if (!aid_audit_allowed(cfg, uid))
+        return 0;
+
+    struct aid_event *e = bpf_ringbuf_reserve(&aid_events, sizeof(*e), 0);
+    if (!e)
+        return 0;
+
+    e->ts_ns = bpf_ktime_get_boot_ns();
+    e->uid = uid;
+    e->pid = bpf_get_current_pid_tgid() >> 32;
+    e->mask = mask;
+    e->reason = reason;
+    e->verdict = permissive ? AID_VERDICT_PERMISSIVE : AID_VERDICT_DENY;
+    e->_pad[0] = 0;
+    e->_pad[1] = 0;
+    __builtin_memset(e->name, 0, sizeof(e->name));
+    return e;
+}
+
+// Emit one audit event for a file access
+static __always_inline void aid_audit(const struct aid_config *cfg,
+                                      const struct agent_profile *prof, __u32 uid,
+                                      struct inode *inode, struct dentry *dentry,
+                                      int mask, __u8 reason, int permissive)
+{
+    struct aid_event *e = aid_audit_reserve(cfg, prof, uid, mask, reason, permissive);
+    if (!e)
+        return;
 
+    e->ino = BPF_CORE_READ(inode, i_ino);
+    e->dev = BPF_CORE_READ(inode, i_sb, s_dev);
+    bpf_probe_read_kernel_str(e->name, sizeof(e->name), BPF_CORE_READ(dentry, d_name.name));
+    bpf_ringbuf_submit(e, 0);
+}
+
+// Emit one audit event for a connect/sendmsg: the port goes in mask and the
+// destination address (IPv4 mapped into IPv6) in the first 16 bytes of name
+static __always_inline void aid_audit_net(const struct aid_config *cfg,
+                                          const struct agent_profile *prof, __u32 uid,
+                                          const struct net_rule_key *key, int permissive)
+{
+    struct aid_event *e = aid_audit_reserve(cfg, prof, uid, key->port,
+                                            AID_REASON_SOCKET_DENIED, permissive);
+    if (!e)
+        return;
+
+    e->ino = 0;
+    e->dev = 0;
+    __builtin_memcpy(e->name, key->addr, sizeof(key->addr));
+    bpf_ringbuf_submit(e, 0);
+}
+
+// Ignore non-AID users
+static __always_inline int aid_is_agent(__u32 uid)
+{
+    return uid >= AID_UID_BASE && uid < AID_UID_MAX;
+}
+
+// Only files opened by an agent are cached: aid_file_free drops exactly
+// those, so a recycled struct file can never inherit a stale verdict.
+static __always_inline int aid_cacheable(struct file *file, __u32 uid)
+{
+    return BPF_CORE_READ(file, f_cred, uid.val) == uid;
+}
+
+// Does a plain read of this name need a policy (its suffix class)? Reads
+// the last AID_SUFFIX_LEN bytes of d_name once, then one lookup for uid's
+// own class and one for the global class: no strlen loop, and no more work
+// for more configured suffixes.
+static __always_inline int aid_name_needs_policy(__u32 uid, struct dentry *dentry)
+{
+    __u32 len = BPF_CORE_READ(dentry, d_name.len);
+    const unsigned char *name = BPF_CORE_READ(dentry, d_name.name);
+    struct suffix_key key = { .uid = uid };
+    __u8 tail[AID_SUFFIX_LEN] = {};
+    int end = AID_SUFFIX_LEN, dot = -1;
+
+    // Short names sit in d_iname, which is longer than the read
+    if (len < AID_SUFFIX_LEN)
+        end = len;
+    else
+        name += len - AID_SUFFIX_LEN;
+    // A name that cannot be read could be anything: treat it as sensitive
+    if (bpf_probe_read_kernel(tail, sizeof(tail), name) < 0)
+        return 1;
+
+    for (int i = 0; i < AID_SUFFIX_LEN; i++) {
+        if (i < end && tail[i] == '.')
+            dot = i;
+    }
+    if (dot < 0)
+        return 0;
+    for (int i = 0; i < AID_SUFFIX_LEN; i++) {
+        if (dot + i < end)
+            key.suffix[i] = tail[(dot + i) & (AID_SUFFIX_LEN - 1)];
+    }
+
+    struct suffix_class *class = bpf_map_lookup_elem(&suffix_classes, &key);
+    if (!class) {
+        key.uid = AID_SUFFIX_GLOBAL;
+        class = bpf_map_lookup_elem(&suffix_classes, &key);
+    }
+    return class && class->sensitive;
+}
+
+// Inner policy map key for inode
+static __always_inline void aid_inode_key(struct inode *inode, struct inode_key *key)
+{
+    // s_dev is already the kernel encoding the key uses: no conversion
+    aid_policy_key(key, BPF_CORE_READ(inode, i_ino), BPF_CORE_READ(inode, i_sb, s_dev));
+}
+
+// Rule for inode's filesystem: its mounted device first, then its type
+static __always_inline struct fs_rule *aid_fs_rule(struct inode *inode)
+{
+    struct super_block *sb = BPF_CORE_READ(inode, i_sb);
+    struct fs_rule_key key = {
+        .kind = AID_FS_KIND_DEV,
+        .id = BPF_CORE_READ(sb, s_dev),
+    };
+    struct fs_rule *rule = bpf_map_lookup_elem(&fs_rules, &key);
+
+    if (rule)
+        return rule;
+    key.kind = AID_FS_KIND_MAGIC;
+    key.id = (__u32)BPF_CORE_READ(sb, s_magic);
+    return bpf_map_lookup_elem(&fs_rules, &key);
+}
+
+// Probe inner for key, unless the bloom filter says no agent has key
+static __always_inline struct file_perm *aid_inner_lookup(void *inner, struct inode_key *key,
+                                                          int bloom)
+{
+    if (bloom && bpf_map_peek_elem(&policy_bloom, key) != 0)
+        return 0;
+    return bpf_map_lookup_elem(inner, key);
+}
+
+// Nearest subtree rule for uid above dentry, within AID_SUBTREE_DEPTH
+// levels. d_parent never leaves the superblock, so key->dev stays valid;
+// only key->ino changes. Plain entries on directories (the traversal grants
+// addagent adds for parent directories) apply to the directory alone and
+// are skipped.
+static __always_inline struct file_perm *aid_subtree_lookup(void *inner,
+                                                            struct dentry *dentry,
+                                                            struct inode_key *key,
+                                                            int bloom, int log_level)
+{
+    struct file_perm *perm;
+
+    for (int depth = 1; depth <= AID_SUBTREE_DEPTH; depth++) {
+        struct dentry *parent = BPF_CORE_READ(dentry, d_parent);
+        if (!parent || parent == dentry)
+            break;  // reached the filesystem root
+        dentry = parent;
+
+        key->ino = BPF_CORE_READ(dentry, d_inode, i_ino);
+        perm = aid_inner_lookup(inner, key, bloom);
+        if (perm && (perm->flags & AID_POLICY_SUBTREE)) {
+            aid_log(AID_LOG_ALL, "[AID] Found subtree policy depth=%d ino=%llu\n",
+                    depth, key->ino);
+            return perm;
+        }
+    }
+    return 0;
+}
+
+static __always_inline __u32 aid_now_sec(void)
+{
+    return (__u32)(bpf_ktime_get_boot_ns() / 1000000000ULL);
+}
+
+// Usage of a policy entry for coverage reports (addagent -C). Concurrent
+// hits race on last_use; either store is fine at this granularity.
+static __always_inline void aid_policy_hit(struct file_perm *perm)
+{
+    __sync_fetch_and_add(&perm->hits, 1);
+
+    __u32 now = aid_now_sec();
+    if (now - perm->last_use >= AID_USE_GRANULARITY)
+        perm->last_use = now;
+}
+
+// uid's grant in one inode's storage: the slot of the agent's current
+// registration, else one inherited since its last revoke
+static __always_inline struct file_perm *aid_slot_lookup(struct aid_inode_policy *ip, __u32 uid,
+                                                         const struct agent_profile *prof)
+{
+    struct file_perm *inherited = 0;
+
+    if (!ip)
+        return 0;
+    for (int i = 0; i < AID_INODE_SLOTS; i++) {
+        struct aid_inode_slot *s = &ip->slot[i];
+        if (s->uid != uid || s->epoch <= prof->base_epoch || s->epoch > prof->epoch)
+            continue;
+        if (s->epoch == prof->epoch)
+            return &s->perm;
+        if (s->perm.flags & AID_POLICY_INHERITED)
+            inherited = &s->perm;
+    }
+    return inherited;
+}
+
+// aid_policy_lookup() for policy_store = inode: the inode's own slot, else
+// the nearest subtree slot above it. Each level is a pointer off the inode,
+// no hashing; inode and dentry must be BTF pointers (not BPF_CORE_READ
+// results) for bpf_inode_storage_get().
+static __always_inline struct file_perm *aid_store_lookup(__u32 uid, struct dentry *dentry,
+                                                          struct inode *inode,
+                                                          const struct agent_profile *prof,
+                                                          int log_level)
+{
+    struct file_perm *perm;
+
+    perm = aid_slot_lookup(bpf_inode_storage_get(&inode_store, inode, 0, 0), uid, prof);
+    if (perm) {
+        aid_log(AID_LOG_ALL, "[AID] Found inode policy allow=0x%x\n", perm->allow);
+        return perm;
+    }
+
+    for (int depth = 1; depth <= AID_SUBTREE_DEPTH; depth++) {
+        struct dentry *parent = dentry->d_parent;
+        if (!parent || parent == dentry)
+            break;  // reached the filesystem root
+        dentry = parent;
+
+        perm = aid_slot_lookup(bpf_inode_storage_get(&inode_store, dentry->d_inode, 0, 0),
+                               uid, prof);
+        if (perm && (perm->flags & AID_POLICY_SUBTREE)) {
+            aid_log(AID_LOG_ALL, "[AID] Found subtree inode policy depth=%d\n", depth);
+            return perm;
+        }
+    }
+    return 0;
+}
+
+// uid's label_rules grant for the label cached on inode, if any
+static __always_inline struct file_perm *aid_label_lookup(__u32 uid, struct inode *inode,
+                                                          int log_level)
+{
+    struct aid_label_cache *c = bpf_inode_storage_get(&label_cache, inode, 0, 0);
+    if (!c || c->state != AID_LABEL_SET)
+        return 0;
+
+    struct label_key key = { .uid = uid };
+    __builtin_memcpy(key.label, c->label, AID_LABEL_LEN);
+    struct file_perm *perm = bpf_map_lookup_elem(&label_rules, &key);
+    if (perm)
+        aid_log(AID_LOG_ALL, "[AID] Found label policy allow=0x%x\n", perm->allow);
+    return perm;
+}
+
+// Policy of inode (reached through dentry, key built for it) for uid: its
+// own entry in the agent's inner map, else the nearest subtree rule above
+// it, else the grant for its xattr label
+static __always_inline struct file_perm *aid_policy_lookup(__u32 uid, struct dentry *dentry,
+                                                           struct inode *inode,
+                                                           struct inode_key *key,
+                                                           const struct agent_profile *prof,
+                                                           int log_level)
+{
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct file_perm *perm = 0;
+
+    if (cfg && cfg->policy_store == AID_STORE_INODE) {
+        perm = aid_store_lookup(uid, dentry, inode, prof, log_level);
+    } else {
+        void *inner = bpf_map_lookup_elem(&inode_policies, &uid);
+        int bloom = cfg && cfg->policy_bloom;
+
+        if (inner)
+            perm = aid_inner_lookup(inner, key, bloom);
+
+        if (perm && (perm->flags & AID_POLICY_INHERITED) &&
+            perm->i_generation != BPF_CORE_READ(inode, i_generation)) {
+            // Copied onto an earlier inode that had this number: drop it
+            aid_log(AID_LOG_ALL, "[AID] Stale inherited policy ino=%llu\n", key->ino);
+            bpf_map_delete_elem(inner, key);
+            perm = 0;
+        }
+
+        if (perm)
+            aid_log(AID_LOG_ALL, "[AID] Found direct policy allow=0x%x\n", perm->allow);
+        else if (inner)
+            perm = aid_subtree_lookup(inner, dentry, key, bloom, log_level);
+    }
+
+    if (!perm && cfg && cfg->xattr_labels)
+        perm = aid_label_lookup(uid, inode, log_level);
+    if (perm)
+        aid_policy_hit(perm);
+    return perm;
+}
+
+// Full evaluation of file for uid: file type, the read heuristics its
+// profile enables and the inode_policies entry (direct, else the nearest
+// subtree rule). Runs once per open (or on a cache miss).
+static __always_inline void aid_evaluate(struct file *file, __u32 uid,
+                                         const struct agent_profile *prof, int log_level,
+                                         struct file_verdict *v)
+{
     struct dentry *dentry;
     struct inode *inode;
-    struct inode_uid_key key = {};
+    struct inode_key key = {};
     struct file_perm *perm;
 
-    // file -> dentry -> inode
-    dentry = BPF_CORE_READ(file, f_path.dentry);
+    v->uid = uid;
+    v->type_reason = AID_REASON_MAX;
+    v->read_reason = AID_REASON_MAX;
+    v->has_policy = 0;
+    v->allow = 0;
+    v->fs_rule = 0;
+    v->ino = 0;
+    v->dev = 0;
+
+    // file -> dentry -> inode, read directly so that both stay BTF pointers
+    // (see aid_store_lookup)
+    dentry = file->f_path.dentry;
     if (!dentry) {
-        bpf_printk("[AID] ALLOW no dentry\n");
-        return 0;
+        aid_log(AID_LOG_ALL, "[AID] ALLOW no dentry\n");
+        v->type_reason = AID_REASON_NO_INODE;
+        return;
     }
 
-    inode = BPF_CORE_READ(dentry, d_inode);
+    inode = dentry->d_inode;
     if (!inode) {
-        bpf_printk("[AID] ALLOW no inode\n");
-        return 0;
+        aid_log(AID_LOG_ALL, "[AID] ALLOW no inode\n");
+        v->type_reason = AID_REASON_NO_INODE;
+        return;
     }
+    aid_inode_key(inode, &key);
+    v->ino = key.ino;
+    v->dev = key.dev;
 
     // Allow access to character/block devices (stdin/stdout/stderr, /dev/null, etc.)
     umode_t mode = BPF_CORE_READ(inode, i_mode);
     if (S_ISCHR(mode) || S_ISBLK(mode)) {
-        bpf_printk("[AID] ALLOW device mode=0x%x\n", mode);
-        return 0;
+        aid_log(AID_LOG_ALL, "[AID] ALLOW device mode=0x%x\n", mode);
+        v->type_reason = AID_REASON_DEVICE;
+        return;
     }
 
-    // Check socket permission based on network.mail
+    // Where a socket may connect is decided once, by the cgroup
+    // connect/sendmsg programs; its reads and writes are not re-checked
     if (S_ISSOCK(mode)) {
-        struct network_perm *net_perm = bpf_map_lookup_elem(&network_policies, &uid);
-        if (!net_perm || !net_perm->allow_mail) {
-            bpf_printk("[AID] DENY socket uid=%u no network.mail permission\n", uid);
-            return -EACCES;
-        }
-        bpf_printk("[AID] ALLOW socket uid=%u network.mail=true\n", uid);
-        return 0;
+        v->type_reason = AID_REASON_SOCKET;
+        return;
     }
 
-    // Convert kernel dev to stat-compatible format
-    // Kernel uses new_encode_dev: (major << 20) | minor
-    // stat uses old format: (major << 8) | minor
-    __u64 kdev = BPF_CORE_READ(inode, i_sb, s_dev);
-    __u32 major = kdev >> 20;
-    __u32 minor = kdev & 0xfffff;
+    // Pipes, procfs, read-only mounts, ...: one rule for the whole
+    // filesystem, no per-inode lookup and no heuristics
+    struct fs_rule *rule = aid_fs_rule(inode);
+    if (rule) {
+        aid_log(AID_LOG_ALL, "[AID] fs rule allow=0x%x\n", rule->allow);
+        v->has_policy = 1;
+        v->allow = rule->allow;
+        v->fs_rule = 1;
+        return;
+    }
 
-    key.dev = (major << 8) | (minor & 0xff);  // Old stat format
-    key.ino = BPF_CORE_READ(inode, i_ino);
-    key.uid = uid;
+    // Filename is copied for debugging only
+    if (log_level >= AID_LOG_ALL) {
+        char fname[64] = {0};
+        bpf_probe_read_kernel_str(fname, sizeof(fname), BPF_CORE_READ(dentry, d_name.name));
+        bpf_printk("[AID] CHECK uid=%u dev=%u:%u ino=%llu file=%s\n",
+                   uid, key.dev >> 20, key.dev & 0xfffff, key.ino, fname);
+    }
 
-    // Try to get filename for debugging
-    const char *filename = BPF_CORE_READ(dentry, d_name.name);
-    char fname[64] = {0};
-    if (filename) {
-        bpf_probe_read_kernel_str(fname, sizeof(fname), filename);
+    perm = aid_policy_lookup(uid, dentry, inode, &key, prof, log_level);
+    if (perm) {
+        v->has_policy = 1;
+        v->allow = perm->allow;
+        if (perm->allow & AID_PERM_READ)
+            return;  // reads granted outright: heuristics (and the name) not needed
     }
 
-    bpf_printk("[AID] CHECK uid=%u dev=%llu ino=%llu mask=0x%x file=%s\n",
-               uid, key.dev, key.ino, mask, fname);
+    // Plain reads of executable files (dynamic linker, libraries, etc.) and
+    // of anything outside a sensitive suffix class need no policy unless the
+    // profile turns that off. This is a pragmatic approach: we only strictly
+    // control writes.
+    // The mode check is free, so it goes before touching the name.
+    if ((prof->flags & AID_PROFILE_EXEC_BIT) && (mode & 0111))
+        v->read_reason = AID_REASON_EXEC_BIT;
+    else if ((prof->flags & AID_PROFILE_SUFFIX_CLASS) && !aid_name_needs_policy(uid, dentry))
+        v->read_reason = AID_REASON_NOT_SENSITIVE;
+}
+
+// Exit reason for an access needing the AID_PERM_* verbs in mask (a MAY_*
+// mask, with MAY_APPEND in place of MAY_WRITE on O_APPEND files), given the
+// file's verdict
+static __always_inline __u8 aid_decide(const struct file_verdict *v, int mask)
+{
+    if (v->type_reason != AID_REASON_MAX)
+        return v->type_reason;
 
     // Allow EXEC unconditionally (including exec+read combinations)
     // When executing a file, kernel may check MAY_EXEC | MAY_READ together
-    if (mask & MAY_EXEC) {
-        bpf_printk("[AID] ALLOW EXEC mask=0x%x\n", mask);
+    if (mask & MAY_EXEC)
+        return AID_REASON_EXEC;
+
+    if (mask == MAY_READ && v->read_reason != AID_REASON_MAX)
+        return v->read_reason;
+
+    if (!v->has_policy)
+        return AID_REASON_NO_POLICY;
+
+    // One test for the whole mask; only a denial looks at which verb
+    __u8 missing = mask & ~v->allow;
+    if (v->fs_rule)
+        return missing ? AID_REASON_FS_DENIED : AID_REASON_FS_MATCH;
+    if (!missing)
+        return AID_REASON_POLICY_MATCH;
+    return (missing & AID_PERM_READ) ? AID_REASON_READ_DENIED : AID_REASON_WRITE_DENIED;
+}
+
+// NO_POLICY is still counted as such under a fail-open profile
+static __always_inline int aid_reason_denies(__u8 reason, const struct agent_profile *prof)
+{
+    if (reason == AID_REASON_NO_POLICY)
+        return !(prof->flags & AID_PROFILE_DEFAULT_ALLOW);
+    return reason == AID_REASON_SOCKET_DENIED ||
+           reason == AID_REASON_READ_DENIED || reason == AID_REASON_WRITE_DENIED ||
+           (reason >= AID_REASON_EXEC_DENIED && reason <= AID_REASON_UNLINK_DENIED) ||
+           reason == AID_REASON_FS_DENIED;
+}
+
+// Shared body of the truncate/create/unlink hooks: does the uid's policy for
+// inode (reached through dentry) grant verb? target is the dentry being
+// truncated, created or removed, for logs and audit. An fs_rules entry for
+// inode's filesystem decides first. Without a policy the access is denied
+// only if no_policy_denies and the profile fails closed.
+static __always_inline int aid_check_verb(struct dentry *dentry, struct inode *inode,
+                                          struct dentry *target, __u8 verb, __u8 deny_reason,
+                                          int no_policy_denies)
+{
+    struct aid_task *task = aid_current_task();
+    __u32 uid = aid_current_agent(task);
+
+    if (!aid_is_agent(uid) || !inode)
         return 0;
+
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile prof;
+    int log_level = AID_LOG_OFF;
+    int permissive = 0;
+
+    aid_load_profile(cfg, task, uid, &prof);
+    if (cfg) {
+        int mode = aid_enforce_mode(cfg, &prof);
+        if (mode == AID_MODE_DISABLED)
+            return 0;
+        permissive = mode == AID_MODE_PERMISSIVE;
+        log_level = aid_log_level(cfg, uid);
     }
 
-    // Also allow pure READ on executable files (for dynamic linker, libraries, etc.)
-    // This is a pragmatic approach: we only strictly control writes
-    if (mask == MAY_READ) {
+    struct aid_verdict_stats *stats = aid_stats(uid);
+    struct fs_rule *rule = aid_fs_rule(inode);
+    __u8 allow;
 
-        int len = 0;
-        #pragma unroll
-        for (int i = 0; i < sizeof(fname); i++) {
-            if (fname[i] == '\0')
-                break;
-            len++;
-        }
+    if (rule) {
+        allow = rule->allow;
+    } else {
+        struct inode_key key = {};
+        aid_inode_key(inode, &key);
 
-        if (len >= 4) {
-            if (!(fname[len - 4] == '.' &&
-                fname[len - 3] == 't' &&
-                fname[len - 2] == 'x' &&
-                fname[len - 1] == 't')) {
-                return 0;
-            }
-        }
+        struct file_perm *perm = aid_policy_lookup(uid, dentry, inode, &key, &prof, log_level);
+        if (!perm && (!no_policy_denies || (prof.flags & AID_PROFILE_DEFAULT_ALLOW)))
+            return 0;
+        allow = perm ? perm->allow : 0;
+    }
+
+    __u64 ino = BPF_CORE_READ(inode, i_ino);
+    __u32 dev = BPF_CORE_READ(inode, i_sb, s_dev);
+
+    if (allow & verb) {
+        __u8 reason = rule ? AID_REASON_FS_MATCH : AID_REASON_POLICY_MATCH;
+        aid_log(AID_LOG_ALL, "[AID] ALLOW uid=%u verb=0x%x\n", uid, verb);
+        aid_count(reason);
+        aid_record(cfg, uid, ino, dev, verb, reason, AID_VERDICT_ALLOW);
+        return 0;
+    }
+    if (rule)
+        deny_reason = AID_REASON_FS_DENIED;
+
+    aid_count(deny_reason);
+    aid_record(cfg, uid, ino, dev, verb, deny_reason,
+               permissive ? AID_VERDICT_PERMISSIVE : AID_VERDICT_DENY);
+    if (log_level >= AID_LOG_DENY) {
+        char fname[64] = {0};
+        bpf_probe_read_kernel_str(fname, sizeof(fname), BPF_CORE_READ(target, d_name.name));
+        bpf_printk("[AID] DENY uid=%u verb=0x%x reason=%u file=%s\n",
+                   uid, verb, deny_reason, fname);
+    }
+    aid_audit(cfg, &prof, uid, inode, target, verb, deny_reason, permissive);
+    return aid_deny();
+}
+
+// LSM: inode_init_security - a file or directory an agent creates inside a
+// directory with a plain grant gets a copy of that grant, so later opens are
+// a direct hit instead of "no policy". A regular file only gets the file
+// verbs: create/unlink on the directory say nothing about the new file.
+// Subtree grants already cover new files through the d_parent walk and are
+// not copied.
+SEC("lsm/inode_init_security")
+int BPF_PROG(aid_inode_init, struct inode *inode, struct inode *dir)
+{
+    struct aid_task *task = aid_current_task();
+    __u32 uid = aid_current_agent(task);
+
+    if (!aid_is_agent(uid))
+        return 0;
+
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile prof;
+    int log_level = AID_LOG_OFF;
+
+    aid_load_profile(cfg, task, uid, &prof);
+    if (!cfg || aid_enforce_mode(cfg, &prof) == AID_MODE_DISABLED)
+        return 0;
+    log_level = aid_log_level(cfg, uid);
+
+    umode_t mode = BPF_CORE_READ(inode, i_mode);
+    if (!S_ISREG(mode) && !S_ISDIR(mode))
+        return 0;
+    __u8 verbs = S_ISREG(mode) ? AID_PERM_FILE_VERBS : 0xff;
+
+    if (cfg->policy_store == AID_STORE_INODE) {
+        struct file_perm *grant = aid_slot_lookup(bpf_inode_storage_get(&inode_store, dir, 0, 0),
+                                                  uid, &prof);
+        if (!grant || (grant->flags & AID_POLICY_SUBTREE))
+            return 0;
 
-        // If file has any execute bit, allow read
-        if (mode & 0111) {
-            bpf_printk("[AID] ALLOW executable file mode=0x%x\n", mode);
+        // A new inode has no storage yet: created zeroed, the grant goes in slot 0
+        struct aid_inode_policy *ip = bpf_inode_storage_get(&inode_store, inode, 0,
+                                                            BPF_LOCAL_STORAGE_GET_F_CREATE);
+        if (!ip)
             return 0;
+        ip->slot[0].perm.allow = grant->allow & verbs;
+        ip->slot[0].perm.flags = AID_POLICY_INHERITED;
+        ip->slot[0].perm.last_use = aid_now_sec();
+        ip->slot[0].epoch = prof.epoch;
+        ip->slot[0].uid = uid;
+        aid_log(AID_LOG_ALL, "[AID] Inherited inode policy allow=0x%x\n", grant->allow & verbs);
+        return 0;
+    }
+
+    void *inner = bpf_map_lookup_elem(&inode_policies, &uid);
+    if (!inner)
+        return 0;
+
+    struct inode_key key = {};
+    aid_inode_key(dir, &key);
+
+    struct file_perm *parent = bpf_map_lookup_elem(inner, &key);
+    if (!parent || (parent->flags & AID_POLICY_SUBTREE))
+        return 0;
+
+    struct file_perm perm = {
+        .allow = parent->allow & verbs,
+        .flags = AID_POLICY_INHERITED,
+        .i_generation = BPF_CORE_READ(inode, i_generation),
+        .last_use = aid_now_sec(),
+    };
+
+    key.ino = BPF_CORE_READ(inode, i_ino);
+    // Fails once the agent's map is full (AID_INNER_MIN_FREE headroom): the
+    // file is created without an entry, counted for aid_top
+    if (bpf_map_update_elem(inner, &key, &perm, BPF_ANY) == 0) {
+        bpf_map_push_elem(&policy_bloom, &key, BPF_ANY);
+    } else {
+        struct aid_verdict_stats *stats = aid_stats(uid);
+        aid_count(AID_REASON_INHERIT_FULL);
+        aid_log(AID_LOG_DENY, "[AID] No inherited policy, map full ino=%llu\n", key.ino);
+        return 0;
+    }
+    aid_log(AID_LOG_ALL, "[AID] Inherited policy ino=%llu allow=0x%x\n",
+            key.ino, perm.allow);
+
+    // Not providing an xattr; 0 keeps the other LSMs' hooks running
+    return 0;
+}
+
+// LSM: file_open - evaluate once per open and cache the verdict. The open
+// execve() does is also where the exec verb is checked: a file with a
+// per-inode policy must grant exec, files without one (system binaries) run
+// freely. fs rules do not gate exec, so "/usr r" still runs /usr/bin.
+SEC("lsm/file_open")
+int BPF_PROG(aid_file_open, struct file *file)
+{
+    struct aid_task *task = aid_current_task();
+    __u32 uid = aid_current_agent(task);
+
+    if (!aid_is_agent(uid))
+        return 0;
+
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile prof;
+    int log_level = AID_LOG_OFF;
+    int permissive, mode;
+
+    if (!cfg)
+        return 0;
+    aid_load_profile(cfg, task, uid, &prof);
+    mode = aid_enforce_mode(cfg, &prof);
+    if (mode == AID_MODE_DISABLED)
+        return 0;
+    log_level = aid_log_level(cfg, uid);
+    permissive = mode == AID_MODE_PERMISSIVE;
+
+    int exec = BPF_CORE_READ(file, f_flags) & __FMODE_EXEC;
+    int cache = cfg->verdict_cache && aid_cacheable(file, uid);
+    if (!exec && !cache)
+        return 0;
+
+    struct file_verdict v;
+    __u64 key = (__u64)file;
+
+    aid_evaluate(file, uid, &prof, log_level, &v);
+
+    if (exec && v.type_reason == AID_REASON_MAX && v.has_policy && !v.fs_rule &&
+        !(v.allow & AID_PERM_EXEC)) {
+        struct aid_verdict_stats *stats = aid_stats(uid);
+        struct dentry *dentry = BPF_CORE_READ(file, f_path.dentry);
+
+        aid_count(AID_REASON_EXEC_DENIED);
+        aid_record(cfg, uid, v.ino, v.dev, MAY_EXEC, AID_REASON_EXEC_DENIED,
+                   permissive ? AID_VERDICT_PERMISSIVE : AID_VERDICT_DENY);
+        if (log_level >= AID_LOG_DENY) {
+            char fname[64] = {0};
+            bpf_probe_read_kernel_str(fname, sizeof(fname), BPF_CORE_READ(dentry, d_name.name));
+            bpf_printk("[AID] DENY uid=%u exec file=%s\n", uid, fname);
         }
+        aid_audit(cfg, &prof, uid, BPF_CORE_READ(file, f_inode), dentry, MAY_EXEC,
+                  AID_REASON_EXEC_DENIED, permissive);
+        if (!permissive)
+            return -EACCES;
+    }
 
-        // // Allow READ from system library directories
-        // // Get path from dentry chain
-        // struct dentry *d = dentry;
-        // char path[256] = {0};
-        // int pos = 255;
-
-        // // Walk up dentry tree to build path (backwards)
-        // #pragma unroll
-        // for (int i = 0; i < 20; i++) {
-        //     if (!d) break;
-
-        //     const char *name = BPF_CORE_READ(d, d_name.name);
-        //     if (!name) break;
-
-        //     // Read name into buffer
-        //     char namebuf[64];
-        //     bpf_probe_read_kernel_str(namebuf, sizeof(namebuf), name);
-
-        //     bpf_printk("[AID] LOGLOG file=%s namebuf=%s\n", fname, namebuf);
-
-        //     // Allow READ from other files than *.txt
-        //     if (!(namebuf[0] == 'h' && namebuf[1] == 'o' && namebuf[2] == 'm' && namebuf[3] == 'e' && namebuf[4] == '\0')) {
-        //         bpf_printk("[AID] ALLOW READ from system files\n");
-        //         return 0;
-        //     }
-        //     // Check for system directories at any level
-        //     // if (namebuf[0] == 'l' && namebuf[1] == 'i' && namebuf[2] == 'b' && namebuf[3] == '\0') {
-        //     //     // Found "lib" directory
-        //     //     bpf_printk("[AID] ALLOW READ from /lib or /usr/lib\n");
-        //     //     return 0;
-        //     // }
-        //     // if (namebuf[0] == 'u' && namebuf[1] == 's' && namebuf[2] == 'r' && namebuf[3] == '\0') {
-        //     //     // Found "usr" directory - likely /usr/lib
-        //     //     struct dentry *parent = BPF_CORE_READ(d, d_parent);
-        //     //     if (parent) {
-        //     //         const char *pname = BPF_CORE_READ(parent, d_name.name);
-        //     //         char pbuf[8];
-        //     //         if (pname) {
-        //     //             bpf_probe_read_kernel_str(pbuf, sizeof(pbuf), pname);
-        //     //             // If parent is "lib", this is /usr/lib
-        //     //             if (pbuf[0] == 'l' && pbuf[1] == 'i' && pbuf[2] == 'b' && pbuf[3] == '\0') {
-        //     //                 bpf_printk("[AID] ALLOW READ from /usr/lib\n");
-        //     //                 return 0;
-        //     //             }
-        //     //         }
-        //     //     }
-        //     // }
-
-        //     // Move to parent
-        //     d = BPF_CORE_READ(d, d_parent);
-        //     if (d == BPF_CORE_READ(d, d_parent)) break; // reached root
-        // }
-    }
-
-    // First, check if there's a policy for this specific inode
-    perm = bpf_map_lookup_elem(&inode_policies, &key);
-    if (!perm) {
-        bpf_printk("[AID] DENY no policy file=%s dev=%llu ino=%llu\n", fname, key.dev, key.ino);
-        return -EACCES;
+    if (cache) {
+        v.gen = cfg->policy_gen;
+        bpf_map_update_elem(&file_verdicts, &key, &v, BPF_ANY);
+    }
+    return 0;
+}
+
+// LSM (sleepable): file_open - the first time an agent opens an inode, read
+// its AID_LABEL_XATTR into label_cache for the non-sleepable hooks. The
+// loader attaches it before aid_file_open. If the trampoline runs it after
+// instead, the verdict aid_file_open just cached did not see the label, so
+// it is dropped and file_permission evaluates again.
+SEC("lsm.s/file_open")
+int BPF_PROG(aid_file_label, struct file *file)
+{
+    __u32 uid = aid_current_agent(aid_current_task());
+
+    if (!aid_is_agent(uid))
+        return 0;
+
+    struct aid_label_cache *c = bpf_inode_storage_get(&label_cache, file->f_inode, 0,
+                                                      BPF_LOCAL_STORAGE_GET_F_CREATE);
+    if (!c || c->state != AID_LABEL_UNKNOWN)
+        return 0;
+
+    char value[AID_LABEL_LEN] = {};
+    struct bpf_dynptr ptr;
+    bpf_dynptr_from_mem(value, sizeof(value), 0, &ptr);
+
+    // Longer values do not fit (-ERANGE) and are no label
+    int len = bpf_get_file_xattr(file, AID_LABEL_XATTR, &ptr);
+    if (len > 0 && len <= AID_LABEL_LEN) {
+        __builtin_memcpy(c->label, value, AID_LABEL_LEN);
+        c->state = AID_LABEL_SET;
+        __u64 key = (__u64)file;
+        bpf_map_delete_elem(&file_verdicts, &key);
     } else {
-        bpf_printk("[AID] Found direct policy read=%d write=%d\n",
-                   perm->allow_read, perm->allow_write);
+        c->state = AID_LABEL_NONE;
     }
+    return 0;
+}
+
+// LSM: inode_post_setxattr/inode_post_removexattr - read the label again at
+// the next open. Any xattr change resets it; they are rare.
+SEC("lsm/inode_post_setxattr")
+int BPF_PROG(aid_label_set, struct dentry *dentry)
+{
+    bpf_inode_storage_delete(&label_cache, dentry->d_inode);
+    return 0;
+}
+
+SEC("lsm/inode_post_removexattr")
+int BPF_PROG(aid_label_remove, struct dentry *dentry)
+{
+    bpf_inode_storage_delete(&label_cache, dentry->d_inode);
+    return 0;
+}
+
+// LSM: inode_rename - a file renamed over a labelled one (the atomic
+// replace of editors and package tools) keeps the label it replaces unless
+// it has its own. This lives in label_cache only: once the new inode is
+// evicted its label is read from disk again, so writers that should keep
+// it must copy the xattr (or addagent stamps it again).
+SEC("lsm/inode_rename")
+int BPF_PROG(aid_label_rename, struct inode *old_dir, struct dentry *old_dentry,
+             struct inode *new_dir, struct dentry *new_dentry)
+{
+    struct inode *replaced = new_dentry->d_inode;
+    if (!replaced)
+        return 0;
 
-    // Check MAY_READ / MAY_WRITE bits in mask
-    if ((mask & MAY_READ) && !perm->allow_read) {
-        bpf_printk("[AID] DENY READ not allowed file=%s\n", fname);
-        return -EACCES;
+    struct aid_label_cache *old = bpf_inode_storage_get(&label_cache, replaced, 0, 0);
+    if (!old || old->state != AID_LABEL_SET)
+        return 0;
+
+    struct aid_label_cache *c = bpf_inode_storage_get(&label_cache, old_dentry->d_inode, 0,
+                                                      BPF_LOCAL_STORAGE_GET_F_CREATE);
+    if (!c || c->state == AID_LABEL_SET)
+        return 0;
+    __builtin_memcpy(c->label, old->label, AID_LABEL_LEN);
+    c->state = AID_LABEL_SET;
+    return 0;
+}
+
+// file_permission body: called on every read/write; a cached verdict
+// reduces it to one lookup. With dispatch, an agent that has a specialized
+// program in agent_progs continues there instead.
+static __always_inline int aid_file_permission(void *ctx, struct file *file, int mask,
+                                               int dispatch)
+{
+    struct aid_task *task = aid_current_task();
+    __u32 uid = aid_current_agent(task);
+
+    if (!aid_is_agent(uid)) {
+        return 0;
     }
 
-    if ((mask & MAY_WRITE) && !perm->allow_write) {
-        bpf_printk("[AID] DENY WRITE not allowed file=%s\n", fname);
-        return -EACCES;
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile prof;
+    int log_level = AID_LOG_OFF;
+    int permissive = 0;
+    int use_cache = 0;
+    __u32 gen = 0;
+    __u64 start = 0;
+
+    // Falls through when the agent has no program in its slot
+    if (dispatch && cfg && cfg->specialize)
+        bpf_tail_call(ctx, &agent_progs, uid - AID_UID_BASE);
+
+    // Timed from here: the profile load, evaluation and logging of an
+    // agent's access, not the uid check every other process pays
+    if (cfg && cfg->latency_hist)
+        start = bpf_ktime_get_ns();
+
+    aid_load_profile(cfg, task, uid, &prof);
+    if (cfg) {
+        int mode = aid_enforce_mode(cfg, &prof);
+        if (mode == AID_MODE_DISABLED)
+            return 0;
+        permissive = mode == AID_MODE_PERMISSIVE;
+        log_level = aid_log_level(cfg, uid);
+        use_cache = cfg->verdict_cache;
+        gen = cfg->policy_gen;
+    }
+
+    struct aid_verdict_stats *stats = aid_stats(uid);
+    struct file_verdict *v = 0;
+    struct file_verdict fresh;
+    __u64 key = (__u64)file;
+
+    if (use_cache)
+        v = bpf_map_lookup_elem(&file_verdicts, &key);
+
+    if (!v || v->uid != uid || v->gen != gen) {
+        // EXEC is allowed whatever the file is: skip the evaluation
+        if (mask & MAY_EXEC) {
+            aid_log(AID_LOG_ALL, "[AID] ALLOW EXEC mask=0x%x\n", mask);
+            aid_count(AID_REASON_EXEC);
+            aid_record(cfg, uid, 0, 0, mask, AID_REASON_EXEC, AID_VERDICT_ALLOW);
+            aid_latency(start, AID_REASON_EXEC);
+            return 0;
+        }
+
+        aid_evaluate(file, uid, &prof, log_level, &fresh);
+        fresh.gen = gen;
+        if (use_cache && aid_cacheable(file, uid))
+            bpf_map_update_elem(&file_verdicts, &key, &fresh, BPF_ANY);
+        v = &fresh;
+    }
+
+    aid_hh_sample(cfg, uid, v->ino, v->dev);
+
+    // Writes through an O_APPEND fd only need the append verb
+    int need = mask;
+    if ((mask & MAY_WRITE) && (BPF_CORE_READ(file, f_flags) & O_APPEND))
+        need = (mask & ~MAY_WRITE) | MAY_APPEND;
+
+    __u8 reason = aid_decide(v, need);
+    aid_count(reason);
+
+    if (!aid_reason_denies(reason, &prof)) {
+        aid_log(AID_LOG_ALL, "[AID] ALLOW uid=%u mask=0x%x reason=%u\n", uid, mask, reason);
+        aid_record(cfg, uid, v->ino, v->dev, mask, reason, AID_VERDICT_ALLOW);
+        aid_latency(start, reason);
+        return 0;
+    }
+
+    // Slow path: only denials touch the dentry/inode again
+    struct dentry *dentry = BPF_CORE_READ(file, f_path.dentry);
+    struct inode *inode = BPF_CORE_READ(file, f_inode);
+
+    if (log_level >= AID_LOG_DENY) {
+        char fname[64] = {0};
+        bpf_probe_read_kernel_str(fname, sizeof(fname), BPF_CORE_READ(dentry, d_name.name));
+        bpf_printk("[AID] DENY uid=%u mask=0x%x reason=%u file=%s\n", uid, mask, reason, fname);
     }
+    aid_audit(cfg, &prof, uid, inode, dentry, mask, reason, permissive);
+    aid_record(cfg, uid, v->ino, v->dev, mask, reason,
+               permissive ? AID_VERDICT_PERMISSIVE : AID_VERDICT_DENY);
+    aid_latency(start, reason);
+    return aid_deny();
+}
+
+SEC("lsm/file_permission")
+int BPF_PROG(aid_enforce_file_permission, struct file *file, int mask)
+{
+    return aid_file_permission(ctx, file, mask, 1);
+}
 
-    bpf_printk("[AID] ALLOW policy match\n");
+// Not attached: slot AID_SPEC_GENERIC of agent_progs, where a specialized
+// program sends what it cannot decide
+SEC("lsm/file_permission")
+int BPF_PROG(aid_file_permission_generic, struct file *file, int mask)
+{
+    return aid_file_permission(ctx, file, mask, 0);
+}
+
+// LSM: file_free_security - drop the cached verdict with the struct file
+SEC("lsm/file_free_security")
+int BPF_PROG(aid_file_free, struct file *file)
+{
+    __u32 uid = BPF_CORE_READ(file, f_cred, uid.val);
+
+    if (!aid_is_agent(uid))
+        return 0;
+
+    __u64 key = (__u64)file;
+    bpf_map_delete_elem(&file_verdicts, &key);
     return 0;
 }
+
+// LSM: task_alloc - a process or thread forked by a task hire started
+// belongs to the same agent and session, and starts from its profile
+SEC("lsm/task_alloc")
+int BPF_PROG(aid_task_alloc, struct task_struct *task, unsigned long clone_flags)
+{
+    struct aid_task *parent = aid_current_task();
+    if (!parent)
+        return 0;
+
+    struct aid_task *child = bpf_task_storage_get(&aid_tasks, task, 0,
+                                                  BPF_LOCAL_STORAGE_GET_F_CREATE);
+    if (child)
+        *child = *parent;
+    return 0;
+}
+
+// LSM: path_truncate - truncate(2) of a regular file needs the truncate
+// verb; without a policy it is denied like a write would be
+SEC("lsm/path_truncate")
+int BPF_PROG(aid_path_truncate, const struct path *path)
+{
+    struct dentry *dentry = path->dentry;
+    struct inode *inode = dentry->d_inode;
+
+    if (!S_ISREG(BPF_CORE_READ(inode, i_mode)))
+        return 0;
+    return aid_check_verb(dentry, inode, dentry, AID_PERM_TRUNCATE,
+                          AID_REASON_TRUNC_DENIED, 1);
+}
+
+// LSM: file_truncate - ftruncate(2) and open(O_TRUNC) go through this hook
+// instead of path_truncate since 6.2. Without it an append-only file opened
+// with O_APPEND passes the write check and can still be emptied.
+SEC("lsm/file_truncate")
+int BPF_PROG(aid_file_truncate, struct file *file)
+{
+    struct dentry *dentry = file->f_path.dentry;
+    struct inode *inode = file->f_inode;
+
+    if (!S_ISREG(BPF_CORE_READ(inode, i_mode)))
+        return 0;
+    return aid_check_verb(dentry, inode, dentry, AID_PERM_TRUNCATE,
+                          AID_REASON_TRUNC_DENIED, 1);
+}
+
+// LSM: inode_create/inode_mkdir - creating in a directory with a policy
+// needs its create verb; directories without one are not gated here (files
+// created there have no policy, so writing them is denied anyway)
+SEC("lsm/inode_create")
+int BPF_PROG(aid_inode_create, struct inode *dir, struct dentry *dentry)
+{
+    return aid_check_verb(dentry->d_parent, dir, dentry,
+                          AID_PERM_CREATE, AID_REASON_CREATE_DENIED, 0);
+}
+
+SEC("lsm/inode_mkdir")
+int BPF_PROG(aid_inode_mkdir, struct inode *dir, struct dentry *dentry)
+{
+    return aid_check_verb(dentry->d_parent, dir, dentry,
+                          AID_PERM_CREATE, AID_REASON_CREATE_DENIED, 0);
+}
+
+// LSM: inode_unlink/inode_rmdir - the same for removing an entry
+SEC("lsm/inode_unlink")
+int BPF_PROG(aid_inode_unlink, struct inode *dir, struct dentry *dentry)
+{
+    return aid_check_verb(dentry->d_parent, dir, dentry,
+                          AID_PERM_UNLINK, AID_REASON_UNLINK_DENIED, 0);
+}
+
+SEC("lsm/inode_rmdir")
+int BPF_PROG(aid_inode_rmdir, struct inode *dir, struct dentry *dentry)
+{
+    return aid_check_verb(dentry->d_parent, dir, dentry,
+                          AID_PERM_UNLINK, AID_REASON_UNLINK_DENIED, 0);
+}
+
+// Shared body of the cgroup connect/sendmsg programs: key holds the
+// destination address and port (uid filled in here). 1 lets the call
+// through, 0 fails it with -EPERM. Only AF_INET/AF_INET6 reach these
+// programs; unix sockets are not covered.
+static __always_inline int aid_check_connect(struct net_rule_key *key)
+{
+    __u32 uid = bpf_get_current_uid_gid() & 0xffffffff;
+
+    if (!aid_is_agent(uid))
+        return 1;
+
+    __u32 zero = 0;
+    struct aid_config *cfg = bpf_map_lookup_elem(&aid_config, &zero);
+    struct agent_profile prof;
+    int log_level = AID_LOG_OFF;
+    int permissive = 0;
+
+    // Classified by cred uid, not aid_tasks: cgroup programs get no task
+    // storage helpers, so session overrides do not reach network decisions
+    aid_load_profile(cfg, 0, uid, &prof);
+    if (cfg) {
+        int mode = aid_enforce_mode(cfg, &prof);
+        if (mode == AID_MODE_DISABLED)
+            return 1;
+        permissive = mode == AID_MODE_PERMISSIVE;
+        log_level = aid_log_level(cfg, uid);
+    }
+
+    struct aid_verdict_stats *stats = aid_stats(uid);
+
+    if (prof.flags & AID_PROFILE_NET_ANY) {
+        aid_count(AID_REASON_SOCKET);
+        return 1;
+    }
+
+    // Exact port first, then the agent's "any port" entries
+    key->uid = uid;
+    struct net_rule *rule = bpf_map_lookup_elem(&net_rules, key);
+    if (!rule) {
+        __u16 port = key->port;
+        key->port = 0;
+        rule = bpf_map_lookup_elem(&net_rules, key);
+        key->port = port;
+    }
+    if (rule && rule->allow) {
+        aid_log(AID_LOG_ALL, "[AID] ALLOW uid=%u connect port=%u\n", uid, key->port);
+        aid_count(AID_REASON_SOCKET);
+        return 1;
+    }
+
+    aid_count(AID_REASON_SOCKET_DENIED);
+    aid_log(AID_LOG_DENY, "[AID] DENY uid=%u connect port=%u\n", uid, key->port);
+    aid_audit_net(cfg, &prof, uid, key, permissive);
+    aid_record(cfg, uid, 0, 0, key->port, AID_REASON_SOCKET_DENIED,
+               permissive ? AID_VERDICT_PERMISSIVE : AID_VERDICT_DENY);
+    return permissive;
+}
+
+// IPv4 destination as IPv4-mapped IPv6; user_ip4/user_port are network order
+static __always_inline int aid_check_connect4(struct bpf_sock_addr *ctx)
+{
+    struct net_rule_key key = { .prefixlen = AID_NET_PREFIX_BASE + 128 };
+    __u32 ip4 = ctx->user_ip4;
+
+    key.port = bpf_ntohs((__u16)ctx->user_port);
+    key.addr[10] = 0xff;
+    key.addr[11] = 0xff;
+    __builtin_memcpy(&key.addr[12], &ip4, sizeof(ip4));
+    return aid_check_connect(&key);
+}
+
+static __always_inline int aid_check_connect6(struct bpf_sock_addr *ctx)
+{
+    struct net_rule_key key = { .prefixlen = AID_NET_PREFIX_BASE + 128 };
+    __u32 ip6[4];
+
+    ip6[0] = ctx->user_ip6[0];
+    ip6[1] = ctx->user_ip6[1];
+    ip6[2] = ctx->user_ip6[2];
+    ip6[3] = ctx->user_ip6[3];
+    key.port = bpf_ntohs((__u16)ctx->user_port);
+    __builtin_memcpy(key.addr, ip6, sizeof(ip6));
+    return aid_check_connect(&key);
+}
+
+// cgroup connect4/connect6: connect(2) of TCP and connected UDP sockets
+SEC("cgroup/connect4")
+int aid_connect4(struct bpf_sock_addr *ctx)
+{
+    return aid_check_connect4(ctx);
+}
+
+SEC("cgroup/connect6")
+int aid_connect6(struct bpf_sock_addr *ctx)
+{
+    return aid_check_connect6(ctx);
+}
+
+// cgroup sendmsg4/sendmsg6: sendto(2)/sendmsg(2) with an address on an
+// unconnected UDP socket (DNS lookups, among others)
+SEC("cgroup/sendmsg4")
+int aid_sendmsg4(struct bpf_sock_addr *ctx)
+{
+    return aid_check_connect4(ctx);
+}
+
+SEC("cgroup/sendmsg6")
+int aid_sendmsg6(struct bpf_sock_addr *ctx)
+{
+    return aid_check_connect6(ctx);
+}
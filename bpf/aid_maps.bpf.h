@@ -0,0 +1,172 @@
+// bpf/aid_maps.bpf.h
+// SPDX-License-Identifier: GPL-2.0
+//
+// Kernel constants, maps and helpers both BPF objects use. aid_lsm.bpf.o
+// creates and pins the maps; addagent loads aid_agent.bpf.o with the pinned
+// ones reused, which needs the definitions to match exactly.
+
+#ifndef __AID_MAPS_BPF_H
+#define __AID_MAPS_BPF_H
+
+#define MAY_EXEC  0x00000001
+#define MAY_WRITE 0x00000002
+#define MAY_READ  0x00000004
+#define MAY_APPEND 0x00000008
+
+// File flags (from uapi/asm-generic/fcntl.h, include/linux/fs.h)
+#define O_APPEND     00002000
+#define __FMODE_EXEC 0x20
+
+#define EACCES 13
+
+// File type macros (from linux/stat.h)
+#define S_IFMT   00170000
+#define S_IFBLK  0060000
+#define S_IFCHR  0020000
+#define S_IFSOCK 0140000
+#define S_IFREG  0100000
+#define S_IFDIR  0040000
+
+#define S_ISBLK(m)  (((m) & S_IFMT) == S_IFBLK)
+#define S_ISCHR(m)  (((m) & S_IFMT) == S_IFCHR)
+#define S_ISSOCK(m) (((m) & S_IFMT) == S_IFSOCK)
+#define S_ISREG(m)  (((m) & S_IFMT) == S_IFREG)
+#define S_ISDIR(m)  (((m) & S_IFMT) == S_IFDIR)
+
+// Runtime control plane (verbosity, enforcement mode, per-uid debug mask).
+// mmap()ed by aid_ctl, so it can be flipped without reloading.
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __uint(map_flags, BPF_F_MMAPABLE);
+    __type(key, __u32);
+    __type(value, struct aid_config);
+    __uint(max_entries, 1);
+} aid_config SEC(".maps");
+
+// Template of the per-agent inner maps addagent creates; BPF_F_INNER_MAP
+// lets each one have its own max_entries
+struct inode_policy_map {
+    __uint(type, BPF_MAP_TYPE_HASH);
+    __uint(map_flags, AID_INNER_MAP_FLAGS);
+    __type(key, struct inode_key);
+    __type(value, struct file_perm);
+    __uint(max_entries, AID_INNER_MIN_FREE);
+};
+
+// uid -> that agent's inode_key -> file_perm map
+struct {
+    __uint(type, BPF_MAP_TYPE_HASH_OF_MAPS);
+    __type(key, __u32);  // uid
+    __uint(max_entries, 1024);
+    __array(values, struct inode_policy_map);
+} inode_policies SEC(".maps");
+
+// (uid - AID_UID_BASE) -> agent_profile, loaded once at each hook's entry
+struct {
+    __uint(type, BPF_MAP_TYPE_ARRAY);
+    __type(key, __u32);
+    __type(value, struct agent_profile);
+    __uint(max_entries, AID_NR_UIDS);
+} agent_profiles SEC(".maps");
+
+// task -> aid_task, written by hire through a pidfd and copied at fork
+struct {
+    __uint(type, BPF_MAP_TYPE_TASK_STORAGE);
+    __uint(map_flags, BPF_F_NO_PREALLOC);
+    __type(key, int);
+    __type(value, struct aid_task);
+} aid_tasks SEC(".maps");
+
+// uid - AID_UID_BASE -> the agent's specialized file_permission (addagent),
+// AID_SPEC_GENERIC -> aid_file_permission_generic (the loader)
+struct {
+    __uint(type, BPF_MAP_TYPE_PROG_ARRAY);
+    __uint(key_size, sizeof(__u32));
+    __uint(value_size, sizeof(__u32));
+    __uint(max_entries, AID_NR_UIDS + 1);
+} agent_progs SEC(".maps");
+
+// uid -> per-CPU count of each exit reason, read by aid_top
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_HASH);
+    __type(key, __u32);  // uid
+    __type(value, struct aid_verdict_stats);
+    __uint(max_entries, 1024);
+} verdict_stats SEC(".maps");
+
+// Per-CPU ring of the last AID_FLIGHT_LEN decisions; see aid_record()
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, struct aid_flight_rec);
+    __uint(max_entries, AID_FLIGHT_LEN);
+} flight_recorder SEC(".maps");
+
+// This CPU's next flight_recorder slot (free-running)
+struct {
+    __uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+    __type(key, __u32);
+    __type(value, __u32);
+    __uint(max_entries, 1);
+} flight_head SEC(".maps");
+
+#define aid_count(reason)                           \
+    do {                                            \
+        if (stats)                                  \
+            stats->count[(reason)]++;               \
+    } while (0)
+
+// This CPU's counter slot for uid, created on the agent's first access
+static __always_inline struct aid_verdict_stats *aid_stats(__u32 uid)
+{
+    struct aid_verdict_stats *stats = bpf_map_lookup_elem(&verdict_stats, &uid);
+    if (stats)
+        return stats;
+
+    struct aid_verdict_stats init = {};
+    bpf_map_update_elem(&verdict_stats, &uid, &init, BPF_NOEXIST);
+    return bpf_map_lookup_elem(&verdict_stats, &uid);
+}
+
+// Overwrite the oldest slot of this CPU's flight recorder ring. Both maps
+// are per-CPU and programs do not migrate, so no locks or atomics; a
+// program preempted mid-write by another on the same CPU can at worst
+// leave one torn record.
+static __always_inline void aid_record(const struct aid_config *cfg, __u32 uid,
+                                       __u64 ino, __u32 dev, int mask,
+                                       __u8 reason, __u8 verdict)
+{
+    __u32 zero = 0;
+
+    if (!cfg || !cfg->flight_recorder)
+        return;
+
+    __u32 *head = bpf_map_lookup_elem(&flight_head, &zero);
+    if (!head)
+        return;
+    __u32 idx = (*head)++ & (AID_FLIGHT_LEN - 1);
+    struct aid_flight_rec *rec = bpf_map_lookup_elem(&flight_recorder, &idx);
+    if (!rec)
+        return;
+
+    rec->ts_ns = bpf_ktime_get_boot_ns();
+    rec->ino = ino;
+    rec->dev = dev;
+    rec->uid = uid;
+    rec->pid = bpf_get_current_pid_tgid() >> 32;
+    rec->mask = (__u16)mask;
+    rec->reason = reason;
+    rec->verdict = verdict;
+}
+
+// Effective enforcement mode. A global "disabled" wins over every profile so
+// aid_ctl can still switch the whole module off.
+static __always_inline int aid_enforce_mode(const struct aid_config *cfg,
+                                            const struct agent_profile *prof)
+{
+    if (cfg->enforce_mode == AID_MODE_DISABLED || prof->enforce_mode == AID_PROFILE_INHERIT)
+        return cfg->enforce_mode;
+    return prof->enforce_mode;
+}
+
+#endif /* __AID_MAPS_BPF_H */
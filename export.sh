@@ -15,10 +15,14 @@ sudo ln -sf "$HOME/hire/src/hire" /usr/local/bin/hire
 sudo ln -sf "$HOME/hire/src/addagent" /usr/local/bin/addagent
 sudo ln -sf "$HOME/hire/src/aid_lsm_loader" /usr/local/bin/aid_lsm_loader
 sudo ln -sf "$HOME/hire/src/dump_policies" /usr/local/bin/dump_policies
+sudo ln -sf "$HOME/hire/src/aid_ctl" /usr/local/bin/aid_ctl
+sudo ln -sf "$HOME/hire/src/aid_auditd" /usr/local/bin/aid_auditd
+sudo ln -sf "$HOME/hire/src/aid_top" /usr/local/bin/aid_top
+sudo ln -sf "$HOME/hire/src/aid_hot" /usr/local/bin/aid_hot
 
 if [ $? -eq 0 ]; then
     echo "✓ Symlinks created successfully"
-    echo "  - hire, addagent, aid_lsm_loader, dump_policies are now available with sudo"
+    echo "  - hire, addagent, aid_lsm_loader, dump_policies, aid_ctl, aid_auditd, aid_top, aid_hot are now available with sudo"
 else
     echo "✗ Failed to create symlinks (may need sudo privileges)"
 fi
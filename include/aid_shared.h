@@ -10,41 +10,589 @@
 
 #define AID_UID_BASE 50000
 #define AID_UID_MAX  60000
+#define AID_NR_UIDS  (AID_UID_MAX - AID_UID_BASE)
 
-// inode + uid key
-struct inode_uid_key {
+#define AID_CONFIG_MAP_PATH "/sys/fs/bpf/aid_config"
+#define AID_EVENTS_MAP_PATH "/sys/fs/bpf/aid_events"
+#define AID_STATS_MAP_PATH  "/sys/fs/bpf/aid_verdict_stats"
+#define AID_BLOOM_MAP_PATH  "/sys/fs/bpf/aid_policy_bloom"
+#define AID_PROFILES_MAP_PATH "/sys/fs/bpf/aid_agent_profiles"
+#define AID_FS_RULES_MAP_PATH "/sys/fs/bpf/aid_fs_rules"
+#define AID_NET_RULES_MAP_PATH "/sys/fs/bpf/aid_net_rules"
+#define AID_SUFFIX_MAP_PATH "/sys/fs/bpf/aid_suffix_classes"
+#define AID_LATENCY_MAP_PATH "/sys/fs/bpf/aid_latency_hist"
+#define AID_FLIGHT_MAP_PATH "/sys/fs/bpf/aid_flight_recorder"
+#define AID_FLIGHT_HEAD_PATH "/sys/fs/bpf/aid_flight_head"
+#define AID_HH_SKETCH_MAP_PATH "/sys/fs/bpf/aid_hh_sketch"
+#define AID_HH_CAND_MAP_PATH   "/sys/fs/bpf/aid_hh_candidates"
+#define AID_INODE_STORE_PATH   "/sys/fs/bpf/aid_inode_store"
+#define AID_LABEL_RULES_MAP_PATH "/sys/fs/bpf/aid_label_rules"
+#define AID_TASKS_MAP_PATH     "/sys/fs/bpf/aid_tasks"
+#define AID_SESSIONS_MAP_PATH  "/sys/fs/bpf/aid_session_profiles"
+#define AID_AGENT_PROGS_PATH   "/sys/fs/bpf/aid_agent_progs"
+
+// Kernel-internal dev_t encoding (MKDEV): 12-bit major, 20-bit minor.
+// This is what inode->i_sb->s_dev holds; userspace st_dev must be converted.
+#define AID_KDEV(major, minor) (((major) << 20) | ((minor) & 0xfffff))
+
+// inode_policies is a hash of maps: agent uid -> that agent's own hash of
+// inode_key -> file_perm, sized to its manifest. Replacing or revoking an
+// agent's whole policy is one update/delete of the outer map.
+
+// Inner map key: 12 bytes, no padding, so every byte hashed is a field
+struct inode_key {
 #ifdef __BPF__
-    __u64 dev;   // st_dev
     __u64 ino;   // st_ino
-    __u32 uid;   // agent uid (>= AID_UID_BASE)
+    __u32 dev;   // kernel dev_t, see AID_KDEV
 #else
-    uint64_t dev;   // st_dev
     uint64_t ino;   // st_ino
-    uint32_t uid;   // agent uid (>= AID_UID_BASE)
+    uint32_t dev;   // kernel dev_t, see AID_KDEV
 #endif
-};
+} __attribute__((packed, aligned(4)));
+
+// Inner maps must match the hook's template in everything but max_entries
+#define AID_INNER_MAP_FLAGS (1U << 12)   // BPF_F_INNER_MAP
+#define AID_INNER_MIN_FREE  256          // room for files the agent creates (inherited entries)
+
+// policy_bloom holds every inode_key of every agent's map (never removed, so
+// it only errs toward "maybe"); a definite miss skips the hash probe
+#define AID_BLOOM_HASHES    3
+
+// The one place a policy key is built, by the hook and by the tools alike
+static inline __attribute__((always_inline))
+void aid_policy_key(struct inode_key *key, unsigned long long ino, unsigned int kdev)
+{
+    key->ino = ino;
+    key->dev = kdev;
+}
+
+// Permission verbs (file_perm.allow). The low four bits equal the kernel's
+// MAY_EXEC/MAY_WRITE/MAY_READ/MAY_APPEND, so an access mask is checked
+// against a policy with a single `need & ~allow`.
+#define AID_PERM_EXEC     0x01   // execve() the file
+#define AID_PERM_WRITE    0x02   // write anywhere in the file
+#define AID_PERM_READ     0x04
+#define AID_PERM_APPEND   0x08   // write through an O_APPEND fd only
+#define AID_PERM_TRUNCATE 0x10   // truncate(2), ftruncate(2), O_TRUNC
+#define AID_PERM_CREATE   0x20   // directory: create files/subdirectories in it
+#define AID_PERM_UNLINK   0x40   // directory: remove entries from it
+#define AID_PERM_DIR_VERBS (AID_PERM_CREATE | AID_PERM_UNLINK)
+#define AID_PERM_FILE_VERBS (AID_PERM_READ | AID_PERM_WRITE | AID_PERM_APPEND | AID_PERM_TRUNCATE)
+
+// file_perm.flags
+#define AID_POLICY_SUBTREE   0x01   // directory entry also covers everything below it
+#define AID_POLICY_INHERITED 0x02   // copied by the hook onto a file an agent created
 
-// Permissions allowed for this uid on this inode
+// Permissions allowed for this uid on this inode.
+// A subtree entry on a directory is a "/path/**" rule; the nearest such
+// ancestor wins. Inherited entries are copied from the parent directory when
+// an agent creates a file; i_generation guards against inode number reuse.
 struct file_perm {
 #ifdef __BPF__
-    __u8 allow_read;
-    __u8 allow_write;
-    __u8 _pad[6];   // padding for alignment
+    __u8 allow;           // AID_PERM_*
+    __u8 flags;           // AID_POLICY_*
+    __u16 _pad;
+    __u32 i_generation;   // only meaningful when inherited
+    __u32 hits;           // lookups that returned this entry
+    __u32 last_use;       // CLOCK_BOOTTIME seconds, see AID_USE_GRANULARITY
+#else
+    uint8_t allow;           // AID_PERM_*
+    uint8_t flags;           // AID_POLICY_*
+    uint16_t _pad;
+    uint32_t i_generation;   // only meaningful when inherited
+    uint32_t hits;           // lookups that returned this entry
+    uint32_t last_use;       // CLOCK_BOOTTIME seconds, see AID_USE_GRANULARITY
+#endif
+};
+
+// file_perm.last_use is set when an entry is registered or inherited and
+// moved forward by the hook at most once per AID_USE_GRANULARITY seconds,
+// so a hot entry is not rewritten on every lookup
+#define AID_USE_GRANULARITY 60
+
+// Where the hook looks up per-file policies (aid_config.policy_store)
+#define AID_STORE_MAP   0   // inode_policies: uid -> {ino, dev} -> file_perm
+#define AID_STORE_INODE 1   // inode_store: BPF inode storage on the inode itself
+
+// inode_store value: one slot per agent with a grant on the inode. A slot
+// counts while base_epoch < epoch <= the agent's profile epoch, and either
+// was written by its current registration (epoch equal) or was inherited.
+// addagent writes slots through an fd of the file (the map key); the kernel
+// frees them with the inode.
+#define AID_INODE_SLOTS 4
+
+struct aid_inode_slot {
+#ifdef __BPF__
+    __u32 uid;            // 0: free
+    __u32 epoch;          // agent_profile.epoch when written
+#else
+    uint32_t uid;            // 0: free
+    uint32_t epoch;          // agent_profile.epoch when written
+#endif
+    struct file_perm perm;   // i_generation unused: the slot dies with the inode
+};
+
+struct aid_inode_policy {
+    struct aid_inode_slot slot[AID_INODE_SLOTS];
+};
+
+// How many d_parent levels the hook climbs looking for a subtree rule
+#define AID_SUBTREE_DEPTH 16
+
+// printk verbosity of the hook (aid_config.verbosity)
+#define AID_LOG_OFF   0   // production: no bpf_printk at all
+#define AID_LOG_DENY  1   // denials only
+#define AID_LOG_ALL   2   // every decision (CHECK/ALLOW/DENY)
+
+// Enforcement mode (aid_config.enforce_mode)
+#define AID_MODE_ENFORCE    0   // deny with -EACCES
+#define AID_MODE_PERMISSIVE 1   // evaluate and log, but never deny
+#define AID_MODE_DISABLED   2   // skip evaluation entirely
+
+// Audit event stream (aid_config.audit_level)
+#define AID_AUDIT_OFF   0
+#define AID_AUDIT_DENY  1   // one ring buffer event per (rate limited) denial
+
+#define AID_AUDIT_DEFAULT_RATE  100   // events/s per uid
+#define AID_AUDIT_DEFAULT_BURST 200
+
+// Whole-filesystem rules (fs_rules), checked before per-inode policies: one
+// entry covers every file of a filesystem type or of one mounted device.
+// A superblock dev rule wins over a filesystem magic rule.
+#define AID_FS_KIND_MAGIC 1   // id: superblock s_magic (PIPEFS_MAGIC, PROC_SUPER_MAGIC, ...)
+#define AID_FS_KIND_DEV   2   // id: superblock s_dev, see AID_KDEV
+
+struct fs_rule_key {
+#ifdef __BPF__
+    __u32 kind;   // AID_FS_KIND_*
+    __u32 id;
 #else
-    uint8_t allow_read;
-    uint8_t allow_write;
-    uint8_t _pad[6];   // padding for alignment
+    uint32_t kind;   // AID_FS_KIND_*
+    uint32_t id;
 #endif
 };
 
-// Network permissions for UID
-struct network_perm {
+struct fs_rule {
+#ifdef __BPF__
+    __u8 allow;     // AID_PERM_* granted on every file; other verbs are denied
+    __u8 _pad[3];
+#else
+    uint8_t allow;     // AID_PERM_* granted on every file; other verbs are denied
+    uint8_t _pad[3];
+#endif
+};
+
+// Connect-time destination allowlist (net_rules, an LPM trie). The cgroup
+// connect/sendmsg hooks look up {uid, port, address} with the exact port,
+// then with port 0 ("any port"). uid and port are always matched in full;
+// prefixlen counts them plus the address bits. IPv4 addresses are stored as
+// IPv4-mapped IPv6 (::ffff:a.b.c.d).
+#define AID_NET_PREFIX_BASE 64   // bits of uid + port + _pad
+#define AID_NET_V4_BITS     96   // bits of the ::ffff: prefix
+
+struct net_rule_key {
+#ifdef __BPF__
+    __u32 prefixlen;   // AID_NET_PREFIX_BASE + address bits
+    __u32 uid;
+    __u16 port;        // host byte order, 0 = any
+    __u16 _pad;
+    __u8  addr[16];
+#else
+    uint32_t prefixlen;   // AID_NET_PREFIX_BASE + address bits
+    uint32_t uid;
+    uint16_t port;        // host byte order, 0 = any
+    uint16_t _pad;
+    uint8_t  addr[16];
+#endif
+};
+
+struct net_rule {
+#ifdef __BPF__
+    __u8 allow;     // 1: connect/sendmsg to the destination is allowed
+    __u8 _pad[3];
+#else
+    uint8_t allow;     // 1: connect/sendmsg to the destination is allowed
+    uint8_t _pad[3];
+#endif
+};
+
+// Filename suffix classes (suffix_classes): whether a plain read of a file
+// whose name ends in the suffix needs a policy. The suffix runs from the
+// last '.' of the name to its end (".json", ".env" for a dotfile), at most
+// AID_SUFFIX_LEN bytes, zero padded; names without one match no class. An
+// agent's own entry wins over the global one (uid AID_SUFFIX_GLOBAL), so
+// the hook does at most two lookups however many suffixes are configured.
+#define AID_SUFFIX_LEN    8
+#define AID_SUFFIX_GLOBAL 0
+
+struct suffix_key {
+#ifdef __BPF__
+    __u32 uid;                     // agent, or AID_SUFFIX_GLOBAL
+    __u8  suffix[AID_SUFFIX_LEN];
+#else
+    uint32_t uid;                     // agent, or AID_SUFFIX_GLOBAL
+    uint8_t  suffix[AID_SUFFIX_LEN];
+#endif
+};
+
+struct suffix_class {
+#ifdef __BPF__
+    __u8 sensitive;   // 1: plain reads need a policy, 0: they do not
+    __u8 _pad[3];
+#else
+    uint8_t sensitive;   // 1: plain reads need a policy, 0: they do not
+    uint8_t _pad[3];
+#endif
+};
+
+// xattr labels (loader: xattr_labels = true): a file stamped with an
+// AID_LABEL_XATTR value is covered by the label_rules entry {uid, label} of
+// each agent granted that label, so a file needs no inode_policies entry
+// of its own. A sleepable file_open program reads the xattr once per inode
+// into label_cache (inode storage); the other hooks only read the cache.
+// bpf_get_file_xattr() reads "security.bpf." and also "user." names, so what
+// the kfunc accepts is no trust boundary. What keeps agents from labelling
+// files is this name being under "security.", which takes CAP_SYS_ADMIN to set.
+#define AID_LABEL_XATTR "security.bpf.aid"
+#define AID_LABEL_LEN   16
+
+struct label_key {
+#ifdef __BPF__
+    __u32 uid;
+    char  label[AID_LABEL_LEN];   // zero padded
+#else
+    uint32_t uid;
+    char     label[AID_LABEL_LEN];   // zero padded
+#endif
+};
+
+// label_cache state
+#define AID_LABEL_UNKNOWN 0   // xattr not read yet
+#define AID_LABEL_NONE    1   // no (valid) label
+#define AID_LABEL_SET     2
+
+struct aid_label_cache {
+#ifdef __BPF__
+    __u8 state;   // AID_LABEL_*
+    __u8 _pad[3];
+#else
+    uint8_t state;   // AID_LABEL_*
+    uint8_t _pad[3];
+#endif
+    char label[AID_LABEL_LEN];
+};
+
+// Per-agent behaviour (agent_profiles, slot uid - AID_UID_BASE)
+#define AID_PROFILE_ACTIVE        0x01   // slot written by addagent; else the defaults apply
+#define AID_PROFILE_NET_ANY       0x02   // connect anywhere, net_rules not consulted
+#define AID_PROFILE_SUFFIX_CLASS  0x04   // plain reads need a policy only for sensitive suffixes
+#define AID_PROFILE_EXEC_BIT      0x08   // plain reads of files with an exec bit need none
+#define AID_PROFILE_DEFAULT_ALLOW 0x10   // accesses no policy covers are allowed (fail open)
+
+#define AID_PROFILE_DEFAULT_FLAGS (AID_PROFILE_SUFFIX_CLASS | AID_PROFILE_EXEC_BIT)
+#define AID_PROFILE_INHERIT       0xff   // audit_level/enforce_mode: follow aid_config
+
+struct agent_profile {
+#ifdef __BPF__
+    __u8 flags;          // AID_PROFILE_*
+    __u8 audit_level;    // AID_AUDIT_*, or AID_PROFILE_INHERIT
+    __u8 enforce_mode;   // AID_MODE_*, or AID_PROFILE_INHERIT
+    __u8 _pad;
+    __u32 epoch;         // inode_store slots: bumped by every addagent
+    __u32 base_epoch;    // inode_store slots up to this one are revoked
+#else
+    uint8_t flags;          // AID_PROFILE_*
+    uint8_t audit_level;    // AID_AUDIT_*, or AID_PROFILE_INHERIT
+    uint8_t enforce_mode;   // AID_MODE_*, or AID_PROFILE_INHERIT
+    uint8_t _pad;
+    uint32_t epoch;         // inode_store slots: bumped by every addagent
+    uint32_t base_epoch;    // inode_store slots up to this one are revoked
+#endif
+};
+
+// Task local storage ("aid_tasks") of a process hire started, copied to
+// every task it forks. hire writes agent and session through a pidfd;
+// the hooks keep the profile they loaded there until policy_gen moves.
+struct aid_task {
+#ifdef __BPF__
+    __u32 agent;         // policy key: the agent's uid
+    __u32 session;       // aid_config.next_session taken by hire, never 0
+    __u32 gen;           // aid_config.policy_gen prof was loaded under
+    __u32 loaded;        // prof is valid
+    struct agent_profile prof;
+#else
+    uint32_t agent;         // policy key: the agent's uid
+    uint32_t session;       // aid_config.next_session taken by hire, never 0
+    uint32_t gen;           // aid_config.policy_gen prof was loaded under
+    uint32_t loaded;        // prof is valid
+    struct agent_profile prof;
+#endif
+};
+
+// Per-session profile override ("aid_session_profiles", keyed by session):
+// replaces the agent's profile for the processes of that hire only
+struct aid_session {
+#ifdef __BPF__
+    __u32 agent;         // the override only applies to this agent's session
+    struct agent_profile prof;
+#else
+    uint32_t agent;         // the override only applies to this agent's session
+    struct agent_profile prof;
+#endif
+};
+
+// Specialized file_permission (bpf/aid_agent.bpf.c): addagent loads one per
+// agent with its policy baked into .rodata and puts it in agent_progs at
+// uid - AID_UID_BASE. Slot AID_SPEC_GENERIC holds the generic evaluation
+// it tail-calls back into.
+#define AID_SPEC_GENERIC AID_NR_UIDS
+#define AID_SPEC_MAX     256   // baked entries, a power of two; larger agents stay generic
+#define AID_SPEC_STEPS   8     // log2(AID_SPEC_MAX)
+
+// One baked entry; unused ones are all ones and sort last
+struct aid_spec_entry {
+#ifdef __BPF__
+    __u64 ino;
+    __u32 dev;
+    __u8  allow;         // AID_PERM_*
+    __u8  flags;         // AID_POLICY_*
+    __u16 _pad;
+#else
+    uint64_t ino;
+    uint32_t dev;
+    uint8_t  allow;         // AID_PERM_*
+    uint8_t  flags;         // AID_POLICY_*
+    uint16_t _pad;
+#endif
+};
+
+// The specialized program's .rodata, sorted by (dev, ino)
+struct aid_spec {
+#ifdef __BPF__
+    __u32 uid;
+    __u32 flags;         // agent_profile.flags baked in; any other profile goes generic
+    __u32 fs_gen;        // aid_config.fs_gen no entry's filesystem had an fs rule under
+    __u32 subtrees;      // entries with AID_POLICY_SUBTREE; 0 drops the d_parent walk
+    struct aid_spec_entry entry[AID_SPEC_MAX];
+#else
+    uint32_t uid;
+    uint32_t flags;         // agent_profile.flags baked in; any other profile goes generic
+    uint32_t fs_gen;        // aid_config.fs_gen no entry's filesystem had an fs rule under
+    uint32_t subtrees;      // entries with AID_POLICY_SUBTREE; 0 drops the d_parent walk
+    struct aid_spec_entry entry[AID_SPEC_MAX];
+#endif
+};
+
+// The specialized program's .bss: hits of each baked entry, which the
+// inner map entry does not see (addagent -C adds them, re-registration
+// carries them over)
+struct aid_spec_usage {
+#ifdef __BPF__
+    __u32 hits;
+    __u32 last_use;
+#else
+    uint32_t hits;
+    uint32_t last_use;
+#endif
+};
+
+#define AID_DEBUG_WORDS ((AID_NR_UIDS + 63) / 64)
+
+// Runtime control plane: single-slot mmapable array map "aid_config".
+// Zero-initialized at load, i.e. enforcing with printk off.
+struct aid_config {
+#ifdef __BPF__
+    __u32 verbosity;
+    __u32 enforce_mode;
+    __u32 audit_level;
+    __u32 audit_rate;    // token bucket refill, events/s per uid
+    __u32 audit_burst;   // token bucket depth
+    __u32 policy_gen;    // bumped by addagent; invalidates cached per-file verdicts
+    __u32 verdict_cache; // evaluate once per open and cache the verdict
+    __u32 policy_bloom;  // check policy_bloom before each inode_policies probe
+    __u32 latency_hist;  // time file_permission into latency_hist
+    __u32 flight_recorder; // keep the last decisions in flight_recorder
+    __u32 hh_sample;     // feed 1 in hh_sample accesses to the hot-inode sketch, 0: off
+    __u32 policy_store;  // AID_STORE_*, fixed at load
+    __u32 xattr_labels;  // label programs loaded, see AID_LABEL_XATTR
+    __u32 next_session;  // last hire session id handed out
+    __u32 specialize;    // dispatch to the agents' specialized programs
+    __u32 fs_gen;        // bumped by aid_ctl fs; stales specialized programs
+    __u64 debug_uids[AID_DEBUG_WORDS];  // bit (uid - AID_UID_BASE): log everything for uid
+#else
+    uint32_t verbosity;
+    uint32_t enforce_mode;
+    uint32_t audit_level;
+    uint32_t audit_rate;    // token bucket refill, events/s per uid
+    uint32_t audit_burst;   // token bucket depth
+    uint32_t policy_gen;    // bumped by addagent; invalidates cached per-file verdicts
+    uint32_t verdict_cache; // evaluate once per open and cache the verdict
+    uint32_t policy_bloom;  // check policy_bloom before each inode_policies probe
+    uint32_t latency_hist;  // time file_permission into latency_hist
+    uint32_t flight_recorder; // keep the last decisions in flight_recorder
+    uint32_t hh_sample;     // feed 1 in hh_sample accesses to the hot-inode sketch, 0: off
+    uint32_t policy_store;  // AID_STORE_*, fixed at load
+    uint32_t xattr_labels;  // label programs loaded, see AID_LABEL_XATTR
+    uint32_t next_session;  // last hire session id handed out
+    uint32_t specialize;    // dispatch to the agents' specialized programs
+    uint32_t fs_gen;        // bumped by aid_ctl fs; stales specialized programs
+    uint64_t debug_uids[AID_DEBUG_WORDS];  // bit (uid - AID_UID_BASE): log everything for uid
+#endif
+};
+
+// Why the hook returned what it did (one code per exit)
+#define AID_REASON_NO_INODE      0   // no dentry/inode, allowed
+#define AID_REASON_DEVICE        1   // char/block device, allowed
+#define AID_REASON_SOCKET        2   // socket I/O, or connect/sendmsg net_rules allows
+#define AID_REASON_SOCKET_DENIED 3   // connect/sendmsg to a destination net_rules lacks
+#define AID_REASON_EXEC          4   // MAY_EXEC, allowed
+#define AID_REASON_NOT_SENSITIVE 5   // plain read of a file of no sensitive suffix class, allowed
+#define AID_REASON_EXEC_BIT      6   // plain read of an executable file, allowed
+#define AID_REASON_NO_POLICY     7   // no inode_policies entry
+#define AID_REASON_READ_DENIED   8   // policy without read
+#define AID_REASON_WRITE_DENIED  9   // policy without write
+#define AID_REASON_POLICY_MATCH  10  // policy allows the access
+#define AID_REASON_EXEC_DENIED   11  // execve() of a file whose policy lacks exec
+#define AID_REASON_TRUNC_DENIED  12  // truncate without truncate (or without policy)
+#define AID_REASON_CREATE_DENIED 13  // create in a directory whose policy lacks create
+#define AID_REASON_UNLINK_DENIED 14  // unlink/rmdir in a directory whose policy lacks unlink
+#define AID_REASON_FS_MATCH      15  // fs_rules entry allows the access
+#define AID_REASON_FS_DENIED     16  // fs_rules entry lacks a needed verb
+#define AID_REASON_INHERIT_FULL  17  // created file got no inherited entry: agent's map is full
+#define AID_REASON_MAX           18
+
+// Per-CPU hook exit counters of one agent (value of "verdict_stats", keyed by uid)
+struct aid_verdict_stats {
+#ifdef __BPF__
+    __u64 count[AID_REASON_MAX];
+#else
+    uint64_t count[AID_REASON_MAX];
+#endif
+};
+
+// Per-CPU file_permission duration of one exit reason (value of
+// "latency_hist", keyed by AID_REASON_*): slot i counts runs that took
+// [2^i, 2^(i+1)) ns, the last slot everything longer
+#define AID_HIST_SLOTS 32
+
+struct aid_latency_hist {
+#ifdef __BPF__
+    __u64 slot[AID_HIST_SLOTS];
+    __u64 total_ns;
+#else
+    uint64_t slot[AID_HIST_SLOTS];
+    uint64_t total_ns;
+#endif
+};
+
+#define AID_VERDICT_ALLOW       0
+#define AID_VERDICT_DENY        1
+#define AID_VERDICT_PERMISSIVE  2   // would have been denied (permissive mode)
+
+// Flight recorder: each CPU overwrites its own ring of the last
+// AID_FLIGHT_LEN decisions (a per-CPU array indexed by a per-CPU head), no
+// locks and no name copy. Readers merge the CPUs by ts_ns.
+#define AID_FLIGHT_LEN 1024   // power of two
+
+struct aid_flight_rec {
+#ifdef __BPF__
+    __u64 ts_ns;    // CLOCK_BOOTTIME; 0 for a slot never written
+    __u64 ino;      // 0 if the hook never looked at the inode
+    __u32 dev;      // kernel dev_t
+    __u32 uid;
+    __u32 pid;      // tgid
+    __u16 mask;     // MAY_* mask, AID_PERM_* verb for truncate/create/unlink,
+                    // destination port for AID_REASON_SOCKET_DENIED
+    __u8  reason;   // AID_REASON_*
+    __u8  verdict;  // AID_VERDICT_*
+#else
+    uint64_t ts_ns;    // CLOCK_BOOTTIME; 0 for a slot never written
+    uint64_t ino;      // 0 if the hook never looked at the inode
+    uint32_t dev;      // kernel dev_t
+    uint32_t uid;
+    uint32_t pid;      // tgid
+    uint16_t mask;     // MAY_* mask, AID_PERM_* verb for truncate/create/unlink,
+                       // destination port for AID_REASON_SOCKET_DENIED
+    uint8_t  reason;   // AID_REASON_*
+    uint8_t  verdict;  // AID_VERDICT_*
+#endif
+};
+
+// Hot-inode profiling: sampled file_permission calls add 1 to a per-CPU
+// count-min sketch (hh_sketch, AID_CMS_DEPTH rows of AID_CMS_WIDTH
+// counters, one row per array slot) and remember the (uid, dev, ino) in
+// an LRU of candidates (hh_candidates). aid_hot sums the CPUs, estimates
+// each candidate as the minimum over the rows and scales by hh_sample.
+#define AID_CMS_DEPTH 4
+#define AID_CMS_WIDTH 2048   // power of two
+
+struct aid_cms_row {
+#ifdef __BPF__
+    __u32 count[AID_CMS_WIDTH];
+#else
+    uint32_t count[AID_CMS_WIDTH];
+#endif
+};
+
+struct aid_hh_key {
+#ifdef __BPF__
+    __u32 uid;
+    __u32 dev;   // kernel dev_t
+    __u64 ino;
+#else
+    uint32_t uid;
+    uint32_t dev;   // kernel dev_t
+    uint64_t ino;
+#endif
+};
+
+// Counter of (uid, dev, ino) in sketch row `row`: a murmur3 finalizer over
+// the key, seeded per row. Shared by the hook and aid_hot.
+static inline __attribute__((always_inline))
+unsigned int aid_cms_slot(unsigned int uid, unsigned int dev, unsigned long long ino,
+                          unsigned int row)
+{
+    unsigned long long h = ino * 0x9e3779b97f4a7c15ULL;
+
+    h ^= ((unsigned long long)dev << 32) | uid;
+    h ^= (row + 1) * 0x632be59bd9b4e019ULL;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (unsigned int)h & (AID_CMS_WIDTH - 1);
+}
+
+#define AID_EVENT_NAME_LEN 28
+
+// Fixed-size audit record: ring buffer "aid_events" and aid_auditd log files.
+// ts_ns is CLOCK_BOOTTIME in the ring buffer, CLOCK_REALTIME on disk.
+struct aid_event {
 #ifdef __BPF__
-    __u8 allow_mail;
-    __u8 _pad[7];   // padding for alignment
+    __u64 ts_ns;
+    __u64 ino;
+    __u32 dev;      // kernel dev_t (major << 20 | minor)
+    __u32 uid;
+    __u32 pid;      // tgid
+    __u32 mask;     // MAY_* mask of the access, AID_PERM_* verb for truncate/create/unlink,
+                    // destination port for AID_REASON_SOCKET_DENIED
+    __u8  reason;   // AID_REASON_*
+    __u8  verdict;  // AID_VERDICT_*
+    __u8  _pad[2];
+    char  name[AID_EVENT_NAME_LEN];  // AID_REASON_SOCKET_DENIED: net_rule_key addr
 #else
-    uint8_t allow_mail;
-    uint8_t _pad[7];   // padding for alignment
+    uint64_t ts_ns;
+    uint64_t ino;
+    uint32_t dev;      // kernel dev_t (major << 20 | minor)
+    uint32_t uid;
+    uint32_t pid;      // tgid
+    uint32_t mask;     // MAY_* mask of the access, AID_PERM_* verb for truncate/create/unlink,
+                       // destination port for AID_REASON_SOCKET_DENIED
+    uint8_t  reason;   // AID_REASON_*
+    uint8_t  verdict;  // AID_VERDICT_*
+    uint8_t  _pad[2];
+    char     name[AID_EVENT_NAME_LEN];  // AID_REASON_SOCKET_DENIED: net_rule_key addr
 #endif
 };
 
@@ -2,8 +2,10 @@
 #define _GNU_SOURCE
 #include <errno.h>
 #include <fcntl.h>
+#include <ftw.h>
 #include <glob.h>
 #include <libgen.h>
+#include <netdb.h>
 #include <linux/bpf.h>
 #include <linux/limits.h>
 #include <pwd.h>
@@ -13,15 +15,19 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <dirent.h>
+#include <sys/vfs.h>
+#include <sys/xattr.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "../include/aid_shared.h"
+#include "aid_util.h"
 
 #define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
-#define AID_NETWORK_MAP_PATH "/sys/fs/bpf/aid_network_policies"
 #define AGENT_USER_PREFIX "agent_"
 
 // --- String utilities ---
@@ -39,6 +45,18 @@ static char *trim(char *s)
     return s;
 }
 
+// A file rule value up to a " #" comment, trimmed; a '#' inside a path is
+// kept
+static char *rule_value(char *s)
+{
+    char *comment = strstr(s, " #");
+    if (!comment)
+        comment = strstr(s, "\t#");
+    if (comment)
+        *comment = 0;
+    return trim(s);
+}
+
 static int starts_with(const char *s, const char *prefix)
 {
     return strncmp(s, prefix, strlen(prefix)) == 0;
@@ -49,17 +67,51 @@ static int starts_with(const char *s, const char *prefix)
 #define MAX_FILE_RULES 256
 #define MAX_PATH_LEN   4096
 
+// Verbs not given in the manifest are -1: append/truncate then follow write,
+// create/unlink follow write on a rule naming a directory and are off
+// otherwise, exec defaults to off
 struct file_rule {
     char path[MAX_PATH_LEN];
     int read;
     int write;
+    int append;
+    int truncate;
+    int create;
+    int unlink;
+    int exec;
+    char label[AID_LABEL_LEN + 1];   // stamp this label instead of inode entries
+};
+
+// --- Network destination structure ---
+
+#define MAX_NET_DESTS 64
+
+// One network: list item, resolved into net_rules keys by addagent
+struct net_dest {
+    char spec[256];   // host name, address or CIDR, optionally ":port"
+    int port;         // from a "port:" line, -1 if not given
+};
+
+// --- Suffix class structure ---
+
+#define MAX_SUFFIX_CLASSES 32
+
+// One suffix of the profile's sensitive:/public: lists
+struct suffix_rule {
+    struct suffix_key key;
+    struct suffix_class class;
 };
 
 struct manifest_data {
     char agentname[128];
     struct file_rule files[MAX_FILE_RULES];
     int file_count;
-    int network_mail;  // network.mail permission
+    struct net_dest nets[MAX_NET_DESTS];
+    int net_count;
+    int net_dns;                   // allow the resolv.conf nameservers too
+    struct suffix_rule suffixes[MAX_SUFFIX_CLASSES];
+    int suffix_count;
+    struct agent_profile profile;  // network.any and the profile: section
 };
 
 // --- Simple manifest.yaml parser ---
@@ -71,8 +123,137 @@ struct manifest_data {
 //     - path: /path/pattern
 //       read: true
 //       write: false
+//       append: true      # optional: append, truncate, create, unlink, exec
+//       label: project-x  # optional: stamp security.bpf.aid=project-x on the
+//                         # matches and grant the label instead (xattr_labels)
+//   network:
+//     - smtp.gmail.com:587  # host, address or CIDR, ":port" optional (any port)
+//     - host: 10.0.0.0/8    # or as separate keys
+//       port: 443
+//     dns: true           # nameservers of /etc/resolv.conf, port 53 (default
+//                         # when there are destinations)
+//     any: false          # true: connect anywhere (old name: mail)
+// profile:                # optional, defaults shown
+//   default: deny         # deny|allow: accesses no file rule covers
+//   suffix_classes: true  # plain reads need a policy only for sensitive suffixes
+//                         # (old name: txt_heuristic)
+//   sensitive: .pem .key  # this agent's own classes, on top of the global ones
+//   public: .log          # (aid_ctl suffix); both optional
+//   exec_bit_reads: true  # plain reads of files with an exec bit need none
+//   audit: global         # off|deny|global (follow aid_ctl audit)
+//   mode: global          # enforce|permissive|disabled|global (follow aid_ctl mode)
 //
-// network/devices are ignored for now (can be extended later)
+// devices are ignored for now (can be extended later)
+
+static int parse_bool(const char *p)
+{
+    return strcmp(p, "true") == 0 || strcmp(p, "True") == 0 || strcmp(p, "1") == 0;
+}
+
+// Permission verbs of a file rule as an AID_PERM_* mask. create and unlink
+// are directory verbs: only a rule naming a directory (dir) gets them from
+// write, a rule naming files has them only if the manifest says so.
+static uint8_t rule_allow(const struct file_rule *r, int dir)
+{
+    uint8_t allow = 0;
+    int append = r->append < 0 ? r->write : r->append;
+    int truncate = r->truncate < 0 ? r->write : r->truncate;
+    int create = r->create < 0 ? dir && r->write : r->create;
+    int unlink = r->unlink < 0 ? dir && r->write : r->unlink;
+
+    if (r->read)     allow |= AID_PERM_READ;
+    if (r->write)    allow |= AID_PERM_WRITE | AID_PERM_APPEND;
+    if (append)      allow |= AID_PERM_APPEND;
+    if (truncate)    allow |= AID_PERM_TRUNCATE;
+    if (create)      allow |= AID_PERM_CREATE;
+    if (unlink)      allow |= AID_PERM_UNLINK;
+    if (r->exec > 0) allow |= AID_PERM_EXEC;
+    return allow;
+}
+
+static void set_profile_flag(struct agent_profile *prof, uint8_t flag, int on)
+{
+    if (on)
+        prof->flags |= flag;
+    else
+        prof->flags &= ~flag;
+}
+
+static int lookup_level(const char *value, const char **names, int count)
+{
+    if (strcmp(value, "global") == 0)
+        return AID_PROFILE_INHERIT;
+    for (int i = 0; i < count; i++) {
+        if (strcmp(value, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// "sensitive: .a .b" / "public: .c": add or override the agent's classes.
+// Entries carry uid 0 until the uid is known.
+static int parse_suffix_list(char *value, int sensitive, struct manifest_data *m)
+{
+    for (char *tok = strtok(value, " ,"); tok; tok = strtok(NULL, " ,")) {
+        struct suffix_key key;
+        int i;
+
+        if (aid_suffix_key_parse(tok, 0, &key) < 0) {
+            fprintf(stderr, "Invalid suffix '%s' (expected .ext, at most %d bytes)\n",
+                    tok, AID_SUFFIX_LEN);
+            return -1;
+        }
+        for (i = 0; i < m->suffix_count; i++) {
+            if (memcmp(&m->suffixes[i].key, &key, sizeof(key)) == 0)
+                break;
+        }
+        if (i == MAX_SUFFIX_CLASSES) {
+            fprintf(stderr, "Too many suffix classes (>%d)\n", MAX_SUFFIX_CLASSES);
+            return -1;
+        }
+        if (i == m->suffix_count)
+            m->suffix_count++;
+        m->suffixes[i].key = key;
+        m->suffixes[i].class.sensitive = (uint8_t)sensitive;
+    }
+    return 0;
+}
+
+// One "key: value" line of the profile: section
+static int parse_profile_line(char *p, struct manifest_data *m)
+{
+    struct agent_profile *prof = &m->profile;
+    static const char *audit_names[] = { "off", "deny" };
+    static const char *mode_names[] = { "enforce", "permissive", "disabled" };
+
+    char *comment = strchr(p, '#');
+    if (comment)
+        *comment = 0;
+    char *colon = strchr(p, ':');
+    if (!colon)
+        return 0;
+    *colon = 0;
+    char *key = trim(p), *value = trim(colon + 1);
+    int level;
+
+    if (strcmp(key, "default") == 0 && (strcmp(value, "allow") == 0 || strcmp(value, "deny") == 0)) {
+        set_profile_flag(prof, AID_PROFILE_DEFAULT_ALLOW, strcmp(value, "allow") == 0);
+    } else if (strcmp(key, "suffix_classes") == 0 || strcmp(key, "txt_heuristic") == 0) {
+        set_profile_flag(prof, AID_PROFILE_SUFFIX_CLASS, parse_bool(value));
+    } else if (strcmp(key, "sensitive") == 0 || strcmp(key, "public") == 0) {
+        return parse_suffix_list(value, strcmp(key, "sensitive") == 0, m);
+    } else if (strcmp(key, "exec_bit_reads") == 0) {
+        set_profile_flag(prof, AID_PROFILE_EXEC_BIT, parse_bool(value));
+    } else if (strcmp(key, "audit") == 0 && (level = lookup_level(value, audit_names, 2)) >= 0) {
+        prof->audit_level = (uint8_t)level;
+    } else if (strcmp(key, "mode") == 0 && (level = lookup_level(value, mode_names, 3)) >= 0) {
+        prof->enforce_mode = (uint8_t)level;
+    } else {
+        fprintf(stderr, "Invalid profile setting '%s: %s'\n", key, value);
+        return -1;
+    }
+    return 0;
+}
 
 static int parse_manifest(const char *filename, struct manifest_data *out)
 {
@@ -83,11 +264,18 @@ static int parse_manifest(const char *filename, struct manifest_data *out)
     }
 
     memset(out, 0, sizeof(*out));
+    out->profile.flags = AID_PROFILE_ACTIVE | AID_PROFILE_DEFAULT_FLAGS;
+    out->profile.audit_level = AID_PROFILE_INHERIT;
+    out->profile.enforce_mode = AID_PROFILE_INHERIT;
+    out->net_dns = 1;
+
     char line[8192];
     int in_permissions = 0;
+    int in_profile = 0;
     int in_files = 0;
     int in_network = 0;
     int current_rule_index = -1;
+    int current_net_index = -1;
 
     while (fgets(line, sizeof(line), f)) {
         char *p = trim(line);
@@ -103,6 +291,21 @@ static int parse_manifest(const char *filename, struct manifest_data *out)
 
         if (starts_with(p, "permissions:")) {
             in_permissions = 1;
+            in_profile = 0;
+            continue;
+        }
+
+        if (starts_with(p, "profile:")) {
+            in_profile = 1;
+            in_permissions = 0;
+            continue;
+        }
+
+        if (in_profile) {
+            if (parse_profile_line(p, out) < 0) {
+                fclose(f);
+                return -1;
+            }
             continue;
         }
 
@@ -121,11 +324,37 @@ static int parse_manifest(const char *filename, struct manifest_data *out)
             continue;
         }
 
-        // Parse network.mail
-        if (in_network && starts_with(p, "mail:")) {
-            p += strlen("mail:");
+        // Parse the network: section
+        if (in_network) {
+            char *comment = strchr(p, '#');
+            if (comment)
+                *comment = 0;
             p = trim(p);
-            out->network_mail = (strcmp(p, "true") == 0 || strcmp(p, "True") == 0 || strcmp(p, "1") == 0);
+
+            if (starts_with(p, "any:") || starts_with(p, "mail:")) {
+                p = trim(strchr(p, ':') + 1);
+                set_profile_flag(&out->profile, AID_PROFILE_NET_ANY, parse_bool(p));
+            } else if (starts_with(p, "dns:")) {
+                out->net_dns = parse_bool(trim(p + strlen("dns:")));
+            } else if (starts_with(p, "-")) {
+                if (out->net_count >= MAX_NET_DESTS) {
+                    fprintf(stderr, "Too many network destinations (>%d)\n", MAX_NET_DESTS);
+                    fclose(f);
+                    return -1;
+                }
+                current_net_index = out->net_count++;
+                out->nets[current_net_index].port = -1;
+                p = trim(p + 1);
+                if (starts_with(p, "host:"))
+                    p = trim(p + strlen("host:"));
+                strncpy(out->nets[current_net_index].spec, p,
+                        sizeof(out->nets[current_net_index].spec) - 1);
+            } else if (current_net_index >= 0 && starts_with(p, "host:")) {
+                strncpy(out->nets[current_net_index].spec, trim(p + strlen("host:")),
+                        sizeof(out->nets[current_net_index].spec) - 1);
+            } else if (current_net_index >= 0 && starts_with(p, "port:")) {
+                out->nets[current_net_index].port = atoi(trim(p + strlen("port:")));
+            }
             continue;
         }
 
@@ -140,35 +369,60 @@ static int parse_manifest(const char *filename, struct manifest_data *out)
             memset(&out->files[current_rule_index], 0, sizeof(struct file_rule));
             out->files[current_rule_index].read = 0;
             out->files[current_rule_index].write = 0;
+            out->files[current_rule_index].append = -1;
+            out->files[current_rule_index].truncate = -1;
+            out->files[current_rule_index].create = -1;
+            out->files[current_rule_index].unlink = -1;
+            out->files[current_rule_index].exec = -1;
             // May be in "- path: ..." format
             p++; // skip '-'
             p = trim(p);
             if (starts_with(p, "path:")) {
-                p += strlen("path:");
-                p = trim(p);
+                p = rule_value(p + strlen("path:"));
                 strncpy(out->files[current_rule_index].path, p,
                         sizeof(out->files[current_rule_index].path) - 1);
             }
             continue;
         }
 
-        // Set path/read/write inside file rule
+        // Set path/verbs inside file rule
         if (in_files && current_rule_index >= 0) {
+            struct file_rule *r = &out->files[current_rule_index];
+            const struct {
+                const char *key;
+                int *value;
+            } verbs[] = {
+                { "read:",     &r->read },
+                { "write:",    &r->write },
+                { "append:",   &r->append },
+                { "truncate:", &r->truncate },
+                { "create:",   &r->create },
+                { "unlink:",   &r->unlink },
+                { "exec:",     &r->exec },
+            };
+
             if (starts_with(p, "path:")) {
-                p += strlen("path:");
-                p = trim(p);
-                strncpy(out->files[current_rule_index].path, p,
-                        sizeof(out->files[current_rule_index].path) - 1);
-            } else if (starts_with(p, "read:")) {
-                p += strlen("read:");
-                p = trim(p);
-                out->files[current_rule_index].read =
-                    (strcmp(p, "true") == 0 || strcmp(p, "True") == 0 || strcmp(p, "1") == 0);
-            } else if (starts_with(p, "write:")) {
-                p += strlen("write:");
-                p = trim(p);
-                out->files[current_rule_index].write =
-                    (strcmp(p, "true") == 0 || strcmp(p, "True") == 0 || strcmp(p, "1") == 0);
+                p = rule_value(p + strlen("path:"));
+                strncpy(r->path, p, sizeof(r->path) - 1);
+                continue;
+            }
+            if (starts_with(p, "label:")) {
+                struct label_key key;
+                p = rule_value(p + strlen("label:"));
+                if (aid_label_key_parse(p, 0, &key) < 0) {
+                    fprintf(stderr, "Invalid label '%s' (1-%d of [A-Za-z0-9._-])\n",
+                            p, AID_LABEL_LEN);
+                    fclose(f);
+                    return -1;
+                }
+                snprintf(r->label, sizeof(r->label), "%s", p);
+                continue;
+            }
+            for (size_t i = 0; i < sizeof(verbs) / sizeof(verbs[0]); i++) {
+                if (starts_with(p, verbs[i].key)) {
+                    *verbs[i].value = parse_bool(rule_value(p + strlen(verbs[i].key)));
+                    break;
+                }
             }
         }
     }
@@ -267,293 +521,1824 @@ static int open_inode_policy_map(void)
     return fd;
 }
 
-static int open_network_policy_map(void)
+static int open_agent_profile_map(void)
 {
-    int fd = bpf_obj_get(AID_NETWORK_MAP_PATH);
+    int fd = bpf_obj_get(AID_PROFILES_MAP_PATH);
     if (fd < 0) {
         fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
-                AID_NETWORK_MAP_PATH, strerror(errno));
+                AID_PROFILES_MAP_PATH, strerror(errno));
     }
     return fd;
 }
 
-static int register_network_policy(int map_fd, uid_t uid, int allow_mail)
+// Invalidate every per-file verdict the hook cached under the old policy
+static int bump_policy_generation(void)
 {
-    uint32_t key = (uint32_t)uid;
-    struct network_perm perm = {
-        .allow_mail = (uint8_t)(allow_mail ? 1 : 0),
-    };
+    int fd = bpf_obj_get(AID_CONFIG_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_CONFIG_MAP_PATH, strerror(errno));
+        return -1;
+    }
 
-    int ret = bpf_map_update_elem(map_fd, &key, &perm, BPF_ANY);
-    if (ret < 0) {
-        fprintf(stderr, "bpf_map_update_elem (network) failed: uid=%u errno=%s\n",
-                uid, strerror(errno));
+    size_t len = (sizeof(struct aid_config) + getpagesize() - 1) & ~(getpagesize() - 1);
+    struct aid_config *cfg = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (cfg == MAP_FAILED) {
+        fprintf(stderr, "mmap(%s) failed: %s\n", AID_CONFIG_MAP_PATH, strerror(errno));
         return -1;
     }
 
-    printf("[addagent] Registered network policy: uid=%u mail=%d\n", uid, allow_mail);
+    uint32_t gen = __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+    munmap(cfg, len);
+
+    printf("[addagent] Policy generation -> %u\n", gen);
     return 0;
 }
 
-static int register_file_policy_for_inode(int map_fd,
-                                          uid_t uid,
-                                          dev_t dev,
-                                          ino_t ino,
-                                          int allow_read,
-                                          int allow_write)
+static int register_agent_profile(int map_fd, uid_t uid, const struct agent_profile *prof)
 {
-    struct inode_uid_key key = {
-        .dev = (uint64_t)dev,
-        .ino = (uint64_t)ino,
-        .uid = (uint32_t)uid,
-    };
-
-    struct file_perm perm = {
-        .allow_read = (uint8_t)(allow_read ? 1 : 0),
-        .allow_write = (uint8_t)(allow_write ? 1 : 0),
-    };
+    uint32_t idx = (uint32_t)uid - AID_UID_BASE;
 
-    int ret = bpf_map_update_elem(map_fd, &key, &perm, BPF_ANY);
+    int ret = bpf_map_update_elem(map_fd, &idx, prof, BPF_ANY);
     if (ret < 0) {
-        fprintf(stderr,
-                "bpf_map_update_elem failed: uid=%u dev=%llu ino=%llu errno=%s\n",
-                uid, (unsigned long long)key.dev, (unsigned long long)key.ino,
-                strerror(errno));
+        fprintf(stderr, "bpf_map_update_elem (profile) failed: uid=%u errno=%s\n",
+                uid, strerror(errno));
         return -1;
     }
 
-    printf("[addagent] Registered uid=%u dev=%llu ino=%llu read=%d write=%d\n",
-           uid, (unsigned long long)key.dev, (unsigned long long)key.ino,
-           allow_read, allow_write);
+    printf("[addagent] Registered profile: uid=%u flags=0x%x audit=%u mode=%u\n",
+           uid, prof->flags, prof->audit_level, prof->enforce_mode);
     return 0;
 }
 
-// Register parent directory policy to allow file creation/access
-static int register_directory_policy(int map_fd,
-                                      uid_t uid,
-                                      const char *dir_path,
-                                      int allow_read,
-                                      int allow_write)
-{
-    struct stat st;
-    if (stat(dir_path, &st) < 0) {
-        fprintf(stderr, "[addagent] Warning: stat(%s) failed: %s\n", dir_path, strerror(errno));
-        return -1;
-    }
+// --- Policy plan ---
+// A manifest is resolved into entries first, written into a fresh inner map
+// for the agent, and published with a single inode_policies update, so the
+// hook sees either the old policy or the whole new one.
 
-    if (!S_ISDIR(st.st_mode)) {
-        return 0;  // Not a directory
-    }
+struct policy_entry {
+    struct inode_key key;
+    struct file_perm perm;
+    int rule;           // manifest rule that produced it, -1: inherited
+    char *path;         // as resolved, for coverage reports
+};
 
-    printf("[addagent] Registering directory policy: %s\n", dir_path);
-    return register_file_policy_for_inode(map_fd, uid, st.st_dev, st.st_ino,
-                                          allow_read, allow_write);
+struct policy_plan {
+    struct policy_entry *entries;
+    size_t count;
+    size_t cap;
+    size_t *index;      // open addressing on (dev, ino): entry index + 1, 0 empty
+    size_t index_cap;   // power of two, at least twice count
+    int rule;           // rule being resolved
+};
+
+static void free_policy_plan(struct policy_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++)
+        free(plan->entries[i].path);
+    free(plan->entries);
+    free(plan->index);
 }
 
-// Extract parent directory path safely
-static char *get_parent_dir(const char *path)
+// The hook's clock for file_perm.last_use
+static uint32_t boot_seconds(void)
 {
-    if (!path || *path == '\0')
-        return NULL;
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return (uint32_t)ts.tv_sec;
+}
 
-    char *path_copy = strdup(path);
-    if (!path_copy)
-        return NULL;
+static size_t plan_slot(const struct policy_plan *plan, const struct inode_key *key)
+{
+    uint64_t h = (key->ino ^ ((uint64_t)key->dev << 32)) * 0x9e3779b97f4a7c15ULL;
+    return (size_t)(h >> 32) & (plan->index_cap - 1);
+}
 
-    char *dir = dirname(path_copy);
-    if (!dir || strcmp(dir, ".") == 0 || strcmp(dir, "/") == 0) {
-        free(path_copy);
+// The plan's entry for key, NULL if it has none
+static struct policy_entry *plan_find(struct policy_plan *plan, const struct inode_key *key)
+{
+    if (!plan->index_cap)
         return NULL;
+    for (size_t slot = plan_slot(plan, key); plan->index[slot];
+         slot = (slot + 1) & (plan->index_cap - 1)) {
+        struct policy_entry *e = &plan->entries[plan->index[slot] - 1];
+        if (e->key.ino == key->ino && e->key.dev == key->dev)
+            return e;
     }
-
-    // dirname modifies path_copy, so we need to copy the result
-    char *result = strdup(dir);
-    free(path_copy);
-    return result;
+    return NULL;
 }
 
-// Recursive directory registration for ** patterns
-static void register_directory_recursive(int map_fd, uid_t uid, const char *dir_path,
-                                         int allow_read, int allow_write)
+// Append an entry for a key the plan does not have yet. -1 when out of
+// memory; the plan is unchanged then.
+static int plan_append(struct policy_plan *plan, const struct inode_key *key,
+                       const struct file_perm *perm, int rule, const char *path)
 {
-    DIR *dir = opendir(dir_path);
-    if (!dir) {
-        return;
+    if (plan->count == plan->cap) {
+        size_t cap = plan->cap ? plan->cap * 2 : 64;
+        struct policy_entry *entries = realloc(plan->entries, cap * sizeof(*entries));
+        if (!entries)
+            return -1;
+        plan->entries = entries;
+        plan->cap = cap;
     }
-
-    struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
-            continue;
+    if ((plan->count + 1) * 2 > plan->index_cap) {
+        size_t index_cap = plan->index_cap ? plan->index_cap * 2 : 128;
+        size_t *index = calloc(index_cap, sizeof(*index));
+        if (!index)
+            return -1;
+        free(plan->index);
+        plan->index = index;
+        plan->index_cap = index_cap;
+        for (size_t i = 0; i < plan->count; i++) {
+            size_t slot = plan_slot(plan, &plan->entries[i].key);
+            while (plan->index[slot])
+                slot = (slot + 1) & (plan->index_cap - 1);
+            plan->index[slot] = i + 1;
         }
+    }
 
-        char full_path[PATH_MAX];
-        snprintf(full_path, sizeof(full_path), "%s/%s", dir_path, entry->d_name);
+    struct policy_entry *e = &plan->entries[plan->count];
+    e->key = *key;
+    e->perm = *perm;
+    e->rule = rule;
+    e->path = path ? strdup(path) : NULL;
 
-        struct stat st;
-        if (stat(full_path, &st) < 0) {
-            continue;
-        }
+    size_t slot = plan_slot(plan, key);
+    while (plan->index[slot])
+        slot = (slot + 1) & (plan->index_cap - 1);
+    plan->index[slot] = ++plan->count;
+    return 0;
+}
 
-        // Register this file/directory
-        register_file_policy_for_inode(map_fd, uid, st.st_dev, st.st_ino,
-                                     allow_read, allow_write);
+static void register_file_policy_for_inode(struct policy_plan *plan,
+                                          const char *path,
+                                          const struct stat *st,
+                                          uint8_t allow,
+                                          int subtree)
+{
+    struct inode_key key;
+    aid_policy_key_stat(&key, st);
 
-        // Recurse into subdirectories
-        if (S_ISDIR(st.st_mode)) {
-            register_directory_recursive(map_fd, uid, full_path, allow_read, allow_write);
-        }
+    // Registration counts as a use: coverage measures idle time from here
+    struct file_perm perm = {
+        .allow = allow,
+        .flags = subtree ? AID_POLICY_SUBTREE : 0,
+        .last_use = boot_seconds(),
+    };
+
+    // A later rule for the same inode replaces the earlier one
+    struct policy_entry *e = plan_find(plan, &key);
+    if (e) {
+        e->perm = perm;
+        e->rule = plan->rule;
+        return;
     }
 
-    closedir(dir);
+    if (plan_append(plan, &key, &perm, plan->rule, path) < 0) {
+        // Nothing has been applied yet
+        fprintf(stderr, "[addagent] out of memory\n");
+        exit(1);
+    }
 }
 
-// Register path (or glob pattern) → stat() → inode
-static int register_file_policy_for_path(int map_fd,
-                                         uid_t uid,
-                                         const char *path_pattern,
-                                         int allow_read,
-                                         int allow_write)
+// Entries in use and capacity of a map
+static int map_occupancy(int map_fd, uint32_t *used, uint32_t *max_entries)
 {
-    // Handle recursive ** pattern
-    if (strstr(path_pattern, "**") != NULL) {
-        char base_path[PATH_MAX];
-        strncpy(base_path, path_pattern, sizeof(base_path) - 1);
-        base_path[sizeof(base_path) - 1] = '\0';
-
-        // Remove "**" and everything after
-        char *star_pos = strstr(base_path, "**");
-        if (star_pos) {
-            if (star_pos > base_path && *(star_pos - 1) == '/') {
-                *(star_pos - 1) = '\0';
-            } else {
-                *star_pos = '\0';
-            }
-        }
-
-        printf("[addagent] Recursive pattern: %s\n", base_path);
+    struct bpf_map_info info = {};
+    uint32_t info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(map_fd, &info, &info_len) < 0)
+        return -1;
 
-        struct stat st;
-        if (stat(base_path, &st) == 0 && S_ISDIR(st.st_mode)) {
-            // Register base directory
-            register_file_policy_for_inode(map_fd, uid, st.st_dev, st.st_ino,
-                                         allow_read, allow_write);
-            // Register all subdirectories and files
-            register_directory_recursive(map_fd, uid, base_path, allow_read, allow_write);
+    char key[64], next_key[64];
+    void *prev = NULL;
+    if (info.key_size > sizeof(key))
+        return -1;
 
-            // Also register parent directories for traversal
-            char *dir = get_parent_dir(base_path);
-            if (dir) {
-                register_directory_policy(map_fd, uid, dir, 1, allow_write);
-                free(dir);
-            }
-            return 0;
-        } else {
-            fprintf(stderr, "[addagent] Base path '%s' is not a directory\n", base_path);
-            return -1;
-        }
+    *used = 0;
+    while (bpf_map_get_next_key(map_fd, prev, next_key) == 0) {
+        (*used)++;
+        memcpy(key, next_key, info.key_size);
+        prev = key;
     }
+    *max_entries = info.max_entries;
+    return 0;
+}
 
-    glob_t g;
-    memset(&g, 0, sizeof(g));
-
-    int flags = 0;
-    int ret = glob(path_pattern, flags, NULL, &g);
-    if (ret == GLOB_NOMATCH) {
-        fprintf(stderr, "[addagent] Warning: No files matching '%s'.\n", path_pattern);
+// Refuse a new agent when inode_policies has no slot left for its inner map.
+// uid is (uid_t)-1 for an agent that does not exist yet; an existing agent
+// only swaps its slot.
+static int check_plan_capacity(int map_fd, const struct policy_plan *plan, uid_t uid)
+{
+    uint32_t used, max_entries;
+    if (map_occupancy(map_fd, &used, &max_entries) < 0) {
+        fprintf(stderr, "[addagent] failed to read %s capacity: %s\n",
+                AID_MAP_PATH, strerror(errno));
+        return -1;
+    }
 
-        // Extract parent directory and register it with READ enabled
-        char *dir = get_parent_dir(path_pattern);
-        if (dir) {
-            printf("[addagent] Attempting to register parent directory: %s\n", dir);
-            register_directory_policy(map_fd, uid, dir, 1, allow_write);  // always allow read for dirs
-            free(dir);
-        }
+    uint32_t key = (uint32_t)uid, inner_id;
+    int present = (int)uid >= 0 && bpf_map_lookup_elem(map_fd, &key, &inner_id) == 0;
 
-        globfree(&g);
-        return 0;  // Changed from -1 to 0 to continue processing
-    } else if (ret != 0) {
-        fprintf(stderr, "[addagent] glob('%s') failed: ret=%d\n", path_pattern, ret);
-        globfree(&g);
+    printf("[addagent] inode_policies: %u/%u agents, manifest needs %zu entries\n",
+           used, max_entries, plan->count);
+    if (!present && used >= max_entries) {
+        fprintf(stderr,
+                "[addagent] Error: %s is full (%u agents). Nothing was registered.\n"
+                "[addagent] Reload with a larger map (aid_lsm_loader -m inode_policies=N).\n",
+                AID_MAP_PATH, max_entries);
         return -1;
     }
+    return 0;
+}
 
-    for (size_t i = 0; i < g.gl_pathc; i++) {
-        const char *path = g.gl_pathv[i];
-        struct stat st;
-        if (stat(path, &st) < 0) {
-            fprintf(stderr, "[addagent] stat(%s) failed: %s\n", path, strerror(errno));
-            continue;
-        }
-        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
-            // Only target files/directories (can extend to devices if needed)
+// fd of the inner map currently installed for uid, -1 if it has none
+static int open_agent_policy_map(int map_fd, uid_t uid)
+{
+    uint32_t key = (uint32_t)uid, inner_id;
+    if ((int)uid < 0 || bpf_map_lookup_elem(map_fd, &key, &inner_id) < 0)
+        return -1;
+    return bpf_map_get_fd_by_id(inner_id);
+}
+
+// Entries the hook inherited onto files the agent created survive a policy
+// update; manifest entries for the same inode win
+static int carry_inherited_entries(int old_fd, struct policy_plan *plan, size_t *carried)
+{
+    struct inode_key key, next_key, *prev = NULL;
+    struct file_perm perm;
+
+    *carried = 0;
+    while (bpf_map_get_next_key(old_fd, prev, &next_key) == 0) {
+        key = next_key;
+        prev = &key;
+        if (bpf_map_lookup_elem(old_fd, &key, &perm) < 0 ||
+            !(perm.flags & AID_POLICY_INHERITED))
             continue;
-        }
-        register_file_policy_for_inode(map_fd, uid, st.st_dev, st.st_ino,
-                                       allow_read, allow_write);
 
-        // Also register parent directory with READ enabled (for directory traversal)
-        char *dir = get_parent_dir(path);
-        if (dir) {
-            register_directory_policy(map_fd, uid, dir, 1, allow_write);  // always allow read for dirs
-            free(dir);
-        }
+        if (plan_find(plan, &key))
+            continue;
+        if (plan_append(plan, &key, &perm, -1, NULL) < 0)
+            return -1;
+        (*carried)++;
     }
-
-    globfree(&g);
     return 0;
 }
 
-int main(int argc, char **argv)
+// Manifest entries the old policy already had keep their hit count and
+// last use, so re-running addagent does not reset coverage
+static void carry_usage(int old_fd, struct policy_plan *plan)
 {
-    if (argc != 2) {
-        fprintf(stderr, "Usage: %s <manifest.yaml>\n", argv[0]);
-        return 1;
+    for (size_t i = 0; i < plan->count; i++) {
+        struct file_perm old;
+        if (plan->entries[i].rule < 0 ||
+            bpf_map_lookup_elem(old_fd, &plan->entries[i].key, &old) < 0)
+            continue;
+        plan->entries[i].perm.hits = old.hits;
+        if (old.last_use)
+            plan->entries[i].perm.last_use = old.last_use;
     }
+}
 
-    if (geteuid() != 0) {
-        fprintf(stderr, "addagent must be run as root.\n");
-        return 1;
+// Fill a new inner map for the agent from the plan. It is not visible to the
+// hook until publish_agent_policy_map() points the agent's slot at it.
+static int build_agent_policy_map(int map_fd, struct policy_plan *plan, uid_t uid)
+{
+    int old_fd = open_agent_policy_map(map_fd, uid);
+    if (old_fd >= 0) {
+        size_t carried;
+        carry_usage(old_fd, plan);
+        int ret = carry_inherited_entries(old_fd, plan, &carried);
+        close(old_fd);
+        if (ret < 0) {
+            fprintf(stderr, "[addagent] out of memory\n");
+            return -1;
+        }
+        if (carried)
+            printf("[addagent] Keeping %zu inherited entries\n", carried);
     }
 
-    const char *manifest_path = argv[1];
-    struct manifest_data m;
-    if (parse_manifest(manifest_path, &m) < 0) {
-        return 1;
+    // Headroom for entries the hook inherits onto files created later
+    LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = AID_INNER_MAP_FLAGS);
+    uint32_t max_entries = (uint32_t)plan->count + AID_INNER_MIN_FREE;
+    int inner_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "aid_agent_pol",
+                                  sizeof(struct inode_key), sizeof(struct file_perm),
+                                  max_entries, &opts);
+    if (inner_fd < 0) {
+        fprintf(stderr, "bpf_map_create (%u entries) failed: uid=%u errno=%s\n",
+                max_entries, uid, strerror(errno));
+        return -1;
     }
 
-    printf("[addagent] manifest agentname='%s', file rules=%d, network.mail=%d\n",
-           m.agentname, m.file_count, m.network_mail);
-
-    uid_t uid = ensure_agent_user(m.agentname);
-    if ((int)uid < 0)
-        return 1;
+    // Bulk load in one syscall per batch; whatever a batch could not take
+    // (old kernel, error) goes through single updates, which report it
+    struct inode_key *keys = malloc(plan->count * sizeof(*keys) + 1);
+    struct file_perm *perms = malloc(plan->count * sizeof(*perms) + 1);
+    if (!keys || !perms) {
+        fprintf(stderr, "[addagent] out of memory\n");
+        goto fail;
+    }
+    for (size_t i = 0; i < plan->count; i++) {
+        keys[i] = plan->entries[i].key;
+        perms[i] = plan->entries[i].perm;
+    }
 
-    int map_fd = open_inode_policy_map();
-    if (map_fd < 0)
-        return 1;
+    size_t done = 0;
+    while (done < plan->count) {
+        uint32_t n = (uint32_t)(plan->count - done);
+        if (bpf_map_update_batch(inner_fd, &keys[done], &perms[done], &n, NULL) < 0)
+            break;
+        done += n;
+    }
+    for (; done < plan->count; done++) {
+        if (bpf_map_update_elem(inner_fd, &keys[done], &perms[done], BPF_ANY) < 0) {
+            fprintf(stderr,
+                    "bpf_map_update_elem failed: uid=%u dev=%u:%u ino=%llu errno=%s\n",
+                    uid, keys[done].dev >> 20, keys[done].dev & 0xfffff,
+                    (unsigned long long)keys[done].ino, strerror(errno));
+            goto fail;
+        }
+    }
+    free(keys);
+    free(perms);
 
-    for (int i = 0; i < m.file_count; i++) {
-        struct file_rule *r = &m.files[i];
-        if (r->path[0] == 0) {
-            fprintf(stderr, "[addagent] rule %d: path is empty. Ignoring.\n", i);
+    for (size_t i = 0; i < plan->count; i++) {
+        const struct inode_key *key = &plan->entries[i].key;
+        const struct file_perm *perm = &plan->entries[i].perm;
+        if (perm->flags & AID_POLICY_INHERITED)
             continue;
+        char verbs[8];
+        printf("[addagent] Registered uid=%u dev=%u:%u ino=%llu allow=%s%s\n",
+               uid, key->dev >> 20, key->dev & 0xfffff, (unsigned long long)key->ino,
+               aid_perm_str(perm->allow, verbs),
+               (perm->flags & AID_POLICY_SUBTREE) ? " subtree" : "");
+    }
+    printf("[addagent] Built %zu entries (capacity %u) for uid=%u\n",
+           plan->count, max_entries, uid);
+    return inner_fd;
+
+fail:
+    free(keys);
+    free(perms);
+    close(inner_fd);
+    return -1;
+}
+
+// Add every key of the plan to policy_bloom. Must happen before the plan is
+// published: a key missing from the filter would hide its entry from the hook.
+static int add_plan_to_bloom(const struct policy_plan *plan)
+{
+    int fd = bpf_obj_get(AID_BLOOM_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_BLOOM_MAP_PATH, strerror(errno));
+        return -1;
+    }
+    for (size_t i = 0; i < plan->count; i++) {
+        if (bpf_map_update_elem(fd, NULL, &plan->entries[i].key, BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem (policy_bloom) failed: %s\n", strerror(errno));
+            close(fd);
+            return -1;
         }
-        printf("[addagent] rule %d: path='%s' read=%d write=%d\n",
-               i, r->path, r->read, r->write);
-        register_file_policy_for_path(map_fd, uid, r->path, r->read, r->write);
     }
+    close(fd);
+    return 0;
+}
 
-    close(map_fd);
+// Point the agent's slot at inner_fd: the one update that switches the hook
+// from the old policy to the new one. *old_fd gets the map it replaced (-1
+// if none) so the caller can switch back.
+static int publish_agent_policy_map(int map_fd, uid_t uid, int inner_fd, int *old_fd)
+{
+    uint32_t key = (uint32_t)uid;
 
-    // Register network permissions
-    int net_map_fd = open_network_policy_map();
-    if (net_map_fd < 0) {
-        fprintf(stderr, "[addagent] Warning: Could not open network policy map\n");
-    } else {
-        register_network_policy(net_map_fd, uid, m.network_mail);
-        close(net_map_fd);
+    *old_fd = open_agent_policy_map(map_fd, uid);
+    if (bpf_map_update_elem(map_fd, &key, &inner_fd, BPF_ANY) < 0) {
+        fprintf(stderr, "bpf_map_update_elem (inode_policies) failed: uid=%u errno=%s\n",
+                uid, strerror(errno));
+        if (*old_fd >= 0)
+            close(*old_fd);
+        *old_fd = -1;
+        return -1;
     }
+    return 0;
+}
+
+// Undo publish_agent_policy_map()
+static void restore_agent_policy_map(int map_fd, uid_t uid, int old_fd)
+{
+    uint32_t key = (uint32_t)uid;
+    int ret = old_fd >= 0 ? bpf_map_update_elem(map_fd, &key, &old_fd, BPF_ANY)
+                          : bpf_map_delete_elem(map_fd, &key);
+    if (ret < 0)
+        fprintf(stderr, "[addagent] Error: could not restore the previous policy: %s\n",
+                strerror(errno));
+}
+
+// --- Inode storage (policy_store = inode) ---
+// The plan goes into the files' own inode storage instead of an inner map.
+// The map is keyed by an fd of the file. The new slots carry the next
+// epoch, which the hook only accepts once register_agent_profile() moves
+// the agent to it. Until then, the previous registration's slots stay in
+// force.
+
+// The load-time settings: policy_store, xattr_labels
+static int read_config(struct aid_config *cfg)
+{
+    int fd = bpf_obj_get(AID_CONFIG_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_CONFIG_MAP_PATH, strerror(errno));
+        return -1;
+    }
+    uint32_t key = 0;
+    int ret = bpf_map_lookup_elem(fd, &key, cfg);
+    close(fd);
+    return ret;
+}
+
+static int open_inode_store(void)
+{
+    int fd = bpf_obj_get(AID_INODE_STORE_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_INODE_STORE_PATH, strerror(errno));
+    }
+    return fd;
+}
+
+// O_PATH fd of a planned entry's file, -1 if the path now names another inode
+static int open_entry(const struct policy_entry *e)
+{
+    struct stat st;
+    struct inode_key key;
+    int fd = e->path ? open(e->path, O_PATH | O_CLOEXEC) : -1;
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return -1;
+    }
+    aid_policy_key_stat(&key, &st);
+    if (key.ino != e->key.ino || key.dev != e->key.dev) {
+        close(fd);
+        errno = ESTALE;
+        return -1;
+    }
+    return fd;
+}
+
+// Can slot s be overwritten? Free, ours from an older registration, or
+// dead for its own agent (revoked, or a manifest slot it has moved past)
+static int slot_reusable(int profile_fd, const struct aid_inode_slot *s, uid_t uid,
+                         uint32_t live_epoch)
+{
+    if (s->uid == 0)
+        return 1;
+    if (s->uid == uid)
+        return s->epoch != live_epoch;
+
+    uint32_t idx = s->uid - AID_UID_BASE;
+    struct agent_profile p;
+    if (bpf_map_lookup_elem(profile_fd, &idx, &p) < 0)
+        return 0;
+    return s->epoch <= p.base_epoch || s->epoch > p.epoch ||
+           (s->epoch < p.epoch && !(s->perm.flags & AID_POLICY_INHERITED));
+}
+
+// Write uid's grants for epoch prof->epoch. -1 if a file could not take it
+// (every slot held by live grants of other agents).
+static int write_inode_slots(int store_fd, int profile_fd, const struct policy_plan *plan,
+                             uid_t uid, const struct agent_profile *prof)
+{
+    // The registration being replaced, 0 if it was revoked (or none)
+    uint32_t live_epoch = prof->epoch - 1 > prof->base_epoch ? prof->epoch - 1 : 0;
+    size_t written = 0;
+
+    for (size_t i = 0; i < plan->count; i++) {
+        const struct policy_entry *e = &plan->entries[i];
+        int fd = open_entry(e);
+        if (fd < 0) {
+            fprintf(stderr, "[addagent] Warning: %s: %s, skipped\n",
+                    e->path ? e->path : "?", strerror(errno));
+            continue;
+        }
+
+        struct aid_inode_policy ip;
+        if (bpf_map_lookup_elem(store_fd, &fd, &ip) < 0)
+            memset(&ip, 0, sizeof(ip));
+
+        // Prefer a free or dead slot, so the live one keeps working until
+        // the profile switches; overwrite it in place only as a last resort
+        int slot = -1, live = -1;
+        for (int s = 0; s < AID_INODE_SLOTS; s++) {
+            if (ip.slot[s].uid == uid && ip.slot[s].epoch == live_epoch)
+                live = s;
+            else if (slot < 0 && slot_reusable(profile_fd, &ip.slot[s], uid, live_epoch))
+                slot = s;
+        }
+        if (slot < 0)
+            slot = live;
+        if (slot < 0) {
+            fprintf(stderr, "[addagent] %s: all %d inode slots in use by other agents\n",
+                    e->path, AID_INODE_SLOTS);
+            close(fd);
+            return -1;
+        }
+
+        struct aid_inode_slot next = { .uid = uid, .epoch = prof->epoch, .perm = e->perm };
+        if (live >= 0) {
+            next.perm.hits = ip.slot[live].perm.hits;
+            next.perm.last_use = ip.slot[live].perm.last_use;
+        }
+        ip.slot[slot] = next;
+        if (bpf_map_update_elem(store_fd, &fd, &ip, BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem (inode_store) failed: %s: %s\n",
+                    e->path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        close(fd);
+        written++;
+    }
+    printf("[addagent] Wrote %zu inode storage slots for uid=%u (epoch %u)\n",
+           written, uid, prof->epoch);
+    return 0;
+}
+
+// uid's grant for a planned entry in the live policy, from either store
+static int live_perm(int inner_fd, int store_fd, uid_t uid, const struct agent_profile *prof,
+                     const struct policy_entry *e, struct file_perm *perm)
+{
+    if (store_fd < 0)
+        return bpf_map_lookup_elem(inner_fd, &e->key, perm);
+
+    struct aid_inode_policy ip;
+    int fd = open_entry(e);
+    if (fd < 0)
+        return -1;
+    int ret = bpf_map_lookup_elem(store_fd, &fd, &ip);
+    close(fd);
+    if (ret < 0)
+        return -1;
+    for (int s = 0; s < AID_INODE_SLOTS; s++) {
+        if (ip.slot[s].uid == uid && ip.slot[s].epoch == prof->epoch &&
+            prof->epoch > prof->base_epoch) {
+            *perm = ip.slot[s].perm;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// --- Specialized programs ---
+// With aid_config.specialize the hook hands an agent to its own
+// file_permission program (bpf/aid_agent.bpf.o), loaded here with the
+// agent's entries and profile baked into its .rodata. Hits on the baked
+// entries are counted in the program's .bss, read back through the
+// agent's agent_progs slot.
+
+static int cmp_spec_entry(const void *a, const void *b)
+{
+    const struct aid_spec_entry *x = a, *y = b;
+    if (x->dev != y->dev)
+        return x->dev < y->dev ? -1 : 1;
+    return (x->ino > y->ino) - (x->ino < y->ino);
+}
+
+// Does an fs_rules entry decide the files of the filesystem holding path?
+static int has_fs_rule(int fs_fd, const char *path, uint32_t dev)
+{
+    struct fs_rule_key key = { .kind = AID_FS_KIND_DEV, .id = dev };
+    struct fs_rule rule;
+    struct statfs sfs;
+
+    if (bpf_map_lookup_elem(fs_fd, &key, &rule) == 0)
+        return 1;
+    if (statfs(path, &sfs) < 0)
+        return 1;   // unknown: leave it to the generic path
+    key.kind = AID_FS_KIND_MAGIC;
+    key.id = (uint32_t)sfs.f_type;
+    return bpf_map_lookup_elem(fs_fd, &key, &rule) == 0;
+}
+
+// Bake the manifest entries of the plan into spec, sorted for the program's
+// binary search. Entries on a filesystem with an fs rule are left out (the
+// rule decides their files), and so are the inherited ones (the program
+// checks the inner map for those). -1 if more than AID_SPEC_MAX remain.
+static int build_spec(const struct policy_plan *plan, uid_t uid,
+                      const struct agent_profile *prof, uint32_t fs_gen, struct aid_spec *spec)
+{
+    int fs_fd = bpf_obj_get(AID_FS_RULES_MAP_PATH);
+    if (fs_fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_FS_RULES_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    memset(spec, 0, sizeof(*spec));
+    memset(spec->entry, 0xff, sizeof(spec->entry));
+    spec->uid = (uint32_t)uid;
+    spec->flags = prof->flags;
+    spec->fs_gen = fs_gen;
+
+    int n = 0;
+    for (size_t i = 0; i < plan->count; i++) {
+        const struct policy_entry *e = &plan->entries[i];
+        if (e->rule < 0 || !e->path || has_fs_rule(fs_fd, e->path, e->key.dev))
+            continue;
+
+        // The plan holds one entry per inode (a later rule already replaced
+        // the earlier one in place), so no duplicate check is needed here
+        if (n == AID_SPEC_MAX) {
+            printf("[addagent] More than %d entries to specialize\n", AID_SPEC_MAX);
+            close(fs_fd);
+            return -1;
+        }
+        int j = n++;
+        spec->entry[j].ino = e->key.ino;
+        spec->entry[j].dev = e->key.dev;
+        spec->entry[j].allow = e->perm.allow;
+        spec->entry[j].flags = e->perm.flags;
+        spec->entry[j]._pad = 0;
+        if (e->perm.flags & AID_POLICY_SUBTREE)
+            spec->subtrees++;
+    }
+    close(fs_fd);
+    qsort(spec->entry, n, sizeof(spec->entry[0]), cmp_spec_entry);
+    return n;
+}
+
+// The .rodata and .bss of the program in uid's slot; -1 if it has none
+static int read_spec_usage(uid_t uid, struct aid_spec *spec, struct aid_spec_usage *usage)
+{
+    int progs_fd = bpf_obj_get(AID_AGENT_PROGS_PATH);
+    uint32_t idx = (uint32_t)uid - AID_UID_BASE, prog_id;
+    if (progs_fd < 0)
+        return -1;
+    int ret = bpf_map_lookup_elem(progs_fd, &idx, &prog_id);
+    close(progs_fd);
+    int prog_fd = ret < 0 ? -1 : bpf_prog_get_fd_by_id(prog_id);
+    if (prog_fd < 0)
+        return -1;
+
+    uint32_t map_ids[8];
+    struct bpf_prog_info info = {
+        .nr_map_ids = sizeof(map_ids) / sizeof(map_ids[0]),
+        .map_ids = (uint64_t)(uintptr_t)map_ids,
+    };
+    uint32_t info_len = sizeof(info);
+    ret = bpf_obj_get_info_by_fd(prog_fd, &info, &info_len);
+    close(prog_fd);
+    if (ret < 0)
+        return -1;
+
+    int found = 0;
+    uint32_t zero = 0;
+    for (uint32_t i = 0; i < info.nr_map_ids && i < sizeof(map_ids) / sizeof(map_ids[0]); i++) {
+        int fd = bpf_map_get_fd_by_id(map_ids[i]);
+        struct bpf_map_info minfo = {};
+        uint32_t minfo_len = sizeof(minfo);
+        if (fd < 0)
+            continue;
+        if (bpf_obj_get_info_by_fd(fd, &minfo, &minfo_len) == 0) {
+            if (strstr(minfo.name, ".rodata") && minfo.value_size == sizeof(*spec) &&
+                bpf_map_lookup_elem(fd, &zero, spec) == 0)
+                found |= 1;
+            else if (strstr(minfo.name, ".bss") &&
+                     minfo.value_size == AID_SPEC_MAX * sizeof(*usage) &&
+                     bpf_map_lookup_elem(fd, &zero, usage) == 0)
+                found |= 2;
+        }
+        close(fd);
+    }
+    return found == 3 ? 0 : -1;
+}
+
+// Add what the specialized program counted for key to perm
+static void add_spec_usage(const struct aid_spec *spec, const struct aid_spec_usage *usage,
+                           const struct inode_key *key, struct file_perm *perm)
+{
+    struct aid_spec_entry want = { .ino = key->ino, .dev = key->dev };
+    const struct aid_spec_entry *e = bsearch(&want, spec->entry, AID_SPEC_MAX,
+                                             sizeof(spec->entry[0]), cmp_spec_entry);
+    if (!e)
+        return;
+    const struct aid_spec_usage *u = &usage[e - spec->entry];
+    perm->hits += u->hits;
+    if (u->last_use > perm->last_use)
+        perm->last_use = u->last_use;
+}
+
+// The old program's counts go into the new inner map (not yet published):
+// its baked entries never touched the old one's
+static void carry_spec_usage(int inner_fd, uid_t uid)
+{
+    static struct aid_spec spec;
+    static struct aid_spec_usage usage[AID_SPEC_MAX];
+
+    if (read_spec_usage(uid, &spec, usage) < 0)
+        return;
+    for (int i = 0; i < AID_SPEC_MAX && spec.entry[i].ino != UINT64_MAX; i++) {
+        struct inode_key key;
+        struct file_perm perm;
+        if (!usage[i].hits)
+            continue;
+        aid_policy_key(&key, spec.entry[i].ino, spec.entry[i].dev);
+        if (bpf_map_lookup_elem(inner_fd, &key, &perm) < 0)
+            continue;
+        add_spec_usage(&spec, usage, &key, &perm);
+        bpf_map_update_elem(inner_fd, &key, &perm, BPF_EXIST);
+    }
+}
+
+// Empty uid's slot: the hook evaluates the agent generically again
+static void remove_spec_program(uid_t uid)
+{
+    int progs_fd = bpf_obj_get(AID_AGENT_PROGS_PATH);
+    uint32_t idx = (uint32_t)uid - AID_UID_BASE;
+    if (progs_fd < 0)
+        return;
+    bpf_map_delete_elem(progs_fd, &idx);
+    close(progs_fd);
+}
+
+// Load bpf/aid_agent.bpf.o with spec baked in and put it in uid's slot,
+// sharing the loader's pinned maps
+static int install_spec_program(const struct aid_spec *spec, uid_t uid)
+{
+    static const struct {
+        const char *name;
+        const char *path;
+    } shared[] = {
+        { "aid_config",     AID_CONFIG_MAP_PATH },
+        { "agent_profiles", AID_PROFILES_MAP_PATH },
+        { "aid_tasks",      AID_TASKS_MAP_PATH },
+        { "inode_policies", AID_MAP_PATH },
+        { "verdict_stats",  AID_STATS_MAP_PATH },
+        { "flight_recorder", AID_FLIGHT_MAP_PATH },
+        { "flight_head",    AID_FLIGHT_HEAD_PATH },
+        { "agent_progs",    AID_AGENT_PROGS_PATH },
+    };
+
+    // Next to the executable like the loader's object, else from the cwd
+    char obj_path[PATH_MAX], exe_path[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    snprintf(obj_path, sizeof(obj_path), "bpf/aid_agent.bpf.o");
+    if (len > 0) {
+        exe_path[len] = '\0';
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s/../bpf/aid_agent.bpf.o", dirname(exe_path));
+        if (access(path, F_OK) == 0)
+            snprintf(obj_path, sizeof(obj_path), "%s", path);
+    }
+
+    struct bpf_object *obj = bpf_object__open_file(obj_path, NULL);
+    if (!obj) {
+        fprintf(stderr, "bpf_object__open_file(%s) failed\n", obj_path);
+        return -1;
+    }
+
+    int ret = -1;
+    struct bpf_map *rodata = bpf_object__find_map_by_name(obj, ".rodata");
+    if (!rodata || bpf_map__set_initial_value(rodata, spec, sizeof(*spec)) < 0) {
+        fprintf(stderr, "%s: .rodata does not match struct aid_spec\n", obj_path);
+        goto out;
+    }
+    for (size_t i = 0; i < sizeof(shared) / sizeof(shared[0]); i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, shared[i].name);
+        int fd = bpf_obj_get(shared[i].path);
+        int err = map && fd >= 0 ? bpf_map__reuse_fd(map, fd) : -1;
+        if (fd >= 0)
+            close(fd);
+        if (err < 0) {
+            fprintf(stderr, "failed to share map '%s' (%s)\n", shared[i].name, shared[i].path);
+            goto out;
+        }
+    }
+    if (bpf_object__load(obj) < 0) {
+        fprintf(stderr, "bpf_object__load(%s) failed\n", obj_path);
+        goto out;
+    }
+
+    struct bpf_program *prog = bpf_object__find_program_by_name(obj, "aid_agent_file_permission");
+    int prog_fd = prog ? bpf_program__fd(prog) : -1;
+    int progs_fd = bpf_obj_get(AID_AGENT_PROGS_PATH);
+    uint32_t idx = (uint32_t)uid - AID_UID_BASE;
+    if (prog_fd >= 0 && progs_fd >= 0 && bpf_map_update_elem(progs_fd, &idx, &prog_fd, BPF_ANY) == 0)
+        ret = 0;
+    else
+        fprintf(stderr, "bpf_map_update_elem (agent_progs) failed: %s\n", strerror(errno));
+    if (progs_fd >= 0)
+        close(progs_fd);
+out:
+    // The prog array keeps the program (and its .rodata/.bss) alive
+    bpf_object__close(obj);
+    return ret;
+}
+
+// Replace uid's specialized program with one for the policy just
+// registered. Whatever fails, the agent is left without one rather than
+// with a program baked from the old policy. n is build_spec()'s result.
+static void specialize_agent(const struct aid_spec *spec, int n, uid_t uid)
+{
+    if (n < 0) {
+        remove_spec_program(uid);
+        printf("[addagent] No specialized program, the generic path applies\n");
+        return;
+    }
+    if (install_spec_program(spec, uid) < 0) {
+        remove_spec_program(uid);
+        fprintf(stderr, "[addagent] Warning: no specialized program, the generic path applies\n");
+        return;
+    }
+    printf("[addagent] Specialized program: %d entries (%u subtree)\n", n, spec->subtrees);
+}
+
+// --- Network allowlist ---
+// Destinations are resolved once, here: the cgroup hooks only ever see
+// addresses, so a host whose addresses change needs addagent to be re-run.
+// The agent's old net_rules entries stay in place until the new ones are
+// all in, then the ones no longer listed are removed.
+
+#define MAX_NET_RULES 1024
+
+struct net_plan {
+    struct net_rule_key keys[MAX_NET_RULES];
+    size_t count;
+    struct net_rule_key old[MAX_NET_RULES];   // the agent's entries before this run
+    size_t old_count;
+};
+
+static int net_key_in(const struct net_rule_key *keys, size_t n, const struct net_rule_key *key)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(&keys[i], key, sizeof(*key)) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Add addr/bits:port for uid, host bits cleared
+static int add_net_key(struct net_plan *plan, uid_t uid, int family, const void *addr,
+                       int bits, int port)
+{
+    struct net_rule_key key;
+
+    memset(&key, 0, sizeof(key));
+    key.uid = (uint32_t)uid;
+    key.port = (uint16_t)port;
+    if (family == AF_INET) {
+        key.addr[10] = 0xff;
+        key.addr[11] = 0xff;
+        memcpy(&key.addr[12], addr, 4);
+        bits += AID_NET_V4_BITS;
+    } else {
+        memcpy(key.addr, addr, 16);
+    }
+    key.prefixlen = AID_NET_PREFIX_BASE + bits;
+    for (int i = 0; i < 16; i++) {
+        int keep = bits - i * 8;
+        if (keep <= 0)
+            key.addr[i] = 0;
+        else if (keep < 8)
+            key.addr[i] &= (uint8_t)(0xff << (8 - keep));
+    }
+
+    if (net_key_in(plan->keys, plan->count, &key))
+        return 0;
+    if (plan->count == MAX_NET_RULES) {
+        fprintf(stderr, "[addagent] Too many network rules (>%d)\n", MAX_NET_RULES);
+        return -1;
+    }
+    plan->keys[plan->count++] = key;
+
+    char buf[80];
+    printf("[addagent]   -> %s\n", aid_net_rule_str(&key, buf, sizeof(buf)));
+    return 0;
+}
+
+// "host[/bits][:port]", "[v6addr][/bits][:port]" or a bare IPv6 address or
+// CIDR; a port of 0 or "*" means any port. Names may resolve to several
+// addresses, each becomes an entry.
+static int resolve_net_dest(struct net_plan *plan, uid_t uid, const char *spec, int port)
+{
+    char buf[256];
+    char *host = buf, *bits_str = NULL, *port_str = NULL, *c;
+
+    snprintf(buf, sizeof(buf), "%s", spec);
+    if (buf[0] == '[') {
+        c = strchr(buf, ']');
+        if (!c)
+            goto invalid;
+        *c++ = 0;
+        host = buf + 1;
+        if (*c == '/') {
+            bits_str = c + 1;
+            c = strchr(bits_str, ':');
+        }
+        if (c && *c == ':') {
+            *c = 0;
+            port_str = c + 1;
+        } else if (c && *c) {
+            goto invalid;
+        }
+    } else {
+        // One colon is a port; more than one is an unbracketed IPv6 address
+        c = strchr(buf, ':');
+        if (c && !strchr(c + 1, ':')) {
+            *c = 0;
+            port_str = c + 1;
+        }
+        c = strchr(host, '/');
+        if (c) {
+            *c = 0;
+            bits_str = c + 1;
+        }
+    }
+
+    if (port_str)
+        port = strcmp(port_str, "*") == 0 ? 0 : atoi(port_str);
+    if (port < 0)
+        port = 0;
+    if (port > 65535 || *host == 0)
+        goto invalid;
+
+    struct addrinfo hints, *res, *ai;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;   // one result per address
+    hints.ai_flags = bits_str ? AI_NUMERICHOST : 0;
+
+    int err = getaddrinfo(host, NULL, &hints, &res);
+    if (err) {
+        fprintf(stderr, "[addagent] Cannot resolve '%s': %s\n", host, gai_strerror(err));
+        return -1;
+    }
+
+    printf("[addagent] network: %s\n", spec);
+    int ret = 0;
+    for (ai = res; ai && ret == 0; ai = ai->ai_next) {
+        const void *addr;
+        int max_bits;
+
+        if (ai->ai_family == AF_INET) {
+            addr = &((struct sockaddr_in *)ai->ai_addr)->sin_addr;
+            max_bits = 32;
+        } else if (ai->ai_family == AF_INET6) {
+            addr = &((struct sockaddr_in6 *)ai->ai_addr)->sin6_addr;
+            max_bits = 128;
+        } else {
+            continue;
+        }
+
+        int bits = bits_str ? atoi(bits_str) : max_bits;
+        if (bits < 0 || bits > max_bits) {
+            freeaddrinfo(res);
+            goto invalid;
+        }
+        ret = add_net_key(plan, uid, ai->ai_family, addr, bits, port);
+    }
+    freeaddrinfo(res);
+    return ret;
+
+invalid:
+    fprintf(stderr, "[addagent] Invalid network destination '%s'\n", spec);
+    return -1;
+}
+
+// The agent's own lookups: every nameserver in /etc/resolv.conf, port 53
+static int resolve_nameservers(struct net_plan *plan, uid_t uid)
+{
+    FILE *f = fopen("/etc/resolv.conf", "r");
+    if (!f) {
+        fprintf(stderr, "[addagent] Warning: no /etc/resolv.conf, DNS not allowed\n");
+        return 0;
+    }
+
+    char line[256], server[INET6_ADDRSTRLEN + 8];
+    int ret = 0;
+    while (ret == 0 && fgets(line, sizeof(line), f)) {
+        char addr[INET6_ADDRSTRLEN];
+        if (sscanf(line, " nameserver %45s", addr) != 1)
+            continue;
+        // Link-local servers carry a %scope the trie cannot hold
+        char *scope = strchr(addr, '%');
+        if (scope)
+            *scope = 0;
+        snprintf(server, sizeof(server), strchr(addr, ':') ? "[%s]" : "%s", addr);
+        ret = resolve_net_dest(plan, uid, server, 53);
+    }
+    fclose(f);
+    return ret;
+}
+
+static int build_net_plan(const struct manifest_data *m, uid_t uid, struct net_plan *plan)
+{
+    plan->count = 0;
+    for (int i = 0; i < m->net_count; i++) {
+        if (resolve_net_dest(plan, uid, m->nets[i].spec, m->nets[i].port) < 0)
+            return -1;
+    }
+    if (m->net_count > 0 && m->net_dns)
+        return resolve_nameservers(plan, uid);
+    return 0;
+}
+
+static int open_net_rules_map(void)
+{
+    int fd = bpf_obj_get(AID_NET_RULES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_NET_RULES_MAP_PATH, strerror(errno));
+    }
+    return fd;
+}
+
+// Undo stage_net_rules(): remove what it added, keep the old entries
+static void unstage_net_rules(int map_fd, const struct net_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++) {
+        if (!net_key_in(plan->old, plan->old_count, &plan->keys[i]))
+            bpf_map_delete_elem(map_fd, &plan->keys[i]);
+    }
+}
+
+// Add the plan's entries next to the agent's current ones
+static int stage_net_rules(int map_fd, uid_t uid, struct net_plan *plan)
+{
+    struct net_rule_key key, next_key;
+    struct net_rule_key *prev = NULL;
+    struct net_rule rule = { .allow = 1 };
+
+    plan->old_count = 0;
+    while (bpf_map_get_next_key(map_fd, prev, &next_key) == 0) {
+        if (next_key.uid == (uint32_t)uid && plan->old_count < MAX_NET_RULES)
+            plan->old[plan->old_count++] = next_key;
+        key = next_key;
+        prev = &key;
+    }
+
+    for (size_t i = 0; i < plan->count; i++) {
+        if (bpf_map_update_elem(map_fd, &plan->keys[i], &rule, BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem (net_rules) failed: uid=%u errno=%s\n",
+                    uid, strerror(errno));
+            unstage_net_rules(map_fd, plan);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Drop the old entries the new manifest no longer lists
+static void prune_net_rules(int map_fd, const struct net_plan *plan)
+{
+    size_t removed = 0;
+
+    for (size_t i = 0; i < plan->old_count; i++) {
+        if (!net_key_in(plan->keys, plan->count, &plan->old[i]) &&
+            bpf_map_delete_elem(map_fd, &plan->old[i]) == 0)
+            removed++;
+    }
+    printf("[addagent] Registered %zu network rules (%zu removed)\n", plan->count, removed);
+}
+
+// --- Suffix classes ---
+// The agent's own sensitive:/public: entries in suffix_classes, swapped in
+// the same way as its network rules: old values are kept so a failed
+// registration can put them back.
+
+struct suffix_plan {
+    struct suffix_rule *rules;   // the manifest's, uid filled in
+    size_t count;
+    struct suffix_rule old[MAX_SUFFIX_CLASSES * 2];
+    size_t old_count;
+};
+
+static int open_suffix_map(void)
+{
+    int fd = bpf_obj_get(AID_SUFFIX_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_SUFFIX_MAP_PATH, strerror(errno));
+    }
+    return fd;
+}
+
+static int suffix_in(const struct suffix_rule *rules, size_t n, const struct suffix_key *key)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(&rules[i].key, key, sizeof(*key)) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+// Undo stage_suffix_classes()
+static void unstage_suffix_classes(int map_fd, const struct suffix_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++) {
+        if (!suffix_in(plan->old, plan->old_count, &plan->rules[i].key))
+            bpf_map_delete_elem(map_fd, &plan->rules[i].key);
+    }
+    for (size_t i = 0; i < plan->old_count; i++)
+        bpf_map_update_elem(map_fd, &plan->old[i].key, &plan->old[i].class, BPF_ANY);
+}
+
+static int stage_suffix_classes(int map_fd, uid_t uid, struct manifest_data *m,
+                                struct suffix_plan *plan)
+{
+    struct suffix_key key, next_key, *prev = NULL;
+
+    plan->rules = m->suffixes;
+    plan->count = m->suffix_count;
+    plan->old_count = 0;
+    while (bpf_map_get_next_key(map_fd, prev, &next_key) == 0) {
+        struct suffix_rule *old = &plan->old[plan->old_count];
+        if (next_key.uid == (uint32_t)uid &&
+            plan->old_count < sizeof(plan->old) / sizeof(plan->old[0]) &&
+            bpf_map_lookup_elem(map_fd, &next_key, &old->class) == 0) {
+            old->key = next_key;
+            plan->old_count++;
+        }
+        key = next_key;
+        prev = &key;
+    }
+
+    for (size_t i = 0; i < plan->count; i++) {
+        plan->rules[i].key.uid = (uint32_t)uid;
+        if (bpf_map_update_elem(map_fd, &plan->rules[i].key, &plan->rules[i].class,
+                                BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem (suffix_classes) failed: uid=%u errno=%s\n",
+                    uid, strerror(errno));
+            unstage_suffix_classes(map_fd, plan);
+            return -1;
+        }
+        printf("[addagent] suffix class %.*s: %s\n", AID_SUFFIX_LEN,
+               (const char *)plan->rules[i].key.suffix,
+               plan->rules[i].class.sensitive ? "sensitive" : "public");
+    }
+    return 0;
+}
+
+// Drop the agent's classes the new manifest no longer lists
+static void prune_suffix_classes(int map_fd, const struct suffix_plan *plan)
+{
+    for (size_t i = 0; i < plan->old_count; i++) {
+        if (!suffix_in(plan->rules, plan->count, &plan->old[i].key))
+            bpf_map_delete_elem(map_fd, &plan->old[i].key);
+    }
+}
+
+// Register the parent directory of a rule's files for traversal: read only.
+// Creating or removing entries in it takes a rule naming the directory. An
+// entry the plan already has for it (a dir/** rule, a directory rule with
+// write) is kept: only a manifest rule replaces an entry.
+static int register_directory_policy(struct policy_plan *plan,
+                                      const char *dir_path)
+{
+    struct stat st;
+    if (stat(dir_path, &st) < 0) {
+        fprintf(stderr, "[addagent] Warning: stat(%s) failed: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return 0;  // Not a directory
+    }
+
+    struct inode_key key;
+    aid_policy_key_stat(&key, &st);
+    if (plan_find(plan, &key))
+        return 0;
+
+    printf("[addagent] Registering directory policy: %s\n", dir_path);
+    register_file_policy_for_inode(plan, dir_path, &st, AID_PERM_READ, 0);
+    return 0;
+}
+
+// Extract parent directory path safely
+static char *get_parent_dir(const char *path)
+{
+    if (!path || *path == '\0')
+        return NULL;
+
+    char *path_copy = strdup(path);
+    if (!path_copy)
+        return NULL;
+
+    char *dir = dirname(path_copy);
+    if (!dir || strcmp(dir, ".") == 0 || strcmp(dir, "/") == 0) {
+        free(path_copy);
+        return NULL;
+    }
+
+    // dirname modifies path_copy, so we need to copy the result
+    char *result = strdup(dir);
+    free(path_copy);
+    return result;
+}
+
+// Base directory of a recursive "dir/**" pattern; 0 if it has no "**"
+static int recursive_base(const char *path_pattern, char *base_path, size_t len)
+{
+    if (strstr(path_pattern, "**") == NULL)
+        return 0;
+
+    snprintf(base_path, len, "%s", path_pattern);
+
+    // Remove "**" and everything after
+    char *star_pos = strstr(base_path, "**");
+    if (star_pos) {
+        if (star_pos > base_path && *(star_pos - 1) == '/') {
+            *(star_pos - 1) = '\0';
+        } else {
+            *star_pos = '\0';
+        }
+    }
+    return 1;
+}
+
+// Does the rule name a directory: "dir/**" or the path of one?
+static int rule_names_directory(const struct file_rule *r)
+{
+    char base_path[PATH_MAX];
+    struct stat st;
+
+    if (recursive_base(r->path, base_path, sizeof(base_path)))
+        return 1;
+    return stat(r->path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+// Register path (or glob pattern) → stat() → inode
+static int register_file_policy_for_path(struct policy_plan *plan,
+                                         const char *path_pattern,
+                                         uint8_t allow)
+{
+    char base_path[PATH_MAX];
+
+    // Handle recursive ** pattern
+    if (recursive_base(path_pattern, base_path, sizeof(base_path))) {
+        printf("[addagent] Recursive pattern: %s\n", base_path);
+
+        struct stat st;
+        if (stat(base_path, &st) == 0 && S_ISDIR(st.st_mode)) {
+            // One subtree entry on the base directory: the hook finds it by
+            // walking up from any file below, including files created later
+            register_file_policy_for_inode(plan, base_path, &st, allow, 1);
+
+            // Also register parent directories for traversal
+            char *dir = get_parent_dir(base_path);
+            if (dir) {
+                register_directory_policy(plan, dir);
+                free(dir);
+            }
+            return 0;
+        } else {
+            fprintf(stderr, "[addagent] Base path '%s' is not a directory\n", base_path);
+            return -1;
+        }
+    }
+
+    glob_t g;
+    memset(&g, 0, sizeof(g));
+
+    int flags = 0;
+    int ret = glob(path_pattern, flags, NULL, &g);
+    if (ret == GLOB_NOMATCH) {
+        fprintf(stderr, "[addagent] Warning: No files matching '%s'.\n", path_pattern);
+
+        // Extract parent directory and register it with READ enabled; the
+        // file itself can only be created under a rule for the directory
+        char *dir = get_parent_dir(path_pattern);
+        if (dir) {
+            printf("[addagent] Attempting to register parent directory: %s\n", dir);
+            register_directory_policy(plan, dir);
+            free(dir);
+        }
+
+        globfree(&g);
+        return 0;  // Changed from -1 to 0 to continue processing
+    } else if (ret != 0) {
+        fprintf(stderr, "[addagent] glob('%s') failed: ret=%d\n", path_pattern, ret);
+        globfree(&g);
+        return -1;
+    }
+
+    for (size_t i = 0; i < g.gl_pathc; i++) {
+        const char *path = g.gl_pathv[i];
+        struct stat st;
+        if (stat(path, &st) < 0) {
+            fprintf(stderr, "[addagent] stat(%s) failed: %s\n", path, strerror(errno));
+            continue;
+        }
+        if (!S_ISREG(st.st_mode) && !S_ISDIR(st.st_mode)) {
+            // Only target files/directories (can extend to devices if needed)
+            continue;
+        }
+        register_file_policy_for_inode(plan, path, &st,
+                                       S_ISDIR(st.st_mode) ? allow : allow & ~AID_PERM_DIR_VERBS, 0);
+
+        // Also register parent directory with READ enabled (for directory traversal)
+        char *dir = get_parent_dir(path);
+        if (dir) {
+            register_directory_policy(plan, dir);
+            free(dir);
+        }
+    }
+
+    globfree(&g);
+    return 0;
+}
+
+// --- xattr labels ---
+// A rule with label: stamps AID_LABEL_XATTR on the files it matches and
+// gives the agent one label_rules entry instead of an entry per file. The
+// agent's entries are swapped like its suffix classes.
+
+struct label_rule {
+    struct label_key key;
+    struct file_perm perm;
+};
+
+struct label_plan {
+    struct label_rule rules[MAX_FILE_RULES];
+    size_t count;
+    struct label_rule old[MAX_FILE_RULES];   // the agent's entries before this run
+    size_t old_count;
+};
+
+static int open_label_map(void)
+{
+    int fd = bpf_obj_get(AID_LABEL_RULES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_LABEL_RULES_MAP_PATH, strerror(errno));
+    }
+    return fd;
+}
+
+// A later rule for the same label replaces the earlier one
+static void add_label_rule(struct label_plan *plan, const struct file_rule *r, uint8_t allow)
+{
+    struct label_key key;
+    aid_label_key_parse(r->label, 0, &key);
+
+    size_t i = 0;
+    while (i < plan->count && memcmp(&plan->rules[i].key, &key, sizeof(key)) != 0)
+        i++;
+    if (i == plan->count)
+        plan->count++;
+    plan->rules[i].key = key;
+    plan->rules[i].perm = (struct file_perm){ .allow = allow, .last_use = boot_seconds() };
+}
+
+static const struct label_rule *label_in(const struct label_rule *rules, size_t n,
+                                         const struct label_key *key)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (memcmp(&rules[i].key, key, sizeof(*key)) == 0)
+            return &rules[i];
+    }
+    return NULL;
+}
+
+// Undo stage_label_rules()
+static void unstage_label_rules(int map_fd, const struct label_plan *plan)
+{
+    for (size_t i = 0; i < plan->count; i++) {
+        if (!label_in(plan->old, plan->old_count, &plan->rules[i].key))
+            bpf_map_delete_elem(map_fd, &plan->rules[i].key);
+    }
+    for (size_t i = 0; i < plan->old_count; i++)
+        bpf_map_update_elem(map_fd, &plan->old[i].key, &plan->old[i].perm, BPF_ANY);
+}
+
+static int stage_label_rules(int map_fd, uid_t uid, struct label_plan *plan)
+{
+    struct label_key key, next_key, *prev = NULL;
+
+    plan->old_count = 0;
+    while (bpf_map_get_next_key(map_fd, prev, &next_key) == 0) {
+        struct label_rule *old = &plan->old[plan->old_count];
+        if (next_key.uid == (uint32_t)uid &&
+            plan->old_count < sizeof(plan->old) / sizeof(plan->old[0]) &&
+            bpf_map_lookup_elem(map_fd, &next_key, &old->perm) == 0) {
+            old->key = next_key;
+            plan->old_count++;
+        }
+        key = next_key;
+        prev = &key;
+    }
+
+    for (size_t i = 0; i < plan->count; i++) {
+        plan->rules[i].key.uid = (uint32_t)uid;
+        // Keep the usage of a label the agent already had
+        const struct label_rule *old = label_in(plan->old, plan->old_count, &plan->rules[i].key);
+        if (old) {
+            plan->rules[i].perm.hits = old->perm.hits;
+            plan->rules[i].perm.last_use = old->perm.last_use;
+        }
+        if (bpf_map_update_elem(map_fd, &plan->rules[i].key, &plan->rules[i].perm,
+                                BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem (label_rules) failed: uid=%u errno=%s\n",
+                    uid, strerror(errno));
+            unstage_label_rules(map_fd, plan);
+            return -1;
+        }
+        char verbs[8];
+        printf("[addagent] label %.*s: allow=%s\n", AID_LABEL_LEN,
+               plan->rules[i].key.label, aid_perm_str(plan->rules[i].perm.allow, verbs));
+    }
+    return 0;
+}
+
+// Drop the agent's labels the new manifest no longer grants
+static void prune_label_rules(int map_fd, const struct label_plan *plan)
+{
+    for (size_t i = 0; i < plan->old_count; i++) {
+        if (!label_in(plan->rules, plan->count, &plan->old[i].key))
+            bpf_map_delete_elem(map_fd, &plan->old[i].key);
+    }
+}
+
+// nftw() takes no context pointer
+static const char *stamp_value;
+static size_t stamp_count;
+
+static int stamp_path(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)ftw;
+    if (type != FTW_F && type != FTW_D)
+        return 0;
+    if (!S_ISREG(st->st_mode) && !S_ISDIR(st->st_mode))
+        return 0;
+    if (setxattr(path, AID_LABEL_XATTR, stamp_value, strlen(stamp_value), 0) < 0) {
+        fprintf(stderr, "[addagent] Warning: setxattr(%s, %s): %s\n",
+                path, AID_LABEL_XATTR, strerror(errno));
+        return 0;
+    }
+    stamp_count++;
+    return 0;
+}
+
+// Stamp the rule's label on every file its pattern matches; "dir/**"
+// stamps the directory and everything below it
+static void stamp_label(const struct file_rule *r)
+{
+    char base_path[PATH_MAX];
+
+    stamp_value = r->label;
+    stamp_count = 0;
+    if (recursive_base(r->path, base_path, sizeof(base_path))) {
+        nftw(base_path, stamp_path, 64, FTW_PHYS);
+    } else {
+        glob_t g;
+        memset(&g, 0, sizeof(g));
+        if (glob(r->path, 0, NULL, &g) == 0) {
+            for (size_t i = 0; i < g.gl_pathc; i++) {
+                struct stat st;
+                if (stat(g.gl_pathv[i], &st) == 0)
+                    stamp_path(g.gl_pathv[i], &st, S_ISDIR(st.st_mode) ? FTW_D : FTW_F, NULL);
+            }
+        }
+        globfree(&g);
+    }
+    printf("[addagent] Labelled %zu files '%s' for '%s'\n", stamp_count, r->label, r->path);
+}
+
+static void format_age(uint32_t secs, char *buf, size_t len)
+{
+    if (secs < 3600)
+        snprintf(buf, len, "%um ago", secs / 60);
+    else if (secs < 86400)
+        snprintf(buf, len, "%uh ago", secs / 3600);
+    else
+        snprintf(buf, len, "%ud ago", secs / 86400);
+}
+
+// Report which of the manifest's rules the agent exercised in the last
+// `days` days, from the hit counters and last-use times the hook keeps in
+// its policy entries (store_fd >= 0: in the files' inode storage). Changes
+// nothing.
+static int report_coverage(int map_fd, int store_fd, int profile_fd, int label_fd,
+                           const struct manifest_data *m,
+                           struct policy_plan *plan, unsigned int days)
+{
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, m->agentname);
+    struct passwd *pw = getpwnam(username);
+    struct agent_profile prof = {};
+    int inner_fd = -1;
+    if (pw && store_fd < 0)
+        inner_fd = open_agent_policy_map(map_fd, pw->pw_uid);
+    if (pw && store_fd >= 0) {
+        uint32_t idx = pw->pw_uid - AID_UID_BASE;
+        if (bpf_map_lookup_elem(profile_fd, &idx, &prof) == 0 && prof.epoch > prof.base_epoch)
+            inner_fd = 0;   // no inner map, but a live registration
+    }
+    if (inner_fd < 0) {
+        fprintf(stderr, "[addagent] agent '%s' has no registered policy\n", m->agentname);
+        return 1;
+    }
+
+    // Hits the agent's specialized program took off the inner map
+    static struct aid_spec spec;
+    static struct aid_spec_usage usage[AID_SPEC_MAX];
+    int have_spec = store_fd < 0 && read_spec_usage(pw->pw_uid, &spec, usage) == 0;
+
+    uint32_t now = boot_seconds();
+    uint32_t idle = days * 86400;
+    if (now < idle)
+        printf("[addagent] Warning: up for %u days only, entries cannot be idle for %u\n",
+               now / 86400, days);
+    printf("[addagent] coverage of '%s' (uid=%u), idle = unused for %u days\n",
+           m->agentname, pw->pw_uid, days);
+    printf("%-5s %-10s %-10s %-8s %s\n", "RULE", "HITS", "LAST USE", "IDLE", "PATH");
+
+    int unused_rules = 0;
+    for (int r = 0; r < m->file_count; r++) {
+        uint64_t hits = 0;
+        uint32_t last = 0;
+        int entries = 0, idle_entries = 0;
+
+        // A labelled rule is one label_rules entry
+        struct label_key lkey;
+        struct file_perm lperm;
+        if (m->files[r].label[0] &&
+            aid_label_key_parse(m->files[r].label, pw->pw_uid, &lkey) == 0 &&
+            bpf_map_lookup_elem(label_fd, &lkey, &lperm) == 0) {
+            entries = 1;
+            hits = lperm.hits;
+            last = lperm.last_use;
+            idle_entries = now - lperm.last_use >= idle;
+        }
+
+        for (size_t i = 0; i < plan->count; i++) {
+            struct file_perm perm;
+            if (plan->entries[i].rule != r)
+                continue;
+            entries++;
+            if (live_perm(inner_fd, store_fd, pw->pw_uid, &prof, &plan->entries[i], &perm) < 0) {
+                // Resolved now, but not in the live policy: manifest changed
+                printf("      %-10s %-10s %-8s %s (not registered)\n", "-", "-", "-",
+                       plan->entries[i].path ? plan->entries[i].path : "?");
+                continue;
+            }
+            if (have_spec)
+                add_spec_usage(&spec, usage, &plan->entries[i].key, &perm);
+            hits += perm.hits;
+            if (perm.last_use > last)
+                last = perm.last_use;
+            if (now - perm.last_use >= idle) {
+                char entry_age[32] = "never";
+                if (perm.hits)
+                    format_age(now - perm.last_use, entry_age, sizeof(entry_age));
+                idle_entries++;
+                printf("      %-10u %-10s %-8s %s\n", perm.hits, entry_age, "idle",
+                       plan->entries[i].path ? plan->entries[i].path : "?");
+            }
+        }
+
+        char age[32] = "never";
+        if (hits)
+            format_age(now - last, age, sizeof(age));
+        int unused = entries > 0 && idle_entries == entries;
+        unused_rules += unused;
+        printf("%-5d %-10llu %-10s %d/%-6d %s%s\n", r, (unsigned long long)hits, age,
+               idle_entries, entries, m->files[r].path, unused ? "  <- unused" : "");
+    }
+
+    if (store_fd >= 0) {
+        // Inode storage cannot be listed: inherited slots are not counted
+        printf("[addagent] %d of %d rules unused\n", unused_rules, m->file_count);
+        return 0;
+    }
+
+    // Entries the hook copied onto files the agent created
+    struct inode_key key, next_key, *prev = NULL;
+    struct file_perm perm;
+    int inherited = 0, idle_inherited = 0;
+    while (bpf_map_get_next_key(inner_fd, prev, &next_key) == 0) {
+        key = next_key;
+        prev = &key;
+        if (bpf_map_lookup_elem(inner_fd, &key, &perm) < 0 ||
+            !(perm.flags & AID_POLICY_INHERITED))
+            continue;
+        inherited++;
+        idle_inherited += now - perm.last_use >= idle;
+    }
+    close(inner_fd);
+
+    printf("[addagent] %d of %d rules unused; %d of %d inherited entries idle\n",
+           unused_rules, m->file_count, idle_inherited, inherited);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s <manifest.yaml>         register or update an agent\n", prog);
+    fprintf(stderr, "       %s -C <days> <manifest.yaml>\n", prog);
+    fprintf(stderr, "              report the manifest's rules the agent has not used\n");
+    fprintf(stderr, "              for <days> days (read-only)\n");
+    exit(1);
+}
+
+int main(int argc, char **argv)
+{
+    const char *prog = argv[0];
+    long coverage_days = -1;
+    if (argc == 4 && strcmp(argv[1], "-C") == 0) {
+        char *end;
+        coverage_days = strtol(argv[2], &end, 10);
+        if (*argv[2] == '\0' || *end != '\0' || coverage_days < 0 || coverage_days > 36500)
+            usage(prog);
+        argv += 2;
+        argc -= 2;
+    }
+    if (argc != 2)
+        usage(prog);
+
+    if (geteuid() != 0) {
+        fprintf(stderr, "addagent must be run as root.\n");
+        return 1;
+    }
+
+    const char *manifest_path = argv[1];
+    struct manifest_data m;
+    if (parse_manifest(manifest_path, &m) < 0) {
+        return 1;
+    }
+
+    printf("[addagent] manifest agentname='%s', file rules=%d, network destinations=%d%s\n",
+           m.agentname, m.file_count, m.net_count,
+           (m.profile.flags & AID_PROFILE_NET_ANY) ? " (any)" : "");
+
+    int map_fd = open_inode_policy_map();
+    if (map_fd < 0)
+        return 1;
+
+    // One array slot per uid: the profile never runs out of room
+    int profile_fd = open_agent_profile_map();
+    if (profile_fd < 0)
+        return 1;
+
+    struct aid_config cfg;
+    if (read_config(&cfg) < 0)
+        return 1;
+    int store_fd = -1;
+    if (cfg.policy_store == AID_STORE_INODE && (store_fd = open_inode_store()) < 0)
+        return 1;
+    int label_fd = open_label_map();
+    if (label_fd < 0)
+        return 1;
+
+    // Resolve every rule before touching the map
+    struct policy_plan plan = {0};
+    static struct label_plan labels;
+    for (int i = 0; i < m.file_count; i++) {
+        struct file_rule *r = &m.files[i];
+        if (r->path[0] == 0) {
+            fprintf(stderr, "[addagent] rule %d: path is empty. Ignoring.\n", i);
+            continue;
+        }
+        char verbs[8];
+        uint8_t allow = rule_allow(r, rule_names_directory(r));
+        printf("[addagent] rule %d: path='%s' allow=%s%s%s\n",
+               i, r->path, aid_perm_str(allow, verbs), r->label[0] ? " label=" : "", r->label);
+        if (r->label[0]) {
+            add_label_rule(&labels, r, allow);
+            continue;
+        }
+        plan.rule = i;
+        register_file_policy_for_path(&plan, r->path, allow);
+    }
+    if (labels.count && !cfg.xattr_labels)
+        fprintf(stderr, "[addagent] Warning: labels are ignored until the loader runs with "
+                "xattr_labels = true\n");
+
+    if (coverage_days >= 0) {
+        int ret = report_coverage(map_fd, store_fd, profile_fd, label_fd, &m, &plan,
+                                  (unsigned int)coverage_days);
+        free_policy_plan(&plan);
+        close(map_fd);
+        return ret;
+    }
+
+    // An existing agent may already own some of the entries
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, m.agentname);
+    struct passwd *pw = getpwnam(username);
+    uid_t existing_uid = pw ? pw->pw_uid : (uid_t)-1;
+
+    if (store_fd < 0 && check_plan_capacity(map_fd, &plan, existing_uid) < 0)
+        return 1;
+
+    int net_fd = open_net_rules_map();
+    int suffix_fd = open_suffix_map();
+    if (net_fd < 0 || suffix_fd < 0)
+        return 1;
+
+    uid_t uid = ensure_agent_user(m.agentname);
+    if ((int)uid < 0)
+        return 1;
+
+    // Host names are resolved before any map changes too
+    static struct net_plan net;
+    if (build_net_plan(&m, uid, &net) < 0) {
+        fprintf(stderr, "[addagent] Error: policy was not registered\n");
+        return 1;
+    }
+
+    // Labels go on the files first: without a label_rules entry they grant
+    // nothing
+    for (int i = 0; i < m.file_count; i++) {
+        if (m.files[i].label[0] && m.files[i].path[0])
+            stamp_label(&m.files[i]);
+    }
+
+    // The profile carries the inode_store epochs from one registration to
+    // the next; with inode storage, this one gets a new epoch
+    struct agent_profile old_prof = {};
+    uint32_t prof_idx = (uint32_t)uid - AID_UID_BASE;
+    bpf_map_lookup_elem(profile_fd, &prof_idx, &old_prof);
+    m.profile.epoch = old_prof.epoch + (store_fd >= 0);
+    m.profile.base_epoch = old_prof.base_epoch;
+
+    int old_fd = -1, spec_n = -1;
+    static struct aid_spec spec;
+    if (store_fd >= 0) {
+        // Invisible to the hook until the profile moves to the new epoch
+        if (write_inode_slots(store_fd, profile_fd, &plan, uid, &m.profile) < 0) {
+            fprintf(stderr, "[addagent] Error: policy was not registered\n");
+            return 1;
+        }
+        free_policy_plan(&plan);
+        close(store_fd);
+        // Specialized programs only know the map store
+        remove_spec_program(uid);
+    } else {
+        // The new file policy is built off to the side; a failure here leaves
+        // the active one untouched
+        int inner_fd = build_agent_policy_map(map_fd, &plan, uid);
+        if (inner_fd < 0 || add_plan_to_bloom(&plan) < 0) {
+            fprintf(stderr, "[addagent] Error: policy was not registered\n");
+            return 1;
+        }
+        // The old specialized program stops deciding before the new
+        // policy is published; its counts move into the new inner map
+        carry_spec_usage(inner_fd, uid);
+        remove_spec_program(uid);
+        spec_n = build_spec(&plan, uid, &m.profile, cfg.fs_gen, &spec);
+        free_policy_plan(&plan);
+
+        if (publish_agent_policy_map(map_fd, uid, inner_fd, &old_fd) < 0) {
+            fprintf(stderr, "[addagent] Error: policy was not registered\n");
+            return 1;
+        }
+        // The outer map holds its own reference to the inner map
+        close(inner_fd);
+    }
+
+    // Stage the network rules and suffix classes and register the profile;
+    // if any of it fails, switch everything back so the agent never runs
+    // with half of the new manifest
+    static struct suffix_plan suffixes;
+    int ret = stage_net_rules(net_fd, uid, &net);
+    if (ret == 0) {
+        ret = stage_suffix_classes(suffix_fd, uid, &m, &suffixes);
+        if (ret == 0) {
+            ret = stage_label_rules(label_fd, uid, &labels);
+            if (ret == 0) {
+                ret = register_agent_profile(profile_fd, uid, &m.profile);
+                if (ret < 0)
+                    unstage_label_rules(label_fd, &labels);
+            }
+            if (ret < 0)
+                unstage_suffix_classes(suffix_fd, &suffixes);
+        }
+        if (ret < 0)
+            unstage_net_rules(net_fd, &net);
+    }
+    close(profile_fd);
+    if (ret < 0) {
+        if (store_fd < 0)
+            restore_agent_policy_map(map_fd, uid, old_fd);
+        fprintf(stderr, "[addagent] Error: policy was not registered\n");
+        return 1;
+    }
+    prune_net_rules(net_fd, &net);
+    prune_suffix_classes(suffix_fd, &suffixes);
+    prune_label_rules(label_fd, &labels);
+    close(label_fd);
+    close(net_fd);
+    close(suffix_fd);
+    if (old_fd >= 0)
+        close(old_fd);
+    close(map_fd);
+
+    if (store_fd < 0)
+        specialize_agent(&spec, spec_n, uid);
+    if (bump_policy_generation() < 0)
+        fprintf(stderr, "[addagent] Warning: open files may keep their old verdicts\n");
 
     printf("[addagent] Done.\n");
     return 0;
@@ -0,0 +1,501 @@
+// src/aid_auditd.c
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../include/aid_shared.h"
+#include "aid_util.h"
+
+// aid_auditd drains the "aid_events" ring buffer into a rotated binary log
+// of fixed-size struct aid_event records, and queries those logs (-q).
+//
+// Log file layout: struct log_header, then records back to back.
+
+#define DEFAULT_LOG_DIR   "/var/log/aid"
+#define LOG_NAME          "audit.log"
+#define DEFAULT_MAX_MB    64
+#define DEFAULT_KEEP      8
+#define WRITE_BUF_SIZE    (256 * 1024)
+#define FLUSH_INTERVAL_S  1
+
+#define LOG_MAGIC   "AIDLOG1"
+#define LOG_VERSION 1
+
+struct log_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+};
+
+struct auditd {
+    const char *dir;
+    uint64_t max_size;
+    int keep;
+    int log_fd;
+    uint64_t log_size;
+    int64_t boot_to_real;   // CLOCK_REALTIME - CLOCK_BOOTTIME, ns
+    size_t buf_len;
+    uint64_t events;
+    char buf[WRITE_BUF_SIZE];
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-d dir] [-s max_mb] [-k keep]\n", prog);
+    fprintf(stderr, "       %s -q [-d dir] [-u uid] [-i ino] [-S since] [-U until] [-c] [file...]\n", prog);
+    fprintf(stderr, "\nDaemon mode: drain %s into <dir>/%s (rotated at max_mb, keep N old files;\n"
+            "             0 truncates instead)\n",
+            AID_EVENTS_MAP_PATH, LOG_NAME);
+    fprintf(stderr, "Query mode:  scan logs (oldest first) and print matching records\n");
+    fprintf(stderr, "  -u  agent uid         -i  inode number\n");
+    fprintf(stderr, "  -S/-U  time range, epoch seconds or YYYY-MM-DDTHH:MM:SS (local)\n");
+    fprintf(stderr, "  -c  only count matches\n");
+    fprintf(stderr, "\nDefaults: dir=%s max_mb=%d keep=%d\n", DEFAULT_LOG_DIR, DEFAULT_MAX_MB, DEFAULT_KEEP);
+    exit(1);
+}
+
+static int64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void log_path(const struct auditd *d, int idx, char *out, size_t len)
+{
+    if (idx == 0)
+        snprintf(out, len, "%s/%s", d->dir, LOG_NAME);
+    else
+        snprintf(out, len, "%s/%s.%d", d->dir, LOG_NAME, idx);
+}
+
+// A log this build can read and append to
+static int log_header_ok(const struct log_header *h)
+{
+    return memcmp(h->magic, LOG_MAGIC, sizeof(LOG_MAGIC)) == 0 &&
+           h->version == LOG_VERSION &&
+           h->record_size == sizeof(struct aid_event);
+}
+
+// --- Daemon mode ---
+
+static int rotate_log(struct auditd *d);
+
+// Open audit.log for appending; trunc empties it first. An existing log with
+// another layout, or cut mid-record, is rotated away rather than appended to.
+static int open_log(struct auditd *d, int trunc)
+{
+    char path[PATH_MAX];
+    log_path(d, 0, path, sizeof(path));
+
+    d->log_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC | (trunc ? O_TRUNC : 0), 0600);
+    if (d->log_fd < 0) {
+        fprintf(stderr, "[aid_auditd] open(%s) failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(d->log_fd, &st) < 0)
+        return -1;
+    d->log_size = st.st_size;
+
+    if (d->log_size > 0) {
+        struct log_header h;
+        if (d->log_size < sizeof(h) ||
+            pread(d->log_fd, &h, sizeof(h), 0) != sizeof(h) || !log_header_ok(&h) ||
+            (d->log_size - sizeof(h)) % sizeof(struct aid_event) != 0) {
+            fprintf(stderr, "[aid_auditd] %s: header or size does not match this version, rotating\n",
+                    path);
+            return rotate_log(d);
+        }
+    }
+
+    if (d->log_size == 0) {
+        struct log_header h = { .version = LOG_VERSION, .record_size = sizeof(struct aid_event) };
+        memcpy(h.magic, LOG_MAGIC, sizeof(LOG_MAGIC));
+        if (write(d->log_fd, &h, sizeof(h)) != sizeof(h)) {
+            fprintf(stderr, "[aid_auditd] write header failed: %s\n", strerror(errno));
+            return -1;
+        }
+        d->log_size = sizeof(h);
+    }
+    return 0;
+}
+
+// audit.log -> audit.log.1 -> ... -> audit.log.<keep>, oldest dropped.
+// With keep 0 (or when audit.log cannot be renamed) it is truncated instead.
+static int rotate_log(struct auditd *d)
+{
+    char from[PATH_MAX], to[PATH_MAX];
+    int trunc = d->keep == 0;
+
+    close(d->log_fd);
+    d->log_fd = -1;
+
+    for (int i = d->keep - 1; i >= 0; i--) {
+        log_path(d, i, from, sizeof(from));
+        log_path(d, i + 1, to, sizeof(to));
+        if (rename(from, to) < 0 && errno != ENOENT) {
+            fprintf(stderr, "[aid_auditd] rename(%s) failed: %s\n", from, strerror(errno));
+            if (i == 0)
+                trunc = 1;
+        }
+    }
+    return open_log(d, trunc);
+}
+
+static int flush_log(struct auditd *d)
+{
+    size_t off = 0;
+
+    while (off < d->buf_len) {
+        ssize_t n = write(d->log_fd, d->buf + off, d->buf_len - off);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[aid_auditd] write failed: %s\n", strerror(errno));
+            d->buf_len = 0;
+            return -1;
+        }
+        off += n;
+    }
+    d->log_size += d->buf_len;
+    d->buf_len = 0;
+
+    if (d->max_size && d->log_size >= d->max_size)
+        return rotate_log(d);
+    return 0;
+}
+
+static int handle_event(void *ctx, void *data, size_t size)
+{
+    struct auditd *d = ctx;
+    struct aid_event *e;
+
+    if (size < sizeof(*e))
+        return 0;
+
+    if (d->buf_len + sizeof(*e) > sizeof(d->buf))
+        flush_log(d);
+
+    e = (struct aid_event *)(d->buf + d->buf_len);
+    memcpy(e, data, sizeof(*e));
+    e->ts_ns += d->boot_to_real;
+    d->buf_len += sizeof(*e);
+    d->events++;
+    return 0;
+}
+
+static int run_daemon(struct auditd *d)
+{
+    if (mkdir(d->dir, 0700) < 0 && errno != EEXIST) {
+        fprintf(stderr, "[aid_auditd] mkdir(%s) failed: %s\n", d->dir, strerror(errno));
+        return 1;
+    }
+    if (open_log(d, 0) < 0)
+        return 1;
+
+    int map_fd = bpf_obj_get(AID_EVENTS_MAP_PATH);
+    if (map_fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_EVENTS_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    struct ring_buffer *rb = ring_buffer__new(map_fd, handle_event, d, NULL);
+    if (!rb) {
+        fprintf(stderr, "[aid_auditd] ring_buffer__new failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    int sig_fd = signalfd(-1, &mask, SFD_CLOEXEC);
+
+    int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+    struct itimerspec its = {
+        .it_interval = { .tv_sec = FLUSH_INTERVAL_S },
+        .it_value = { .tv_sec = FLUSH_INTERVAL_S },
+    };
+    timerfd_settime(timer_fd, 0, &its, NULL);
+
+    // One epoll set: ring buffer readiness, periodic flush, shutdown signals
+    int ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    int rb_fd = ring_buffer__epoll_fd(rb);
+    struct epoll_event ev = { .events = EPOLLIN };
+    ev.data.fd = rb_fd;
+    epoll_ctl(ep_fd, EPOLL_CTL_ADD, rb_fd, &ev);
+    ev.data.fd = timer_fd;
+    epoll_ctl(ep_fd, EPOLL_CTL_ADD, timer_fd, &ev);
+    ev.data.fd = sig_fd;
+    epoll_ctl(ep_fd, EPOLL_CTL_ADD, sig_fd, &ev);
+
+    d->boot_to_real = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_BOOTTIME);
+    printf("[aid_auditd] Writing %s/%s (rotate at %llu bytes, keep %d)\n",
+           d->dir, LOG_NAME, (unsigned long long)d->max_size, d->keep);
+    fflush(stdout);
+
+    int running = 1;
+    while (running) {
+        struct epoll_event events[4];
+        int n = epoll_wait(ep_fd, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[aid_auditd] epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == rb_fd) {
+                // Drain everything available in one pass; records are batched
+                // in d->buf and written out when it fills or on the timer.
+                ring_buffer__consume(rb);
+            } else if (fd == timer_fd) {
+                uint64_t expirations;
+                if (read(timer_fd, &expirations, sizeof(expirations)) < 0)
+                    continue;
+                flush_log(d);
+                // Re-sync in case the wall clock was stepped
+                d->boot_to_real = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_BOOTTIME);
+            } else if (fd == sig_fd) {
+                running = 0;
+            }
+        }
+    }
+
+    ring_buffer__consume(rb);
+    flush_log(d);
+    printf("[aid_auditd] Stopped, %llu events written.\n", (unsigned long long)d->events);
+
+    ring_buffer__free(rb);
+    close(ep_fd);
+    close(timer_fd);
+    close(sig_fd);
+    close(map_fd);
+    close(d->log_fd);
+    return 0;
+}
+
+// --- Query mode ---
+
+struct query {
+    int64_t uid;     // -1: any
+    int64_t ino;     // -1: any
+    uint64_t since;  // ns, inclusive
+    uint64_t until;  // ns, exclusive
+    int count_only;
+    uint64_t scanned;
+    uint64_t matched;
+};
+
+static int parse_time(const char *s, uint64_t *out_ns)
+{
+    char *end;
+    unsigned long long v = strtoull(s, &end, 10);
+    if (*s && *end == '\0') {
+        *out_ns = v * 1000000000ULL;
+        return 0;
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    end = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm);
+    if (!end || *end)
+        end = strptime(s, "%Y-%m-%d", &tm);
+    if (!end || *end) {
+        fprintf(stderr, "[aid_auditd] Bad time '%s'\n", s);
+        return -1;
+    }
+    tm.tm_isdst = -1;
+    *out_ns = (uint64_t)mktime(&tm) * 1000000000ULL;
+    return 0;
+}
+
+static void print_event(const struct aid_event *e)
+{
+    static time_t last_sec = -1;
+    static char tbuf[32];
+    time_t sec = e->ts_ns / 1000000000ULL;
+
+    // Formatting the date dominates output cost, do it once per second
+    if (sec != last_sec) {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(tbuf, sizeof(tbuf), "%Y-%m-%dT%H:%M:%S", &tm);
+        last_sec = sec;
+    }
+
+    static const char *verdicts[] = { "allow", "deny", "permissive" };
+    if (e->reason == AID_REASON_SOCKET_DENIED) {
+        struct net_rule_key key = {
+            .prefixlen = AID_NET_PREFIX_BASE + 128,
+            .port = (uint16_t)e->mask,
+        };
+        char dst[64];
+        memcpy(key.addr, e->name, sizeof(key.addr));
+        printf("%s.%06llu uid=%u pid=%u dst=%s %s %s\n",
+               tbuf, (unsigned long long)(e->ts_ns % 1000000000ULL) / 1000,
+               e->uid, e->pid, aid_net_rule_str(&key, dst, sizeof(dst)),
+               aid_reason_name(e->reason),
+               e->verdict < 3 ? verdicts[e->verdict] : "?");
+        return;
+    }
+    printf("%s.%06llu uid=%u pid=%u dev=%u:%u ino=%llu mask=0x%x %s %s name=%.*s\n",
+           tbuf, (unsigned long long)(e->ts_ns % 1000000000ULL) / 1000,
+           e->uid, e->pid, e->dev >> 20, e->dev & 0xfffff,
+           (unsigned long long)e->ino, e->mask,
+           aid_reason_name(e->reason),
+           e->verdict < 3 ? verdicts[e->verdict] : "?",
+           AID_EVENT_NAME_LEN, e->name);
+}
+
+static int query_file(struct query *q, const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno != ENOENT)
+            fprintf(stderr, "[aid_auditd] open(%s) failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct log_header)) {
+        close(fd);
+        return -1;
+    }
+
+    const char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        fprintf(stderr, "[aid_auditd] mmap(%s) failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    madvise((void *)base, st.st_size, MADV_SEQUENTIAL);
+
+    const struct log_header *h = (const struct log_header *)base;
+    if (!log_header_ok(h)) {
+        fprintf(stderr, "[aid_auditd] %s: not an AID audit log (or wrong version)\n", path);
+        munmap((void *)base, st.st_size);
+        return -1;
+    }
+
+    const struct aid_event *e = (const struct aid_event *)(base + sizeof(*h));
+    size_t count = (st.st_size - sizeof(*h)) / sizeof(*e);
+
+    for (size_t i = 0; i < count; i++, e++) {
+        if (q->uid >= 0 && e->uid != (uint32_t)q->uid)
+            continue;
+        if (q->ino >= 0 && e->ino != (uint64_t)q->ino)
+            continue;
+        if (e->ts_ns < q->since || e->ts_ns >= q->until)
+            continue;
+        q->matched++;
+        if (!q->count_only)
+            print_event(e);
+    }
+    q->scanned += count;
+
+    munmap((void *)base, st.st_size);
+    return 0;
+}
+
+static int run_query(struct auditd *d, struct query *q, int nfiles, char **files)
+{
+    static char outbuf[1 << 20];
+    setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+    int64_t start = clock_ns(CLOCK_MONOTONIC);
+
+    if (nfiles > 0) {
+        for (int i = 0; i < nfiles; i++)
+            query_file(q, files[i]);
+    } else {
+        // Oldest rotation first so output is in time order
+        char path[PATH_MAX];
+        for (int i = d->keep; i >= 0; i--) {
+            log_path(d, i, path, sizeof(path));
+            query_file(q, path);
+        }
+    }
+
+    if (q->count_only)
+        printf("%llu\n", (unsigned long long)q->matched);
+    fflush(stdout);
+
+    double secs = (clock_ns(CLOCK_MONOTONIC) - start) / 1e9;
+    fprintf(stderr, "[aid_auditd] scanned %llu records, matched %llu in %.3f s (%.1f M records/s)\n",
+            (unsigned long long)q->scanned, (unsigned long long)q->matched, secs,
+            secs > 0 ? q->scanned / secs / 1e6 : 0.0);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    static struct auditd d = {
+        .dir = DEFAULT_LOG_DIR,
+        .max_size = (uint64_t)DEFAULT_MAX_MB << 20,
+        .keep = DEFAULT_KEEP,
+        .log_fd = -1,
+    };
+    struct query q = {
+        .uid = -1,
+        .ino = -1,
+        .since = 0,
+        .until = UINT64_MAX,
+    };
+    int query_mode = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "qd:s:k:u:i:S:U:c")) != -1) {
+        switch (opt) {
+        case 'q': query_mode = 1; break;
+        case 'd': d.dir = optarg; break;
+        case 's': d.max_size = (uint64_t)atoll(optarg) << 20; break;
+        case 'k': d.keep = atoi(optarg); break;
+        case 'u': q.uid = atoll(optarg); break;
+        case 'i': q.ino = atoll(optarg); break;
+        case 'S':
+            if (parse_time(optarg, &q.since) < 0)
+                return 1;
+            break;
+        case 'U':
+            if (parse_time(optarg, &q.until) < 0)
+                return 1;
+            break;
+        case 'c': q.count_only = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (d.keep < 0)
+        usage(argv[0]);
+
+    if (query_mode)
+        return run_query(&d, &q, argc - optind, argv + optind);
+
+    if (optind != argc)
+        usage(argv[0]);
+    if (geteuid() != 0) {
+        fprintf(stderr, "aid_auditd must be run as root.\n");
+        return 1;
+    }
+    return run_daemon(&d);
+}
@@ -0,0 +1,647 @@
+// src/aid_bench.c
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <linux/limits.h>
+#include <pwd.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+
+#include "../include/aid_shared.h"
+#include "aid_util.h"
+
+// Syscall latency micro-benchmark for the AID hook.
+// Run it under an agent uid (e.g. `hire <agent> aid_bench <file>`) so every
+// read/write goes through aid_enforce_file_permission. With -u, run it as
+// root instead: it enables BPF run-time stats, drops to the agent in a child
+// and reports per-program verifier size and ns/run alongside the syscall
+// latency. With -K it compares policy key layouts instead, and with -A a flat
+// uid-keyed policy map against the per-agent hash of maps (no file needed).
+// With -T the file is an access trace (one path per line) replayed as the
+// agent, with open+read latency split by whether the path has a policy.
+
+#define DEFAULT_ITERS 200000
+#define DEFAULT_SIZE  64
+
+#define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
+#define AGENT_USER_PREFIX "agent_"
+#define PROG_PREFIX "aid_"
+#define MAX_PROGS 32
+#define KEY_BENCH_ENTRIES 16384
+#define AGENT_BENCH_ENTRIES 100   // default policy entries per agent for -A
+#define MAX_TRACE 65536
+
+// Policy key layout before the packed inode_uid_key: 20 bytes + 4 of padding
+struct legacy_key {
+    uint64_t dev;
+    uint64_t ino;
+    uint32_t uid;
+};
+
+// Single flat map key before the per-agent inner maps: inode_key + uid
+struct flat_key {
+    uint64_t ino;
+    uint32_t dev;
+    uint32_t uid;
+};
+
+// Access trace for -T, classified against the agent's policy before replay
+struct trace {
+    char *paths[MAX_TRACE];
+    uint8_t hit[MAX_TRACE];   // direct or subtree entry exists for the agent
+    int count;
+};
+
+struct prog_sample {
+    char name[BPF_OBJ_NAME_LEN];
+    uint32_t verified_insns;
+    uint32_t jited_len;
+    uint64_t run_cnt;
+    uint64_t run_time_ns;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-n iterations] [-s bytes] [-w | -S] [-u agentname] <file>\n", prog);
+    fprintf(stderr, "       %s -u agentname -T [-n opens] <trace>\n", prog);
+    fprintf(stderr, "       %s -K [-n iterations]\n", prog);
+    fprintf(stderr, "       %s -A [-n iterations] [-e entries]\n", prog);
+    fprintf(stderr, "  -n  number of syscalls (default %d)\n", DEFAULT_ITERS);
+    fprintf(stderr, "  -s  bytes per syscall (default %d)\n", DEFAULT_SIZE);
+    fprintf(stderr, "  -w  measure pwrite(2) instead of pread(2)\n");
+    fprintf(stderr, "  -S  sequential read(2) through the file, rewinding at EOF\n");
+    fprintf(stderr, "  -u  run as agent_<agentname> and report AID program stats (root)\n");
+    fprintf(stderr, "  -K  compare legacy vs packed policy key: lookup ns and map memory (root)\n");
+    fprintf(stderr, "  -A  flat map vs hash of maps at 10/100/1000 agents: lookup, purge (root)\n");
+    fprintf(stderr, "  -e  policy entries per agent for -A (default %d)\n", AGENT_BENCH_ENTRIES);
+    fprintf(stderr, "  -T  replay a trace of paths as the agent: policy hits vs misses (root)\n");
+    exit(1);
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Snapshot every loaded program whose name starts with "aid_"
+static int sample_progs(struct prog_sample *out, int max)
+{
+    uint32_t id = 0;
+    int n = 0;
+
+    while (n < max && bpf_prog_get_next_id(id, &id) == 0) {
+        int fd = bpf_prog_get_fd_by_id(id);
+        if (fd < 0)
+            continue;
+
+        struct bpf_prog_info info = {};
+        uint32_t info_len = sizeof(info);
+        if (bpf_obj_get_info_by_fd(fd, &info, &info_len) == 0 &&
+            strncmp(info.name, PROG_PREFIX, strlen(PROG_PREFIX)) == 0) {
+            struct prog_sample *p = &out[n++];
+            memcpy(p->name, info.name, sizeof(p->name));
+            p->verified_insns = info.verified_insns;
+            p->jited_len = info.jited_prog_len;
+            p->run_cnt = info.run_cnt;
+            p->run_time_ns = info.run_time_ns;
+        }
+        close(fd);
+    }
+    return n;
+}
+
+static void print_prog_stats(const struct prog_sample *before, int nbefore,
+                             const struct prog_sample *after, int nafter)
+{
+    printf("  %-28s %9s %9s %10s %9s\n", "program", "verified", "jited", "runs", "ns/run");
+    for (int i = 0; i < nafter; i++) {
+        uint64_t cnt = after[i].run_cnt, time_ns = after[i].run_time_ns;
+        for (int j = 0; j < nbefore; j++) {
+            if (strcmp(before[j].name, after[i].name) == 0) {
+                cnt -= before[j].run_cnt;
+                time_ns -= before[j].run_time_ns;
+                break;
+            }
+        }
+        printf("  %-28s %9u %9u %10llu %9.1f\n", after[i].name,
+               after[i].verified_insns, after[i].jited_len, (unsigned long long)cnt,
+               cnt ? (double)time_ns / cnt : 0.0);
+    }
+}
+
+// Kernel memory charged to a map, from /proc/self/fdinfo
+static long map_memlock(int fd)
+{
+    char path[64], line[128];
+    long memlock = -1;
+
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "memlock: %ld", &memlock) == 1)
+            break;
+    }
+    fclose(f);
+    return memlock;
+}
+
+// Fill a scratch hash map shaped like inode_policies and time lookups of
+// existing keys. make_key writes key number i into buf.
+static int bench_key_layout(const char *label, uint32_t key_size, long iters,
+                            void (*make_key)(void *buf, uint32_t i))
+{
+    int fd = bpf_map_create(BPF_MAP_TYPE_HASH, "aid_key_bench", key_size,
+                            sizeof(struct file_perm), KEY_BENCH_ENTRIES, NULL);
+    if (fd < 0) {
+        fprintf(stderr, "[aid_bench] bpf_map_create failed: %s (run as root)\n", strerror(errno));
+        return -1;
+    }
+
+    char key[32] = {0};
+    struct file_perm perm = { .allow = AID_PERM_READ };
+    for (uint32_t i = 0; i < KEY_BENCH_ENTRIES; i++) {
+        make_key(key, i);
+        bpf_map_update_elem(fd, key, &perm, BPF_ANY);
+    }
+
+    long misses = 0;
+    uint64_t start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        make_key(key, (uint32_t)(i * 7919) % KEY_BENCH_ENTRIES);
+        if (bpf_map_lookup_elem(fd, key, &perm) < 0)
+            misses++;
+    }
+    uint64_t total = now_ns() - start;
+
+    printf("  %-8s key %2u bytes  %7.1f ns/lookup  memlock %ld KiB%s\n",
+           label, key_size, (double)total / iters, map_memlock(fd) / 1024,
+           misses ? "  (misses!)" : "");
+    close(fd);
+    return 0;
+}
+
+static void make_legacy_key(void *buf, uint32_t i)
+{
+    struct legacy_key *k = buf;
+    k->dev = (8 << 8) | 1;
+    k->ino = 1000000 + i;
+    k->uid = AID_UID_BASE;
+}
+
+static void make_packed_key(void *buf, uint32_t i)
+{
+    aid_policy_key(buf, 1000000 + i, AID_KDEV(8, 1));
+}
+
+// One flat map holding every agent's entries vs inode_policies' layout:
+// uid -> inner map. Lookup times go through bpf(2), one call for the flat
+// map and two (outer, inner) here where the hook pays only a second hash
+// probe; purge is what changes shape. Inner maps get the same headroom
+// addagent gives them.
+static int bench_agents(uint32_t agents, uint32_t per_agent, long iters)
+{
+    uint32_t total = agents * per_agent;
+    int flat_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "aid_flat_bench", sizeof(struct flat_key),
+                                 sizeof(struct file_perm), total, NULL);
+    LIBBPF_OPTS(bpf_map_create_opts, inner_opts, .map_flags = AID_INNER_MAP_FLAGS);
+    int tmpl_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "aid_tmpl_bench", sizeof(struct inode_key),
+                                 sizeof(struct file_perm), AID_INNER_MIN_FREE, &inner_opts);
+    LIBBPF_OPTS(bpf_map_create_opts, outer_opts, .inner_map_fd = tmpl_fd);
+    int outer_fd = bpf_map_create(BPF_MAP_TYPE_HASH_OF_MAPS, "aid_outer_bench", sizeof(uint32_t),
+                                  sizeof(uint32_t), agents, &outer_opts);
+    int *inner_fds = calloc(agents, sizeof(*inner_fds));
+    int ret = -1;
+
+    if (flat_fd < 0 || tmpl_fd < 0 || outer_fd < 0 || !inner_fds) {
+        fprintf(stderr, "[aid_bench] map setup failed: %s (run as root)\n", strerror(errno));
+        goto out;
+    }
+
+    struct file_perm perm = { .allow = AID_PERM_READ };
+    long inner_memlock = 0;
+    for (uint32_t a = 0; a < agents; a++) {
+        inner_fds[a] = bpf_map_create(BPF_MAP_TYPE_HASH, "aid_agent_pol", sizeof(struct inode_key),
+                                      sizeof(struct file_perm), per_agent + AID_INNER_MIN_FREE,
+                                      &inner_opts);
+        if (inner_fds[a] < 0) {
+            fprintf(stderr, "[aid_bench] inner map %u: %s\n", a, strerror(errno));
+            goto out;
+        }
+        for (uint32_t i = 0; i < per_agent; i++) {
+            struct flat_key fk = { .ino = 1000000 + i, .dev = AID_KDEV(8, 1),
+                                   .uid = AID_UID_BASE + a };
+            struct inode_key ik;
+            aid_policy_key(&ik, fk.ino, fk.dev);
+            bpf_map_update_elem(flat_fd, &fk, &perm, BPF_ANY);
+            bpf_map_update_elem(inner_fds[a], &ik, &perm, BPF_ANY);
+        }
+        uint32_t uid = AID_UID_BASE + a;
+        if (bpf_map_update_elem(outer_fd, &uid, &inner_fds[a], BPF_ANY) < 0) {
+            fprintf(stderr, "[aid_bench] outer update %u: %s\n", a, strerror(errno));
+            goto out;
+        }
+        inner_memlock += map_memlock(inner_fds[a]);
+    }
+
+    long misses = 0;
+    uint64_t start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        uint32_t n = (uint32_t)(i * 7919) % total;
+        struct flat_key fk = { .ino = 1000000 + n % per_agent, .dev = AID_KDEV(8, 1),
+                               .uid = AID_UID_BASE + n / per_agent };
+        if (bpf_map_lookup_elem(flat_fd, &fk, &perm) < 0)
+            misses++;
+    }
+    uint64_t flat_ns = now_ns() - start;
+
+    start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        uint32_t n = (uint32_t)(i * 7919) % total;
+        uint32_t uid = AID_UID_BASE + n / per_agent, inner_id;
+        struct inode_key ik;
+        aid_policy_key(&ik, 1000000 + n % per_agent, AID_KDEV(8, 1));
+        if (bpf_map_lookup_elem(outer_fd, &uid, &inner_id) < 0 ||
+            bpf_map_lookup_elem(inner_fds[n / per_agent], &ik, &perm) < 0)
+            misses++;
+    }
+    uint64_t nested_ns = now_ns() - start;
+
+    // Purge the middle agent: scan-and-delete vs one outer delete
+    uint32_t victim = AID_UID_BASE + agents / 2;
+    struct flat_key key, next_key, *prev = NULL;
+    uint32_t deleted = 0;
+    start = now_ns();
+    while (bpf_map_get_next_key(flat_fd, prev, &next_key) == 0) {
+        if (next_key.uid == victim && bpf_map_delete_elem(flat_fd, &next_key) == 0) {
+            deleted++;
+            continue;   // prev still names a live key
+        }
+        key = next_key;
+        prev = &key;
+    }
+    uint64_t flat_purge = now_ns() - start;
+
+    start = now_ns();
+    bpf_map_delete_elem(outer_fd, &victim);
+    uint64_t nested_purge = now_ns() - start;
+
+    printf("  %5u agents  flat %7.1f ns  outer+inner %7.1f ns  "
+           "purge %9.1f us (%u entries) vs %5.1f us  memlock %ld / %ld KiB%s\n",
+           agents, (double)flat_ns / iters, (double)nested_ns / iters,
+           flat_purge / 1000.0, deleted, nested_purge / 1000.0,
+           map_memlock(flat_fd) / 1024, (map_memlock(outer_fd) + inner_memlock) / 1024,
+           misses ? "  (misses!)" : "");
+    ret = 0;
+
+out:
+    if (inner_fds) {
+        for (uint32_t a = 0; a < agents; a++) {
+            if (inner_fds[a] > 0)
+                close(inner_fds[a]);
+        }
+        free(inner_fds);
+    }
+    if (outer_fd >= 0)
+        close(outer_fd);
+    if (tmpl_fd >= 0)
+        close(tmpl_fd);
+    if (flat_fd >= 0)
+        close(flat_fd);
+    return ret;
+}
+
+// Switch to the agent's uid/gid the same way hire does
+static int become_agent(const char *agentname)
+{
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, agentname);
+
+    struct passwd *pw = getpwnam(username);
+    if (!pw) {
+        fprintf(stderr, "[aid_bench] Agent user '%s' does not exist.\n", username);
+        return -1;
+    }
+    if (setgid(pw->pw_gid) != 0 || setuid(pw->pw_uid) != 0) {
+        fprintf(stderr, "[aid_bench] Failed to switch to uid=%d: %s\n",
+                pw->pw_uid, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+// Does the agent's inner map hold an entry for path, or a subtree entry for
+// one of its first AID_SUBTREE_DEPTH ancestors (what the hook would find)
+static int trace_has_policy(int inner_fd, const char *path)
+{
+    struct stat st;
+    struct inode_key key;
+    struct file_perm perm;
+
+    if (stat(path, &st) < 0)
+        return 0;
+    aid_policy_key_stat(&key, &st);
+    if (bpf_map_lookup_elem(inner_fd, &key, &perm) == 0)
+        return 1;
+
+    char dir[PATH_MAX];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (int depth = 1; depth <= AID_SUBTREE_DEPTH; depth++) {
+        char *parent = dirname(dir);
+        if (parent != dir)
+            memmove(dir, parent, strlen(parent) + 1);
+        if (stat(dir, &st) < 0)
+            return 0;
+        aid_policy_key_stat(&key, &st);
+        if (bpf_map_lookup_elem(inner_fd, &key, &perm) == 0 && (perm.flags & AID_POLICY_SUBTREE))
+            return 1;
+        if (strcmp(dir, "/") == 0)
+            break;
+    }
+    return 0;
+}
+
+// Read the trace and classify each path against the agent's pinned policy
+static int load_trace(const char *file, const char *agentname, struct trace *t)
+{
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, agentname);
+    struct passwd *pw = getpwnam(username);
+    if (!pw) {
+        fprintf(stderr, "[aid_bench] Agent user '%s' does not exist.\n", username);
+        return -1;
+    }
+
+    int inner_fd = -1;
+    int map_fd = bpf_obj_get(AID_MAP_PATH);
+    uint32_t uid = pw->pw_uid, inner_id;
+    if (map_fd >= 0 && bpf_map_lookup_elem(map_fd, &uid, &inner_id) == 0)
+        inner_fd = bpf_map_get_fd_by_id(inner_id);
+    if (map_fd >= 0)
+        close(map_fd);
+
+    FILE *f = fopen(file, "r");
+    if (!f) {
+        fprintf(stderr, "[aid_bench] open(%s) failed: %s\n", file, strerror(errno));
+        if (inner_fd >= 0)
+            close(inner_fd);
+        return -1;
+    }
+
+    char line[PATH_MAX];
+    t->count = 0;
+    while (t->count < MAX_TRACE && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] != '/')
+            continue;
+        t->paths[t->count] = strdup(line);
+        if (!t->paths[t->count])
+            break;
+        t->hit[t->count] = inner_fd >= 0 && trace_has_policy(inner_fd, line);
+        t->count++;
+    }
+    fclose(f);
+    if (inner_fd >= 0)
+        close(inner_fd);
+
+    if (t->count == 0) {
+        fprintf(stderr, "[aid_bench] %s: no absolute paths\n", file);
+        return -1;
+    }
+    return 0;
+}
+
+static void print_latency(const char *label, uint32_t *lat, long n, long errors)
+{
+    if (n == 0) {
+        printf("  %-6s      0 opens\n", label);
+        return;
+    }
+    uint64_t sum = 0;
+    for (long i = 0; i < n; i++)
+        sum += lat[i];
+    qsort(lat, n, sizeof(*lat), cmp_u32);
+    printf("  %-6s %6ld opens  avg %.1f ns  p50 %u ns  p99 %u ns  (%ld failed)\n",
+           label, n, (double)sum / n, lat[n / 2], lat[n * 99 / 100], errors);
+}
+
+// Replay the trace iters times over: open, read size bytes, close
+static int run_trace(const struct trace *t, long iters, size_t size)
+{
+    char *buf = calloc(1, size);
+    uint32_t *lat[2] = { calloc(iters, sizeof(uint32_t)), calloc(iters, sizeof(uint32_t)) };
+    long n[2] = { 0, 0 }, errors[2] = { 0, 0 };
+    if (!buf || !lat[0] || !lat[1]) {
+        fprintf(stderr, "[aid_bench] out of memory\n");
+        return 1;
+    }
+
+    for (long i = 0; i < iters; i++) {
+        int p = (int)(i % t->count);
+        int h = t->hit[p];
+        uint64_t t0 = now_ns();
+        int fd = open(t->paths[p], O_RDONLY);
+        ssize_t r = -1;
+        if (fd >= 0) {
+            r = read(fd, buf, size);
+            close(fd);
+        }
+        lat[h][n[h]++] = (uint32_t)(now_ns() - t0);
+        if (r < 0)
+            errors[h]++;
+    }
+
+    int hits = 0;
+    for (int p = 0; p < t->count; p++)
+        hits += t->hit[p];
+    printf("[aid_bench] trace: %d paths (%d with a policy), %ld opens x %zu bytes\n",
+           t->count, hits, iters, size);
+    print_latency("hit", lat[1], n[1], errors[1]);
+    print_latency("miss", lat[0], n[0], errors[0]);
+
+    free(lat[0]);
+    free(lat[1]);
+    free(buf);
+    return 0;
+}
+
+static int run_bench(const char *path, long iters, size_t size, int do_write, int sequential)
+{
+    int fd = open(path, do_write ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "[aid_bench] open(%s) failed: %s\n", path, strerror(errno));
+        return 1;
+    }
+
+    char *buf = calloc(1, size);
+    uint32_t *lat = calloc(iters, sizeof(*lat));
+    if (!buf || !lat) {
+        fprintf(stderr, "[aid_bench] out of memory\n");
+        return 1;
+    }
+
+    // Warm up caches and the hook before measuring
+    for (int i = 0; i < 1000; i++) {
+        if (pread(fd, buf, size, 0) < 0)
+            break;
+    }
+
+    long errors = 0;
+    uint64_t bytes = 0;
+    uint64_t start = now_ns();
+    for (long i = 0; i < iters; i++) {
+        uint64_t t0 = now_ns();
+        ssize_t n;
+        if (sequential)
+            n = read(fd, buf, size);
+        else
+            n = do_write ? pwrite(fd, buf, size, 0) : pread(fd, buf, size, 0);
+        uint64_t t1 = now_ns();
+        if (n < 0)
+            errors++;
+        else
+            bytes += n;
+        lat[i] = (uint32_t)(t1 - t0);
+        if (sequential && n == 0)
+            lseek(fd, 0, SEEK_SET);
+    }
+    uint64_t total = now_ns() - start;
+
+    qsort(lat, iters, sizeof(*lat), cmp_u32);
+
+    printf("[aid_bench] %s %s: %ld calls x %zu bytes\n",
+           sequential ? "read" : do_write ? "pwrite" : "pread", path, iters, size);
+    printf("  avg %.1f ns/call  p50 %u ns  p99 %u ns  max %u ns  %.1f MB/s\n",
+           (double)total / iters, lat[iters / 2], lat[iters * 99 / 100], lat[iters - 1],
+           bytes * 1000.0 / total);
+    if (errors)
+        printf("  %ld calls failed (denied?)\n", errors);
+
+    free(lat);
+    free(buf);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    long iters = DEFAULT_ITERS;
+    size_t size = DEFAULT_SIZE;
+    int do_write = 0;
+    int sequential = 0;
+    const char *agent = NULL;
+    int key_bench = 0;
+    int agent_bench = 0;
+    int trace_bench = 0;
+    long per_agent = AGENT_BENCH_ENTRIES;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:wSu:KAe:T")) != -1) {
+        switch (opt) {
+        case 'n': iters = atol(optarg); break;
+        case 's': size = (size_t)atol(optarg); break;
+        case 'w': do_write = 1; break;
+        case 'S': sequential = 1; break;
+        case 'u': agent = optarg; break;
+        case 'K': key_bench = 1; break;
+        case 'A': agent_bench = 1; break;
+        case 'e': per_agent = atol(optarg); break;
+        case 'T': trace_bench = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+
+    if (key_bench) {
+        if (optind != argc || iters <= 0)
+            usage(argv[0]);
+        // Lookups go through bpf(2), so syscall cost is included in both rows
+        printf("[aid_bench] policy key layouts, %d entries, %ld lookups\n",
+               KEY_BENCH_ENTRIES, iters);
+        if (bench_key_layout("legacy", sizeof(struct legacy_key), iters, make_legacy_key) < 0 ||
+            bench_key_layout("packed", sizeof(struct inode_key), iters, make_packed_key) < 0)
+            return 1;
+        return 0;
+    }
+    if (agent_bench) {
+        if (optind != argc || iters <= 0 || per_agent <= 0)
+            usage(argv[0]);
+        printf("[aid_bench] flat map vs hash of maps, %ld entries/agent, %ld lookups\n",
+               per_agent, iters);
+        uint32_t counts[] = { 10, 100, 1000 };
+        for (int i = 0; i < 3; i++) {
+            if (bench_agents(counts[i], (uint32_t)per_agent, iters) < 0)
+                return 1;
+        }
+        return 0;
+    }
+    if (optind != argc - 1 || iters <= 0 || size == 0 || (do_write && sequential))
+        usage(argv[0]);
+
+    const char *path = argv[optind];
+    if (!agent && trace_bench)
+        usage(argv[0]);
+    if (!agent)
+        return run_bench(path, iters, size, do_write, sequential);
+
+    static struct trace trace;
+    if (trace_bench && load_trace(path, agent, &trace) < 0)
+        return 1;
+
+    // Run-time stats stay enabled only while this fd is open
+    int stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+    if (stats_fd < 0) {
+        fprintf(stderr, "[aid_bench] bpf_enable_stats failed: %s (run as root)\n",
+                strerror(errno));
+        return 1;
+    }
+
+    static struct prog_sample before[MAX_PROGS], after[MAX_PROGS];
+    int nbefore = sample_progs(before, MAX_PROGS);
+
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "[aid_bench] fork failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (pid == 0) {
+        close(stats_fd);
+        if (become_agent(agent) < 0)
+            _exit(1);
+        if (trace_bench)
+            _exit(run_trace(&trace, iters, size));
+        _exit(run_bench(path, iters, size, do_write, sequential));
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    int nafter = sample_progs(after, MAX_PROGS);
+    close(stats_fd);
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        return 1;
+    if (nafter == 0) {
+        printf("  (no %s* programs loaded)\n", PROG_PREFIX);
+        return 0;
+    }
+    // Runs include every process hitting the hooks, not just this benchmark
+    print_prog_stats(before, nbefore, after, nafter);
+    return 0;
+}
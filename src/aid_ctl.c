@@ -0,0 +1,761 @@
+// src/aid_ctl.c
+#include <errno.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+
+#include "../include/aid_shared.h"
+#include "aid_util.h"
+
+#define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
+#define AGENT_USER_PREFIX "agent_"
+
+static const char *verbosity_names[] = { "off", "deny", "all" };
+static const char *mode_names[] = { "enforce", "permissive", "disabled" };
+static const char *audit_names[] = { "off", "deny" };
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s <command> [args]\n", prog);
+    fprintf(stderr, "Change AID LSM runtime settings without reloading\n");
+    fprintf(stderr, "\nCommands:\n");
+    fprintf(stderr, "  status                          show current settings\n");
+    fprintf(stderr, "  verbosity <off|deny|all>        bpf_printk level (off in production)\n");
+    fprintf(stderr, "  mode <enforce|permissive|disabled>\n");
+    fprintf(stderr, "  debug <agentname|uid> <on|off>  log every decision for one agent\n");
+    fprintf(stderr, "  audit <off|deny>                ring buffer events for denials\n");
+    fprintf(stderr, "  ratelimit <events/s> <burst>    per-uid audit token bucket\n");
+    fprintf(stderr, "  cache <on|off>                  per-open-file verdict cache\n");
+    fprintf(stderr, "  bloom <on|off>                  bloom filter in front of policy lookups\n");
+    fprintf(stderr, "  latency <on|off>                file_permission latency histograms (aid_top -H)\n");
+    fprintf(stderr, "  recorder <on|off>               flight recorder of recent decisions\n");
+    fprintf(stderr, "                                  (dump_policies --recent)\n");
+    fprintf(stderr, "  hot <N|off>                     sample 1 in N accesses into the hot-inode\n");
+    fprintf(stderr, "                                  sketch (aid_hot)\n");
+    fprintf(stderr, "  specialize <on|off>             run agents' specialized file_permission\n");
+    fprintf(stderr, "                                  programs (built by addagent)\n");
+    fprintf(stderr, "  revoke <agentname|uid>          drop an agent's file policy, network rules,\n");
+    fprintf(stderr, "                                  suffix classes, label rules, session\n");
+    fprintf(stderr, "                                  overrides, specialized program and profile\n");
+    fprintf(stderr, "  profile <agentname|uid> [<key> <value>]\n");
+    fprintf(stderr, "                                  show or change one agent's profile:\n");
+    fprintf(stderr, "                                  default allow|deny, any|suffix|execbit on|off,\n");
+    fprintf(stderr, "                                  audit off|deny|global,\n");
+    fprintf(stderr, "                                  mode enforce|permissive|disabled|global\n");
+    fprintf(stderr, "  session [<agentname|uid> <id> [<key> <value>|del]]\n");
+    fprintf(stderr, "                                  list session overrides, or show or change\n");
+    fprintf(stderr, "                                  the profile of one hire session (keys as profile)\n");
+    fprintf(stderr, "  fs [<fs|0xmagic|/mount> <rwatcux|del>]\n");
+    fprintf(stderr, "                                  list or change whole-filesystem rules\n");
+    fprintf(stderr, "  net [<agentname|uid>]           list connect/sendmsg destination rules\n");
+    fprintf(stderr, "  suffix [<.ext> <sensitive|public|del>]\n");
+    fprintf(stderr, "                                  list suffix classes or change a global one\n");
+    exit(1);
+}
+
+static int lookup_name(const char *name, const char **names, int count)
+{
+    for (int i = 0; i < count; i++) {
+        if (strcmp(name, names[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+// Accept either a numeric uid or an agent name (agent_<name>)
+static int resolve_uid(const char *arg, uint32_t *uid)
+{
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (*arg && *end == '\0') {
+        *uid = (uint32_t)v;
+    } else {
+        char username[256];
+        snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, arg);
+        struct passwd *pw = getpwnam(username);
+        if (!pw) {
+            fprintf(stderr, "[aid_ctl] Agent user '%s' does not exist.\n", username);
+            return -1;
+        }
+        *uid = pw->pw_uid;
+    }
+
+    if (*uid < AID_UID_BASE || *uid >= AID_UID_MAX) {
+        fprintf(stderr, "[aid_ctl] uid=%u is not in AID range (%d-%d).\n",
+                *uid, AID_UID_BASE, AID_UID_MAX);
+        return -1;
+    }
+    return 0;
+}
+
+// Delete uid's key from the pinned map at path; a missing entry is not an error
+static int delete_uid_entry(const char *path, uint32_t uid)
+{
+    int fd = bpf_obj_get(path);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", path, strerror(errno));
+        return -1;
+    }
+    int ret = bpf_map_delete_elem(fd, &uid);
+    if (ret < 0 && errno == ENOENT)
+        ret = 1;
+    else if (ret < 0)
+        fprintf(stderr, "bpf_map_delete_elem(%s, uid=%u) failed: %s\n",
+                path, uid, strerror(errno));
+    close(fd);
+    return ret;
+}
+
+static const char *profile_level_name(uint8_t v, const char **names, int count)
+{
+    if (v == AID_PROFILE_INHERIT)
+        return "global";
+    return v < count ? names[v] : "?";
+}
+
+static void print_profile(uint32_t uid, const struct agent_profile *p)
+{
+    printf("uid %u: %s\n", uid, (p->flags & AID_PROFILE_ACTIVE) ? "profile" : "defaults");
+    printf("default:   %s\n", (p->flags & AID_PROFILE_DEFAULT_ALLOW) ? "allow" : "deny");
+    printf("any:       %s\n", (p->flags & AID_PROFILE_NET_ANY) ? "on" : "off");
+    printf("suffix:    %s\n", (p->flags & AID_PROFILE_SUFFIX_CLASS) ? "on" : "off");
+    printf("execbit:   %s\n", (p->flags & AID_PROFILE_EXEC_BIT) ? "on" : "off");
+    printf("audit:     %s\n", profile_level_name(p->audit_level, audit_names, 2));
+    printf("mode:      %s\n", profile_level_name(p->enforce_mode, mode_names, 3));
+}
+
+// Apply "<key> <value>" to a profile; -1 if either is not recognised
+static int set_profile(struct agent_profile *p, const char *key, const char *value)
+{
+    static const struct {
+        const char *key;
+        uint8_t flag;
+    } flags[] = {
+        { "any",     AID_PROFILE_NET_ANY },
+        { "suffix",  AID_PROFILE_SUFFIX_CLASS },
+        { "execbit", AID_PROFILE_EXEC_BIT },
+    };
+
+    if (strcmp(key, "default") == 0) {
+        int allow = lookup_name(value, (const char *[]){ "deny", "allow" }, 2);
+        if (allow < 0)
+            return -1;
+        p->flags = allow ? p->flags | AID_PROFILE_DEFAULT_ALLOW
+                         : p->flags & ~AID_PROFILE_DEFAULT_ALLOW;
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        if (strcmp(key, flags[i].key) == 0) {
+            int on = lookup_name(value, (const char *[]){ "off", "on" }, 2);
+            if (on < 0)
+                return -1;
+            p->flags = on ? p->flags | flags[i].flag : p->flags & ~flags[i].flag;
+            return 0;
+        }
+    }
+
+    int level = strcmp(value, "global") == 0 ? AID_PROFILE_INHERIT : -1;
+    if (strcmp(key, "audit") == 0) {
+        if (level < 0)
+            level = lookup_name(value, audit_names, 2);
+        if (level < 0)
+            return -1;
+        p->audit_level = (uint8_t)level;
+        return 0;
+    }
+    if (strcmp(key, "mode") == 0) {
+        if (level < 0)
+            level = lookup_name(value, mode_names, 3);
+        if (level < 0)
+            return -1;
+        p->enforce_mode = (uint8_t)level;
+        return 0;
+    }
+    return -1;
+}
+
+// uid's profile slot; an unset slot reads as the defaults
+static void load_profile(int fd, uint32_t uid, struct agent_profile *p)
+{
+    uint32_t idx = uid - AID_UID_BASE;
+    if (bpf_map_lookup_elem(fd, &idx, p) < 0 || !(p->flags & AID_PROFILE_ACTIVE)) {
+        p->flags = AID_PROFILE_DEFAULT_FLAGS;
+        p->audit_level = AID_PROFILE_INHERIT;
+        p->enforce_mode = AID_PROFILE_INHERIT;
+    }
+}
+
+// profile <uid> [<key> <value>]: an unset slot starts from the defaults
+static int profile_cmd(struct aid_config *cfg, uint32_t uid, const char *key, const char *value)
+{
+    int fd = bpf_obj_get(AID_PROFILES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_PROFILES_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    uint32_t idx = uid - AID_UID_BASE;
+    struct agent_profile p = {};
+    int ret = 0;
+    load_profile(fd, uid, &p);
+
+    if (key) {
+        if (set_profile(&p, key, value) < 0) {
+            fprintf(stderr, "[aid_ctl] invalid profile setting '%s %s'\n", key, value);
+            close(fd);
+            return 1;
+        }
+        p.flags |= AID_PROFILE_ACTIVE;
+        if (bpf_map_update_elem(fd, &idx, &p, BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem(%s) failed: %s\n",
+                    AID_PROFILES_MAP_PATH, strerror(errno));
+            ret = 1;
+        } else {
+            // Cached verdicts were computed with the old read heuristics
+            __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+            printf("[aid_ctl] profile uid=%u %s=%s\n", uid, key, value);
+        }
+    } else {
+        print_profile(uid, &p);
+    }
+    close(fd);
+    return ret;
+}
+
+// session [<uid> <id> [<key> <value>|del]]: an override starts from the
+// agent's profile and only applies to the processes of that hire session
+static int session_cmd(struct aid_config *cfg, uint32_t uid, const char *id,
+                       const char *key, const char *value)
+{
+    int fd = bpf_obj_get(AID_SESSIONS_MAP_PATH);
+    int profile_fd = bpf_obj_get(AID_PROFILES_MAP_PATH);
+    if (fd < 0 || profile_fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                fd < 0 ? AID_SESSIONS_MAP_PATH : AID_PROFILES_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    uint32_t session, next_session, *prev = NULL;
+    struct aid_session s = {};
+    int ret = 0;
+
+    if (!id) {
+        while (bpf_map_get_next_key(fd, prev, &next_session) == 0) {
+            session = next_session;
+            prev = &session;
+            if (bpf_map_lookup_elem(fd, &session, &s) < 0)
+                continue;
+            printf("session %u, ", session);
+            print_profile(s.agent, &s.prof);
+        }
+        goto out;
+    }
+
+    char *end;
+    unsigned long v = strtoul(id, &end, 10);
+    if (!*id || *end != '\0' || v == 0 || v > 0xffffffffUL) {
+        fprintf(stderr, "[aid_ctl] invalid session id '%s'\n", id);
+        ret = 1;
+        goto out;
+    }
+    session = (uint32_t)v;
+
+    if (bpf_map_lookup_elem(fd, &session, &s) < 0 || s.agent != uid) {
+        s.agent = uid;
+        load_profile(profile_fd, uid, &s.prof);
+    }
+
+    if (key && strcmp(key, "del") == 0) {
+        if (bpf_map_delete_elem(fd, &session) < 0 && errno != ENOENT) {
+            fprintf(stderr, "bpf_map_delete_elem(%s) failed: %s\n",
+                    AID_SESSIONS_MAP_PATH, strerror(errno));
+            ret = 1;
+        } else {
+            __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+            printf("[aid_ctl] session %u override removed\n", session);
+        }
+    } else if (key) {
+        if (set_profile(&s.prof, key, value) < 0) {
+            fprintf(stderr, "[aid_ctl] invalid profile setting '%s %s'\n", key, value);
+            ret = 1;
+            goto out;
+        }
+        s.prof.flags |= AID_PROFILE_ACTIVE;
+        if (bpf_map_update_elem(fd, &session, &s, BPF_ANY) < 0) {
+            fprintf(stderr, "bpf_map_update_elem(%s) failed: %s\n",
+                    AID_SESSIONS_MAP_PATH, strerror(errno));
+            ret = 1;
+        } else {
+            // Every task of the session reloads its profile
+            __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+            printf("[aid_ctl] session %u uid=%u %s=%s\n", session, uid, key, value);
+        }
+    } else {
+        printf("session %u, ", session);
+        print_profile(uid, &s.prof);
+    }
+out:
+    close(fd);
+    close(profile_fd);
+    return ret;
+}
+
+static void print_fs_rules(int fd)
+{
+    struct fs_rule_key key, next_key, *prev = NULL;
+    struct fs_rule rule;
+
+    printf("%-6s %-16s %s\n", "KIND", "TARGET", "ALLOW");
+    while (bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+        key = next_key;
+        prev = &key;
+        if (bpf_map_lookup_elem(fd, &key, &rule) < 0)
+            continue;
+
+        char target[32], verbs[8];
+        const char *name = aid_fs_name(key.id);
+        if (key.kind == AID_FS_KIND_DEV)
+            snprintf(target, sizeof(target), "%u:%u", key.id >> 20, key.id & 0xfffff);
+        else if (name)
+            snprintf(target, sizeof(target), "%s", name);
+        else
+            snprintf(target, sizeof(target), "0x%x", key.id);
+        printf("%-6s %-16s %s\n", key.kind == AID_FS_KIND_DEV ? "dev" : "magic", target,
+               aid_perm_str(rule.allow, verbs));
+    }
+}
+
+// fs [<target> <verbs|del>]
+static int fs_cmd(struct aid_config *cfg, const char *target, const char *verbs)
+{
+    int fd = bpf_obj_get(AID_FS_RULES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_FS_RULES_MAP_PATH, strerror(errno));
+        return 1;
+    }
+    if (!target) {
+        print_fs_rules(fd);
+        close(fd);
+        return 0;
+    }
+
+    struct fs_rule_key key = {};
+    struct fs_rule rule = {};
+    int allow = strcmp(verbs, "del") == 0 ? 0 : aid_perm_parse(verbs);
+    int ret;
+
+    if (aid_fs_rule_key_parse(target, &key) < 0 || allow < 0) {
+        fprintf(stderr, "[aid_ctl] invalid fs rule '%s %s'\n", target, verbs);
+        close(fd);
+        return 1;
+    }
+    rule.allow = (uint8_t)allow;
+    if (strcmp(verbs, "del") == 0)
+        ret = bpf_map_delete_elem(fd, &key);
+    else
+        ret = bpf_map_update_elem(fd, &key, &rule, BPF_ANY);
+    close(fd);
+    if (ret < 0) {
+        fprintf(stderr, "[aid_ctl] fs %s %s failed: %s\n", target, verbs, strerror(errno));
+        return 1;
+    }
+
+    // Cached verdicts may carry the old rule, and the specialized programs
+    // were built without it (until addagent runs again)
+    __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+    __atomic_add_fetch(&cfg->fs_gen, 1, __ATOMIC_SEQ_CST);
+    printf("[aid_ctl] fs %s %s\n", target, verbs);
+    return 0;
+}
+
+// List net_rules entries, of one uid or (uid 0) of every agent; with del,
+// delete them instead. Returns how many matched, -1 on error.
+static int walk_net_rules(uint32_t uid, int del)
+{
+    int fd = bpf_obj_get(AID_NET_RULES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_NET_RULES_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    // Collect first: deleting while iterating would restart the walk
+    static struct net_rule_key keys[4096];
+    struct net_rule_key key, next_key, *prev = NULL;
+    int n = 0;
+
+    while (n < (int)(sizeof(keys) / sizeof(keys[0])) &&
+           bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+        if (!uid || next_key.uid == uid)
+            keys[n++] = next_key;
+        key = next_key;
+        prev = &key;
+    }
+
+    if (!del)
+        printf("%-6s %s\n", "UID", "DESTINATION");
+    for (int i = 0; i < n; i++) {
+        char buf[80];
+        if (del)
+            bpf_map_delete_elem(fd, &keys[i]);
+        else
+            printf("%-6u %s\n", keys[i].uid, aid_net_rule_str(&keys[i], buf, sizeof(buf)));
+    }
+    close(fd);
+    return n;
+}
+
+// suffix: list every class (global and per agent); suffix <.ext> <class|del>
+// changes a global one
+static int suffix_cmd(struct aid_config *cfg, const char *suffix, const char *class)
+{
+    int fd = bpf_obj_get(AID_SUFFIX_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_SUFFIX_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    if (!suffix) {
+        struct suffix_key key, next_key, *prev = NULL;
+        struct suffix_class c;
+
+        printf("%-8s %-10s %s\n", "UID", "SUFFIX", "CLASS");
+        while (bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+            key = next_key;
+            prev = &key;
+            if (bpf_map_lookup_elem(fd, &key, &c) < 0)
+                continue;
+            char uid[16] = "global";
+            if (key.uid != AID_SUFFIX_GLOBAL)
+                snprintf(uid, sizeof(uid), "%u", key.uid);
+            printf("%-8s %-10.*s %s\n", uid, AID_SUFFIX_LEN, (const char *)key.suffix,
+                   c.sensitive ? "sensitive" : "public");
+        }
+        close(fd);
+        return 0;
+    }
+
+    struct suffix_key key;
+    struct suffix_class c = {};
+    int del = strcmp(class, "del") == 0;
+    int ret;
+
+    if (aid_suffix_key_parse(suffix, AID_SUFFIX_GLOBAL, &key) < 0 ||
+        (!del && strcmp(class, "sensitive") != 0 && strcmp(class, "public") != 0)) {
+        fprintf(stderr, "[aid_ctl] invalid suffix class '%s %s'\n", suffix, class);
+        close(fd);
+        return 1;
+    }
+    c.sensitive = strcmp(class, "sensitive") == 0;
+    ret = del ? bpf_map_delete_elem(fd, &key) : bpf_map_update_elem(fd, &key, &c, BPF_ANY);
+    close(fd);
+    if (ret < 0) {
+        fprintf(stderr, "[aid_ctl] suffix %s %s failed: %s\n", suffix, class, strerror(errno));
+        return 1;
+    }
+
+    // Cached verdicts may carry the old class
+    __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+    printf("[aid_ctl] suffix %s %s\n", suffix, class);
+    return 0;
+}
+
+// Delete uid's own suffix classes; returns how many, -1 on error
+static int delete_suffix_classes(uint32_t uid)
+{
+    int fd = bpf_obj_get(AID_SUFFIX_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_SUFFIX_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    struct suffix_key keys[256], key, next_key, *prev = NULL;
+    int n = 0;
+    while (n < (int)(sizeof(keys) / sizeof(keys[0])) &&
+           bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+        if (next_key.uid == uid)
+            keys[n++] = next_key;
+        key = next_key;
+        prev = &key;
+    }
+    for (int i = 0; i < n; i++)
+        bpf_map_delete_elem(fd, &keys[i]);
+    close(fd);
+    return n;
+}
+
+// Delete uid's label rules; returns how many, -1 on error
+static int delete_label_rules(uint32_t uid)
+{
+    int fd = bpf_obj_get(AID_LABEL_RULES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_LABEL_RULES_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    struct label_key keys[256], key, next_key, *prev = NULL;
+    int n = 0;
+    while (n < (int)(sizeof(keys) / sizeof(keys[0])) &&
+           bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+        if (next_key.uid == uid)
+            keys[n++] = next_key;
+        key = next_key;
+        prev = &key;
+    }
+    for (int i = 0; i < n; i++)
+        bpf_map_delete_elem(fd, &keys[i]);
+    close(fd);
+    return n;
+}
+
+// Delete the overrides of uid's hire sessions; returns how many, -1 on error
+static int delete_session_overrides(uint32_t uid)
+{
+    int fd = bpf_obj_get(AID_SESSIONS_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_SESSIONS_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    uint32_t keys[256], key, next_key, *prev = NULL;
+    struct aid_session s;
+    int n = 0;
+    while (n < (int)(sizeof(keys) / sizeof(keys[0])) &&
+           bpf_map_get_next_key(fd, prev, &next_key) == 0) {
+        if (bpf_map_lookup_elem(fd, &next_key, &s) == 0 && s.agent == uid)
+            keys[n++] = next_key;
+        key = next_key;
+        prev = &key;
+    }
+    for (int i = 0; i < n; i++)
+        bpf_map_delete_elem(fd, &keys[i]);
+    close(fd);
+    return n;
+}
+
+// Put uid's profile slot back to the defaults. The inode_store epochs stay,
+// with every slot written so far (base_epoch = epoch) revoked: inode storage
+// cannot be listed to delete them.
+static int reset_profile(uint32_t uid)
+{
+    int fd = bpf_obj_get(AID_PROFILES_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_PROFILES_MAP_PATH, strerror(errno));
+        return -1;
+    }
+    uint32_t idx = uid - AID_UID_BASE;
+    struct agent_profile old = {}, p = {};
+    bpf_map_lookup_elem(fd, &idx, &old);
+    p.epoch = old.epoch;
+    p.base_epoch = old.epoch;
+    int ret = bpf_map_update_elem(fd, &idx, &p, BPF_ANY);
+    if (ret < 0)
+        fprintf(stderr, "bpf_map_update_elem(%s) failed: %s\n",
+                AID_PROFILES_MAP_PATH, strerror(errno));
+    close(fd);
+    return ret;
+}
+
+static void print_status(const struct aid_config *cfg)
+{
+    printf("verbosity: %s\n", cfg->verbosity < 3 ? verbosity_names[cfg->verbosity] : "?");
+    printf("mode:      %s\n", cfg->enforce_mode < 3 ? mode_names[cfg->enforce_mode] : "?");
+    printf("audit:     %s (%u events/s, burst %u per uid)\n",
+           cfg->audit_level < 2 ? audit_names[cfg->audit_level] : "?",
+           cfg->audit_rate, cfg->audit_burst);
+    printf("cache:     %s (policy generation %u)\n",
+           cfg->verdict_cache ? "on" : "off", cfg->policy_gen);
+    printf("bloom:     %s\n", cfg->policy_bloom ? "on" : "off");
+    printf("latency:   %s\n", cfg->latency_hist ? "on" : "off");
+    printf("recorder:  %s\n", cfg->flight_recorder ? "on" : "off");
+    printf("store:     %s\n", cfg->policy_store == AID_STORE_INODE ? "inode" : "map");
+    printf("sessions:  %u started by hire\n", cfg->next_session);
+    printf("specialize: %s\n", cfg->specialize ? "on" : "off");
+    if (cfg->hh_sample)
+        printf("hot:       1/%u\n", cfg->hh_sample);
+    else
+        printf("hot:       off\n");
+    printf("debug:    ");
+    int any = 0;
+    for (uint32_t i = 0; i < AID_NR_UIDS; i++) {
+        if (cfg->debug_uids[i / 64] & (1ULL << (i % 64))) {
+            printf(" %u", AID_UID_BASE + i);
+            any = 1;
+        }
+    }
+    printf("%s\n", any ? "" : " (none)");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+        usage(argv[0]);
+
+    int map_fd = bpf_obj_get(AID_CONFIG_MAP_PATH);
+    if (map_fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n",
+                AID_CONFIG_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    // The map is BPF_F_MMAPABLE: slot 0 starts at offset 0
+    size_t map_len = (sizeof(struct aid_config) + getpagesize() - 1) & ~(getpagesize() - 1);
+    struct aid_config *cfg = mmap(NULL, map_len, PROT_READ | PROT_WRITE,
+                                  MAP_SHARED, map_fd, 0);
+    if (cfg == MAP_FAILED) {
+        fprintf(stderr, "mmap(%s) failed: %s\n", AID_CONFIG_MAP_PATH, strerror(errno));
+        close(map_fd);
+        return 1;
+    }
+
+    int ret = 0;
+    const char *cmd = argv[1];
+
+    if (strcmp(cmd, "status") == 0) {
+        print_status(cfg);
+    } else if (strcmp(cmd, "verbosity") == 0 && argc == 3) {
+        int v = lookup_name(argv[2], verbosity_names, 3);
+        if (v < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->verbosity, (uint32_t)v, __ATOMIC_RELAXED);
+        printf("[aid_ctl] verbosity=%s\n", verbosity_names[v]);
+    } else if (strcmp(cmd, "mode") == 0 && argc == 3) {
+        int m = lookup_name(argv[2], mode_names, 3);
+        if (m < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->enforce_mode, (uint32_t)m, __ATOMIC_RELAXED);
+        printf("[aid_ctl] mode=%s\n", mode_names[m]);
+    } else if (strcmp(cmd, "audit") == 0 && argc == 3) {
+        int a = lookup_name(argv[2], audit_names, 2);
+        if (a < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->audit_level, (uint32_t)a, __ATOMIC_RELAXED);
+        printf("[aid_ctl] audit=%s\n", audit_names[a]);
+    } else if (strcmp(cmd, "ratelimit") == 0 && argc == 4) {
+        long rate = atol(argv[2]);
+        long burst = atol(argv[3]);
+        if (rate <= 0 || burst <= 0) {
+            fprintf(stderr, "[aid_ctl] rate and burst must be positive\n");
+            ret = 1;
+        } else {
+            __atomic_store_n(&cfg->audit_rate, (uint32_t)rate, __ATOMIC_RELAXED);
+            __atomic_store_n(&cfg->audit_burst, (uint32_t)burst, __ATOMIC_RELAXED);
+            printf("[aid_ctl] ratelimit=%ld events/s burst=%ld\n", rate, burst);
+        }
+    } else if (strcmp(cmd, "cache") == 0 && argc == 3) {
+        int on = lookup_name(argv[2], (const char *[]){ "off", "on" }, 2);
+        if (on < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->verdict_cache, (uint32_t)on, __ATOMIC_RELAXED);
+        // Entries cached before a disable must not come back on re-enable
+        __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+        printf("[aid_ctl] cache=%s\n", argv[2]);
+    } else if (strcmp(cmd, "bloom") == 0 && argc == 3) {
+        int on = lookup_name(argv[2], (const char *[]){ "off", "on" }, 2);
+        if (on < 0)
+            usage(argv[0]);
+        // addagent fills the filter whether or not the hook reads it
+        __atomic_store_n(&cfg->policy_bloom, (uint32_t)on, __ATOMIC_RELAXED);
+        printf("[aid_ctl] bloom=%s\n", argv[2]);
+    } else if (strcmp(cmd, "latency") == 0 && argc == 3) {
+        int on = lookup_name(argv[2], (const char *[]){ "off", "on" }, 2);
+        if (on < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->latency_hist, (uint32_t)on, __ATOMIC_RELAXED);
+        printf("[aid_ctl] latency=%s\n", argv[2]);
+    } else if (strcmp(cmd, "recorder") == 0 && argc == 3) {
+        int on = lookup_name(argv[2], (const char *[]){ "off", "on" }, 2);
+        if (on < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->flight_recorder, (uint32_t)on, __ATOMIC_RELAXED);
+        printf("[aid_ctl] recorder=%s\n", argv[2]);
+    } else if (strcmp(cmd, "hot") == 0 && argc == 3) {
+        unsigned long n = 0;
+        if (strcmp(argv[2], "off") != 0) {
+            char *end;
+            n = strtoul(argv[2], &end, 10);
+            if (*end != '\0' || n == 0 || n > 0xffffffffUL)
+                usage(argv[0]);
+        }
+        // The sketch keeps its counts; aid_hot -c starts a new window
+        __atomic_store_n(&cfg->hh_sample, (uint32_t)n, __ATOMIC_RELAXED);
+        printf("[aid_ctl] hot=%s\n", argv[2]);
+    } else if (strcmp(cmd, "debug") == 0 && argc == 4) {
+        uint32_t uid;
+        if (resolve_uid(argv[2], &uid) < 0) {
+            ret = 1;
+        } else {
+            uint32_t idx = uid - AID_UID_BASE;
+            uint64_t bit = 1ULL << (idx % 64);
+            if (strcmp(argv[3], "on") == 0)
+                __atomic_fetch_or(&cfg->debug_uids[idx / 64], bit, __ATOMIC_RELAXED);
+            else if (strcmp(argv[3], "off") == 0)
+                __atomic_fetch_and(&cfg->debug_uids[idx / 64], ~bit, __ATOMIC_RELAXED);
+            else
+                usage(argv[0]);
+            printf("[aid_ctl] debug uid=%u %s\n", uid, argv[3]);
+        }
+    } else if (strcmp(cmd, "specialize") == 0 && argc == 3) {
+        int on = lookup_name(argv[2], (const char *[]){ "off", "on" }, 2);
+        if (on < 0)
+            usage(argv[0]);
+        __atomic_store_n(&cfg->specialize, (uint32_t)on, __ATOMIC_RELAXED);
+        printf("[aid_ctl] specialize=%s\n", argv[2]);
+    } else if (strcmp(cmd, "revoke") == 0 && argc == 3) {
+        uint32_t uid;
+        if (resolve_uid(argv[2], &uid) < 0) {
+            ret = 1;
+        } else {
+            // One outer delete drops the agent's inner map and every entry
+            // in it; the profile goes back to the defaults (no network)
+            int files = delete_uid_entry(AID_MAP_PATH, uid);
+            int net = walk_net_rules(uid, 1);
+            int suffixes = delete_suffix_classes(uid);
+            int labels = delete_label_rules(uid);
+            int sessions = delete_session_overrides(uid);
+            int spec = delete_uid_entry(AID_AGENT_PROGS_PATH, uid - AID_UID_BASE);
+            int prof = reset_profile(uid);
+            __atomic_add_fetch(&cfg->policy_gen, 1, __ATOMIC_SEQ_CST);
+            if (files < 0 || net < 0 || suffixes < 0 || labels < 0 || sessions < 0 || spec < 0 || prof < 0)
+                ret = 1;
+            printf("[aid_ctl] revoke uid=%u files=%s net=%d labels=%d sessions=%d profile=%s\n", uid,
+                   files < 0 ? "error" : files ? "none" : "removed", net, labels, sessions,
+                   prof < 0 ? "error" : "reset");
+        }
+    } else if (strcmp(cmd, "session") == 0 && (argc == 2 || argc == 4 || argc == 5 || argc == 6)) {
+        uint32_t uid = 0;
+        if (argc == 5 && strcmp(argv[4], "del") != 0)
+            usage(argv[0]);
+        if (argc > 2 && resolve_uid(argv[2], &uid) < 0)
+            ret = 1;
+        else
+            ret = session_cmd(cfg, uid, argc > 2 ? argv[3] : NULL, argc > 4 ? argv[4] : NULL,
+                              argc > 5 ? argv[5] : NULL);
+    } else if (strcmp(cmd, "fs") == 0 && (argc == 2 || argc == 4)) {
+        ret = fs_cmd(cfg, argc == 4 ? argv[2] : NULL, argc == 4 ? argv[3] : NULL);
+    } else if (strcmp(cmd, "suffix") == 0 && (argc == 2 || argc == 4)) {
+        ret = suffix_cmd(cfg, argc == 4 ? argv[2] : NULL, argc == 4 ? argv[3] : NULL);
+    } else if (strcmp(cmd, "net") == 0 && (argc == 2 || argc == 3)) {
+        uint32_t uid = 0;
+        if (argc == 3 && resolve_uid(argv[2], &uid) < 0)
+            ret = 1;
+        else if (walk_net_rules(uid, 0) < 0)
+            ret = 1;
+    } else if (strcmp(cmd, "profile") == 0 && (argc == 3 || argc == 5)) {
+        uint32_t uid;
+        if (resolve_uid(argv[2], &uid) < 0) {
+            ret = 1;
+        } else {
+            ret = profile_cmd(cfg, uid, argc == 5 ? argv[3] : NULL, argc == 5 ? argv[4] : NULL);
+        }
+    } else {
+        usage(argv[0]);
+    }
+
+    munmap(cfg, map_len);
+    close(map_fd);
+    return ret;
+}
@@ -0,0 +1,290 @@
+// src/aid_hot.c
+#define _XOPEN_SOURCE 700
+#include <errno.h>
+#include <ftw.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../include/aid_shared.h"
+
+#define AGENT_USER_PREFIX "agent_"
+#define MAX_CANDIDATES 4096   // hh_candidates max_entries
+
+struct hot {
+    struct aid_hh_key key;
+    uint64_t estimate;      // sampled hits, min over the sketch rows
+    char *path;             // NULL until resolved
+};
+
+static struct aid_cms_row sketch[AID_CMS_DEPTH];   // summed over CPUs
+
+// nftw() takes no context pointer: the walk of one device works on these
+static struct hot *walk_hot;
+static int walk_n;
+static unsigned int walk_dev;
+static int walk_left;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-k count] [-u agentname|uid] [-R] [-c]\n", prog);
+    fprintf(stderr, "Most accessed files per agent, from the sampled hot-inode sketch\n");
+    fprintf(stderr, "(enable with: aid_ctl hot <N>)\n");
+    fprintf(stderr, "  -k  files shown per agent (default 10)\n");
+    fprintf(stderr, "  -u  only this agent\n");
+    fprintf(stderr, "  -R  do not resolve inodes to paths (no filesystem walk)\n");
+    fprintf(stderr, "  -c  clear the sketch and candidates after printing\n");
+    exit(1);
+}
+
+static const char *agent_name(uint32_t uid)
+{
+    struct passwd *pw = getpwuid(uid);
+    if (!pw)
+        return "?";
+    if (strncmp(pw->pw_name, AGENT_USER_PREFIX, strlen(AGENT_USER_PREFIX)) == 0)
+        return pw->pw_name + strlen(AGENT_USER_PREFIX);
+    return pw->pw_name;
+}
+
+// Accept either a numeric uid or an agent name (agent_<name>)
+static int resolve_uid(const char *arg, uint32_t *uid)
+{
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (*arg && *end == '\0') {
+        *uid = (uint32_t)v;
+        return 0;
+    }
+
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, arg);
+    struct passwd *pw = getpwnam(username);
+    if (!pw) {
+        fprintf(stderr, "No such agent '%s'\n", arg);
+        return -1;
+    }
+    *uid = pw->pw_uid;
+    return 0;
+}
+
+// Sum every CPU's copy of each sketch row into sketch[]
+static int read_sketch(int fd)
+{
+    int ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0)
+        return -1;
+    struct aid_cms_row *percpu = calloc(ncpus, sizeof(*percpu));
+    if (!percpu)
+        return -1;
+
+    for (uint32_t row = 0; row < AID_CMS_DEPTH; row++) {
+        if (bpf_map_lookup_elem(fd, &row, percpu) < 0) {
+            free(percpu);
+            return -1;
+        }
+        for (int cpu = 0; cpu < ncpus; cpu++)
+            for (int i = 0; i < AID_CMS_WIDTH; i++)
+                sketch[row].count[i] += percpu[cpu].count[i];
+    }
+    free(percpu);
+    return 0;
+}
+
+static uint64_t estimate(const struct aid_hh_key *k)
+{
+    uint64_t min = UINT64_MAX;
+    for (unsigned int row = 0; row < AID_CMS_DEPTH; row++) {
+        uint32_t c = sketch[row].count[aid_cms_slot(k->uid, k->dev, k->ino, row)];
+        if (c < min)
+            min = c;
+    }
+    return min;
+}
+
+// Agents grouped together, hottest first within each
+static int cmp_hot(const void *a, const void *b)
+{
+    const struct hot *x = a, *y = b;
+    if (x->key.uid != y->key.uid)
+        return (x->key.uid > y->key.uid) - (x->key.uid < y->key.uid);
+    return (x->estimate < y->estimate) - (x->estimate > y->estimate);
+}
+
+// Mount point of the filesystem with kernel dev_t dev, from mountinfo
+static int mount_of(unsigned int dev, char *mnt, size_t len)
+{
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f)
+        return -1;
+
+    char line[4096];
+    int found = -1;
+    while (fgets(line, sizeof(line), f)) {
+        unsigned int major, minor;
+        char path[4096];
+        // <id> <parent> <major>:<minor> <root> <mount point> ...
+        if (sscanf(line, "%*u %*u %u:%u %*s %4095s", &major, &minor, path) != 3)
+            continue;
+        if (((major << 20) | minor) == dev) {
+            snprintf(mnt, len, "%s", path);
+            found = 0;
+            break;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+static int match_inode(const char *path, const struct stat *st, int type, struct FTW *ftw)
+{
+    (void)type;
+    (void)ftw;
+    if (((major(st->st_dev) << 20) | minor(st->st_dev)) != walk_dev)
+        return 0;
+    for (int i = 0; i < walk_n; i++) {
+        if (walk_hot[i].path || walk_hot[i].key.dev != walk_dev ||
+            walk_hot[i].key.ino != (uint64_t)st->st_ino)
+            continue;
+        walk_hot[i].path = strdup(path);
+        walk_left--;
+    }
+    // Stop the walk once every wanted inode on this device has a path
+    return walk_left == 0;
+}
+
+// One walk per device holding a shown inode; a hard-linked file gets the
+// first name found
+static void resolve_paths(struct hot *hot, int n)
+{
+    walk_hot = hot;
+    walk_n = n;
+    for (int i = 0; i < n; i++) {
+        if (hot[i].path || !hot[i].estimate)
+            continue;
+
+        char mnt[4096];
+        walk_dev = hot[i].key.dev;
+        walk_left = 0;
+        for (int j = i; j < n; j++)
+            if (hot[j].key.dev == walk_dev && !hot[j].path)
+                walk_left++;
+        if (mount_of(walk_dev, mnt, sizeof(mnt)) < 0)
+            continue;
+        nftw(mnt, match_inode, 64, FTW_PHYS | FTW_MOUNT);
+    }
+}
+
+// Zero every CPU's rows and forget the candidates: a new profiling window
+static int clear_maps(int sketch_fd, int cand_fd)
+{
+    int ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0)
+        return -1;
+    struct aid_cms_row *zero = calloc(ncpus, sizeof(*zero));
+    if (!zero)
+        return -1;
+    for (uint32_t row = 0; row < AID_CMS_DEPTH; row++)
+        bpf_map_update_elem(sketch_fd, &row, zero, BPF_ANY);
+    free(zero);
+
+    struct aid_hh_key key;
+    while (bpf_map_get_next_key(cand_fd, NULL, &key) == 0)
+        bpf_map_delete_elem(cand_fd, &key);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int top_k = 10, resolve = 1, clear = 0;
+    uint32_t only_uid = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:u:Rc")) != -1) {
+        switch (opt) {
+        case 'k': top_k = atoi(optarg); break;
+        case 'u':
+            if (resolve_uid(optarg, &only_uid) < 0)
+                return 1;
+            break;
+        case 'R': resolve = 0; break;
+        case 'c': clear = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (top_k <= 0 || optind != argc)
+        usage(argv[0]);
+
+    int sketch_fd = bpf_obj_get(AID_HH_SKETCH_MAP_PATH);
+    int cand_fd = bpf_obj_get(AID_HH_CAND_MAP_PATH);
+    if (sketch_fd < 0 || cand_fd < 0) {
+        fprintf(stderr, "[aid_hot] failed to open %s / %s: %s (is aid_lsm_loader running?)\n",
+                AID_HH_SKETCH_MAP_PATH, AID_HH_CAND_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    uint32_t sample = 0, cfg_key = 0;
+    struct aid_config cfg;
+    int cfg_fd = bpf_obj_get(AID_CONFIG_MAP_PATH);
+    if (cfg_fd >= 0 && bpf_map_lookup_elem(cfg_fd, &cfg_key, &cfg) == 0)
+        sample = cfg.hh_sample;
+    if (cfg_fd >= 0)
+        close(cfg_fd);
+
+    if (read_sketch(sketch_fd) < 0) {
+        fprintf(stderr, "[aid_hot] failed to read the sketch: %s\n", strerror(errno));
+        return 1;
+    }
+
+    static struct hot hot[MAX_CANDIDATES];
+    struct aid_hh_key key, next, *prev = NULL;
+    int n = 0;
+    while (n < MAX_CANDIDATES && bpf_map_get_next_key(cand_fd, prev, &next) == 0) {
+        key = next;
+        prev = &key;
+        if (only_uid && key.uid != only_uid)
+            continue;
+        hot[n].key = key;
+        hot[n].estimate = estimate(&key);
+        n++;
+    }
+    qsort(hot, n, sizeof(hot[0]), cmp_hot);
+
+    // Keep the top K of each agent: the rest is neither resolved nor shown
+    int kept = 0;
+    for (int i = 0, rank = 0; i < n; i++) {
+        rank = (i > 0 && hot[i].key.uid == hot[i - 1].key.uid) ? rank + 1 : 0;
+        if (rank < top_k)
+            hot[kept++] = hot[i];
+    }
+    if (resolve)
+        resolve_paths(hot, kept);
+
+    if (sample)
+        printf("sampling 1/%u, counts are estimated accesses (samples x %u)\n", sample, sample);
+    else
+        printf("sampling off, counts are raw samples\n");
+    printf("%-6s %-12s %-10s %-20s %-12s %s\n", "UID", "AGENT", "DEV", "INO", "ACCESSES", "PATH");
+    for (int i = 0; i < kept; i++) {
+        char dev[16];
+        snprintf(dev, sizeof(dev), "%u:%u", hot[i].key.dev >> 20, hot[i].key.dev & 0xfffff);
+        printf("%-6u %-12s %-10s %-20llu %-12llu %s\n",
+               hot[i].key.uid, agent_name(hot[i].key.uid), dev,
+               (unsigned long long)hot[i].key.ino,
+               (unsigned long long)(hot[i].estimate * (sample ? sample : 1)),
+               hot[i].path ? hot[i].path : "-");
+        free(hot[i].path);
+    }
+
+    if (clear && clear_maps(sketch_fd, cand_fd) < 0)
+        fprintf(stderr, "[aid_hot] failed to clear the sketch\n");
+
+    close(sketch_fd);
+    close(cand_fd);
+    return 0;
+}
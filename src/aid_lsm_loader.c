@@ -2,15 +2,395 @@
 #include <bpf/libbpf.h>
 #include <bpf/bpf.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 #include <libgen.h>
 #include <linux/limits.h>
 
+#include "../include/aid_shared.h"
+#include "aid_util.h"
+
 #define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
-#define AID_NETWORK_MAP_PATH "/sys/fs/bpf/aid_network_policies"
+#define AID_LOADER_CONF "/etc/aid/aid.conf"
+
+// cgroup v2 root: programs attached here run for every process
+#define AID_CGROUP_ROOT "/sys/fs/cgroup"
+
+// Programs to attach, and where to pin their links. cgroup programs go on
+// AID_CGROUP_ROOT; the rest attach to their LSM hook. labels: only loaded
+// with xattr_labels = true (they need a 6.13+ kernel). Order matters:
+// aid_file_label fills the label cache aid_file_open reads.
+static const struct {
+    const char *name;
+    const char *link_path;
+    int cgroup;
+    int labels;
+} lsm_programs[] = {
+    { "aid_enforce_file_permission", "/sys/fs/bpf/aid_lsm_link" },
+    { "aid_file_label",              "/sys/fs/bpf/aid_file_label_link", 0, 1 },
+    { "aid_label_set",               "/sys/fs/bpf/aid_label_set_link", 0, 1 },
+    { "aid_label_remove",            "/sys/fs/bpf/aid_label_remove_link", 0, 1 },
+    { "aid_label_rename",            "/sys/fs/bpf/aid_label_rename_link", 0, 1 },
+    { "aid_file_open",               "/sys/fs/bpf/aid_file_open_link" },
+    { "aid_file_free",               "/sys/fs/bpf/aid_file_free_link" },
+    { "aid_task_alloc",              "/sys/fs/bpf/aid_task_alloc_link" },
+    { "aid_inode_init",              "/sys/fs/bpf/aid_inode_init_link" },
+    { "aid_path_truncate",           "/sys/fs/bpf/aid_path_truncate_link" },
+    { "aid_file_truncate",           "/sys/fs/bpf/aid_file_truncate_link" },
+    { "aid_inode_create",            "/sys/fs/bpf/aid_inode_create_link" },
+    { "aid_inode_mkdir",             "/sys/fs/bpf/aid_inode_mkdir_link" },
+    { "aid_inode_unlink",            "/sys/fs/bpf/aid_inode_unlink_link" },
+    { "aid_inode_rmdir",             "/sys/fs/bpf/aid_inode_rmdir_link" },
+    { "aid_connect4",                "/sys/fs/bpf/aid_connect4_link", 1 },
+    { "aid_connect6",                "/sys/fs/bpf/aid_connect6_link", 1 },
+    { "aid_sendmsg4",                "/sys/fs/bpf/aid_sendmsg4_link", 1 },
+    { "aid_sendmsg6",                "/sys/fs/bpf/aid_sendmsg6_link", 1 },
+};
+
+#define NR_LSM_PROGRAMS (sizeof(lsm_programs) / sizeof(lsm_programs[0]))
+
+// Maps shared with the userspace tools, pinned under /sys/fs/bpf
+static const struct {
+    const char *name;
+    const char *path;
+} pinned_maps[] = {
+    { "inode_policies",   AID_MAP_PATH },
+    { "agent_profiles",   AID_PROFILES_MAP_PATH }, // written by addagent/aid_ctl
+    { "aid_config",       AID_CONFIG_MAP_PATH },   // mmap()ed by aid_ctl
+    { "aid_events",       AID_EVENTS_MAP_PATH },   // drained by aid_auditd
+    { "verdict_stats",    AID_STATS_MAP_PATH },    // read by aid_top
+    { "policy_bloom",     AID_BLOOM_MAP_PATH },    // filled by addagent
+    { "fs_rules",         AID_FS_RULES_MAP_PATH }, // edited by aid_ctl fs
+    { "net_rules",        AID_NET_RULES_MAP_PATH }, // filled by addagent
+    { "suffix_classes",   AID_SUFFIX_MAP_PATH },   // addagent, aid_ctl suffix
+    { "latency_hist",     AID_LATENCY_MAP_PATH },  // read by aid_top -H
+    { "flight_recorder",  AID_FLIGHT_MAP_PATH },   // read by dump_policies --recent
+    { "flight_head",      AID_FLIGHT_HEAD_PATH },  // shared with the specialized programs
+    { "hh_sketch",        AID_HH_SKETCH_MAP_PATH }, // read by aid_hot
+    { "hh_candidates",    AID_HH_CAND_MAP_PATH },  // read by aid_hot
+    { "inode_store",      AID_INODE_STORE_PATH },  // written by addagent (policy_store = inode)
+    { "label_rules",      AID_LABEL_RULES_MAP_PATH }, // filled by addagent
+    { "aid_tasks",        AID_TASKS_MAP_PATH },    // written by hire (pidfd key)
+    { "session_profiles", AID_SESSIONS_MAP_PATH }, // aid_ctl session
+    { "agent_progs",      AID_AGENT_PROGS_PATH },  // filled by addagent
+};
+
+#define NR_PINNED_MAPS (sizeof(pinned_maps) / sizeof(pinned_maps[0]))
+
+// Maps whose capacity can be set at load time. Plain hashes can also skip
+// preallocation, so a sparse fleet only pays for the entries it uses; the
+// LRU hash cannot (the kernel requires it preallocated), and the LPM trie
+// never is.
+static struct {
+    const char *name;
+    __u32 max_entries;   // 0: keep the size compiled into the object
+    int can_no_prealloc;
+} sized_maps[] = {
+    { "inode_policies",   0, 1 },   // agents; each has its own inner map
+    { "verdict_stats",    0, 1 },
+    { "file_verdicts",    0, 0 },
+    { "policy_bloom",     0, 0 },   // expected number of policy keys
+    { "net_rules",        0, 0 },   // destinations, over all agents
+};
+
+#define NR_SIZED_MAPS (sizeof(sized_maps) / sizeof(sized_maps[0]))
+
+static int no_prealloc;
+static int use_bloom;
+static int latency_hist;
+static int flight_recorder = 1;
+static unsigned int hh_sample;
+static int policy_store = AID_STORE_MAP;
+static int xattr_labels;
+static int specialize;
+
+// Whole-filesystem rules seeded at load: pipes and anon inodes (eventfd,
+// epoll, ...) so shell pipelines work under hire, and procfs/sysfs
+// read-only as the old .txt heuristic already had them. "fs_rule" config
+// lines add to or override these.
+#define MAX_FS_RULES 64
+
+static struct {
+    char target[128];
+    char verbs[8];
+} fs_rules[MAX_FS_RULES] = {
+    { "pipefs",       "rwa" },
+    { "anon_inodefs", "rwa" },
+    { "proc",         "r" },
+    { "sysfs",        "r" },
+};
+static int nr_fs_rules = 4;
+
+// Global suffix classes seeded at load: the old .txt heuristic plus the
+// formats secrets come in (.json, .bin as in agent/openaiapi.bin, .env).
+// "suffix_class" config lines add to or override these; an agent whose
+// runtime reads such files gets them through its manifest.
+#define MAX_SUFFIX_CLASSES 64
+
+static struct {
+    char suffix[AID_SUFFIX_LEN + 1];
+    int sensitive;
+} suffix_classes[MAX_SUFFIX_CLASSES] = {
+    { ".txt",  1 },
+    { ".json", 1 },
+    { ".bin",  1 },
+    { ".env",  1 },
+};
+static int nr_suffix_classes = 4;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-c config] [-m map=entries]... [-P] [-B] [-L]\n", prog);
+    fprintf(stderr, "  -c  map sizing config (default %s, optional)\n", AID_LOADER_CONF);
+    fprintf(stderr, "  -m  max_entries for inode_policies, verdict_stats,\n");
+    fprintf(stderr, "      file_verdicts, policy_bloom or net_rules (overrides the config)\n");
+    fprintf(stderr, "      (inode_policies counts agents: addagent sizes each agent's map)\n");
+    fprintf(stderr, "  -P  do not preallocate the hash maps (no_prealloc = true)\n");
+    fprintf(stderr, "  -B  check policy_bloom before inode_policies (use_bloom = true)\n");
+    fprintf(stderr, "  -L  time file_permission into latency_hist (latency_hist = true)\n");
+    fprintf(stderr, "\nConfig lines: <map> = <entries>, no_prealloc = true|false,\n");
+    fprintf(stderr, "              use_bloom = true|false, latency_hist = true|false,\n");
+    fprintf(stderr, "              flight_recorder = true|false (default true),\n");
+    fprintf(stderr, "              hh_sample = <N> (hot-inode sampling 1 in N, 0 = off),\n");
+    fprintf(stderr, "              policy_store = map|inode (per-file policies in inode_policies\n");
+    fprintf(stderr, "              or in BPF inode storage, default map),\n");
+    fprintf(stderr, "              xattr_labels = true|false (%s labels, kernel 6.13+),\n",
+            AID_LABEL_XATTR);
+    fprintf(stderr, "              specialize = true|false (per-agent file_permission programs),\n");
+    fprintf(stderr, "              fs_rule = <fs|0xmagic|/mount> <rwatcux>,\n");
+    fprintf(stderr, "              suffix_class = <.ext> <sensitive|public>, # comments\n");
+    exit(1);
+}
 
+// Apply one "<key>=<value>" setting from the config file or -m
+static int set_option(const char *key, const char *value)
+{
+    if (strcmp(key, "no_prealloc") == 0) {
+        no_prealloc = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+    if (strcmp(key, "fs_rule") == 0) {
+        // "<target> <verbs>", checked when the rules are seeded
+        char target[128], verbs[8];
+        if (nr_fs_rules == MAX_FS_RULES ||
+            sscanf(value, "%127s %7s", target, verbs) != 2) {
+            fprintf(stderr, "invalid fs_rule '%s' (expected: <fs|0xmagic|/mount> <rwatcux>)\n",
+                    value);
+            return -1;
+        }
+        snprintf(fs_rules[nr_fs_rules].target, sizeof(fs_rules[0].target), "%s", target);
+        snprintf(fs_rules[nr_fs_rules].verbs, sizeof(fs_rules[0].verbs), "%s", verbs);
+        nr_fs_rules++;
+        return 0;
+    }
+    if (strcmp(key, "suffix_class") == 0) {
+        char suffix[32], class[16];
+        struct suffix_key k;
+        if (nr_suffix_classes == MAX_SUFFIX_CLASSES ||
+            sscanf(value, "%31s %15s", suffix, class) != 2 ||
+            aid_suffix_key_parse(suffix, AID_SUFFIX_GLOBAL, &k) < 0 ||
+            (strcmp(class, "sensitive") != 0 && strcmp(class, "public") != 0)) {
+            fprintf(stderr, "invalid suffix_class '%s' (expected: <.ext> <sensitive|public>)\n",
+                    value);
+            return -1;
+        }
+        // k.suffix is the checked suffix, zero padded to AID_SUFFIX_LEN
+        memcpy(suffix_classes[nr_suffix_classes].suffix, k.suffix, AID_SUFFIX_LEN);
+        suffix_classes[nr_suffix_classes].suffix[AID_SUFFIX_LEN] = '\0';
+        suffix_classes[nr_suffix_classes].sensitive = strcmp(class, "sensitive") == 0;
+        nr_suffix_classes++;
+        return 0;
+    }
+    if (strcmp(key, "use_bloom") == 0) {
+        use_bloom = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+    if (strcmp(key, "flight_recorder") == 0) {
+        flight_recorder = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+    if (strcmp(key, "policy_store") == 0) {
+        if (strcmp(value, "map") == 0) {
+            policy_store = AID_STORE_MAP;
+        } else if (strcmp(value, "inode") == 0) {
+            policy_store = AID_STORE_INODE;
+        } else {
+            fprintf(stderr, "invalid policy_store '%s' (expected: map|inode)\n", value);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(key, "xattr_labels") == 0) {
+        xattr_labels = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+    if (strcmp(key, "specialize") == 0) {
+        specialize = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+    if (strcmp(key, "hh_sample") == 0) {
+        char *end;
+        unsigned long n = strtoul(value, &end, 10);
+        if (*value == '\0' || *end != '\0' || n > 0xffffffffUL) {
+            fprintf(stderr, "invalid hh_sample '%s'\n", value);
+            return -1;
+        }
+        hh_sample = (unsigned int)n;
+        return 0;
+    }
+    if (strcmp(key, "latency_hist") == 0) {
+        latency_hist = strcmp(value, "true") == 0 || strcmp(value, "1") == 0;
+        return 0;
+    }
+
+    for (size_t i = 0; i < NR_SIZED_MAPS; i++) {
+        if (strcmp(key, sized_maps[i].name) == 0) {
+            char *end;
+            unsigned long n = strtoul(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n == 0 || n > 0xffffffffUL) {
+                fprintf(stderr, "invalid size for %s: '%s'\n", key, value);
+                return -1;
+            }
+            sized_maps[i].max_entries = (__u32)n;
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "unknown setting '%s'\n", key);
+    return -1;
+}
+
+static char *strip(char *s)
+{
+    while (*s == ' ' || *s == '\t')
+        s++;
+    char *end = s + strlen(s);
+    while (end > s && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n' || end[-1] == '\r'))
+        *--end = '\0';
+    return s;
+}
+
+static int parse_setting(char *line)
+{
+    char *eq = strchr(line, '=');
+    if (!eq) {
+        fprintf(stderr, "expected <key> = <value>: '%s'\n", line);
+        return -1;
+    }
+    *eq = '\0';
+    return set_option(strip(line), strip(eq + 1));
+}
+
+static int load_config(const char *path, int required)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        if (!required && errno == ENOENT)
+            return 0;
+        fprintf(stderr, "failed to open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    char line[256];
+    int lineno = 0, err = 0;
+    while (!err && fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *p = strip(line);
+        if (*p == '\0' || *p == '#')
+            continue;
+        if (parse_setting(p) < 0) {
+            fprintf(stderr, "  at %s:%d\n", path, lineno);
+            err = -1;
+        }
+    }
+    fclose(f);
+    return err;
+}
+
+// Resize / un-preallocate maps between open and load
+static int apply_map_sizing(struct bpf_object *obj)
+{
+    for (size_t i = 0; i < NR_SIZED_MAPS; i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, sized_maps[i].name);
+        if (!map) {
+            fprintf(stderr, "map '%s' not found\n", sized_maps[i].name);
+            return -1;
+        }
+
+        if (sized_maps[i].max_entries &&
+            bpf_map__set_max_entries(map, sized_maps[i].max_entries) < 0) {
+            fprintf(stderr, "failed to size map '%s'\n", sized_maps[i].name);
+            return -1;
+        }
+        if (no_prealloc && sized_maps[i].can_no_prealloc &&
+            bpf_map__set_map_flags(map, bpf_map__map_flags(map) | BPF_F_NO_PREALLOC) < 0) {
+            fprintf(stderr, "failed to set BPF_F_NO_PREALLOC on '%s'\n", sized_maps[i].name);
+            return -1;
+        }
+
+        printf("[aid_lsm_loader] %s: max_entries=%u%s\n", sized_maps[i].name,
+               bpf_map__max_entries(map),
+               (bpf_map__map_flags(map) & BPF_F_NO_PREALLOC) ? " (no prealloc)" : "");
+    }
+    return 0;
+}
+
+static int seed_fs_rules(struct bpf_object *obj)
+{
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, "fs_rules");
+    if (!map) {
+        fprintf(stderr, "map 'fs_rules' not found\n");
+        return -1;
+    }
+
+    for (int i = 0; i < nr_fs_rules; i++) {
+        struct fs_rule_key key = {};
+        struct fs_rule rule = {};
+        int allow = aid_perm_parse(fs_rules[i].verbs);
+
+        if (aid_fs_rule_key_parse(fs_rules[i].target, &key) < 0 || allow < 0) {
+            fprintf(stderr, "invalid fs_rule '%s %s'\n", fs_rules[i].target, fs_rules[i].verbs);
+            return -1;
+        }
+        rule.allow = (__u8)allow;
+        if (bpf_map_update_elem(bpf_map__fd(map), &key, &rule, BPF_ANY) < 0) {
+            fprintf(stderr, "failed to add fs_rule '%s': %s\n", fs_rules[i].target,
+                    strerror(errno));
+            return -1;
+        }
+        char buf[8];
+        printf("[aid_lsm_loader] fs_rule %s: allow=%s\n", fs_rules[i].target,
+               aid_perm_str(rule.allow, buf));
+    }
+    return 0;
+}
+
+static int seed_suffix_classes(struct bpf_object *obj)
+{
+    struct bpf_map *map = bpf_object__find_map_by_name(obj, "suffix_classes");
+    if (!map) {
+        fprintf(stderr, "map 'suffix_classes' not found\n");
+        return -1;
+    }
+
+    for (int i = 0; i < nr_suffix_classes; i++) {
+        struct suffix_key key;
+        struct suffix_class class = { .sensitive = (__u8)suffix_classes[i].sensitive };
+
+        aid_suffix_key_parse(suffix_classes[i].suffix, AID_SUFFIX_GLOBAL, &key);
+        if (bpf_map_update_elem(bpf_map__fd(map), &key, &class, BPF_ANY) < 0) {
+            fprintf(stderr, "failed to add suffix_class '%s': %s\n", suffix_classes[i].suffix,
+                    strerror(errno));
+            return -1;
+        }
+        printf("[aid_lsm_loader] suffix_class %s: %s\n", suffix_classes[i].suffix,
+               class.sensitive ? "sensitive" : "public");
+    }
+    return 0;
+}
 
 static int libbpf_print_fn(enum libbpf_print_level lvl,
                            const char *fmt, va_list args)
@@ -20,12 +400,41 @@ static int libbpf_print_fn(enum libbpf_print_level lvl,
 
 
 
-int main(void)
+int main(int argc, char **argv)
 {
     struct bpf_object *obj = NULL;
     int err;
     char bpf_obj_path[PATH_MAX];
     char exe_path[PATH_MAX];
+    const char *conf_path = AID_LOADER_CONF;
+    int conf_required = 0;
+    int opt;
+
+    // The config file is read first so -m/-P can override it
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "-c") == 0) {
+            conf_path = argv[i + 1];
+            conf_required = 1;
+        }
+    }
+    if (load_config(conf_path, conf_required) < 0)
+        return 1;
+
+    while ((opt = getopt(argc, argv, "c:m:PBL")) != -1) {
+        switch (opt) {
+        case 'c': break;
+        case 'm':
+            if (parse_setting(optarg) < 0)
+                return 1;
+            break;
+        case 'P': no_prealloc = 1; break;
+        case 'B': use_bloom = 1; break;
+        case 'L': latency_hist = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+        usage(argv[0]);
 
     // Get executable path
     ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
@@ -45,11 +454,12 @@ int main(void)
     }
 
     // Check if map is already pinned
-    if (access(AID_MAP_PATH, F_OK) == 0 || access(AID_NETWORK_MAP_PATH, F_OK) == 0) {
-        fprintf(stderr, "AID LSM already loaded (map exists)\n");
-        fprintf(stderr, "To reload, first run: sudo rm %s %s /sys/fs/bpf/aid_lsm_link\n",
-                AID_MAP_PATH, AID_NETWORK_MAP_PATH);
-        return 1;
+    for (size_t i = 0; i < NR_PINNED_MAPS; i++) {
+        if (access(pinned_maps[i].path, F_OK) == 0) {
+            fprintf(stderr, "AID LSM already loaded (map %s exists)\n", pinned_maps[i].path);
+            fprintf(stderr, "To reload, first run: sudo ./unload_aid.sh\n");
+            return 1;
+        }
     }
 
     // libbpf_set_strict_mode(LIBBPF_STRICT_ALL);
@@ -61,77 +471,139 @@ int main(void)
         return 1;
     }
 
+    if (apply_map_sizing(obj) < 0)
+        return 1;
+
+    for (size_t i = 0; i < NR_LSM_PROGRAMS; i++) {
+        struct bpf_program *prog = bpf_object__find_program_by_name(obj, lsm_programs[i].name);
+        if (prog && lsm_programs[i].labels && !xattr_labels)
+            bpf_program__set_autoload(prog, false);
+    }
+
     err = bpf_object__load(obj);
     if (err) {
         fprintf(stderr, "bpf_object__load failed: %d\n", err);
         return 1;
     }
 
-    // Attach LSM program
-    struct bpf_program *prog;
-    struct bpf_link *link;
-
-    prog = bpf_object__find_program_by_name(obj, "aid_enforce_file_permission");
-    if (!prog) {
-        fprintf(stderr, "Failed to find BPF program 'aid_enforce_file_permission'\n");
+    // Seed runtime defaults before the hook goes live
+    struct bpf_map *cfg_map = bpf_object__find_map_by_name(obj, "aid_config");
+    if (!cfg_map) {
+        fprintf(stderr, "map 'aid_config' not found\n");
         return 1;
     }
 
-    link = bpf_program__attach(prog);
-    err = libbpf_get_error(link);
+    __u32 cfg_key = 0;
+    struct aid_config cfg = {
+        .verbosity = AID_LOG_OFF,
+        .enforce_mode = AID_MODE_ENFORCE,
+        .audit_level = AID_AUDIT_DENY,
+        .audit_rate = AID_AUDIT_DEFAULT_RATE,
+        .audit_burst = AID_AUDIT_DEFAULT_BURST,
+        .verdict_cache = 1,
+        .policy_bloom = (__u32)use_bloom,
+        .latency_hist = (__u32)latency_hist,
+        .flight_recorder = (__u32)flight_recorder,
+        .hh_sample = hh_sample,
+        .policy_store = (__u32)policy_store,
+        .xattr_labels = (__u32)xattr_labels,
+        .specialize = (__u32)specialize,
+    };
+    err = bpf_map_update_elem(bpf_map__fd(cfg_map), &cfg_key, &cfg, BPF_ANY);
     if (err) {
-        fprintf(stderr, "Failed to attach LSM program: %d (%s)\n", err, strerror(-err));
+        fprintf(stderr, "failed to initialize config map: %d\n", err);
         return 1;
     }
 
-    int prog_fd = bpf_program__fd(prog);
-    struct bpf_prog_info info = {};
-    __u32 info_len = sizeof(info);
-
-    err = bpf_obj_get_info_by_fd(prog_fd, &info, &info_len);
-    if (err) {
-        fprintf(stderr, "Warning: failed to get prog info: %d\n", err);
-    }
-
-    printf("[aid_lsm_loader] LSM program attached successfully\n");
-    printf("  Program FD: %d, ID: %u, Type: %u\n", prog_fd, info.id, info.type);
-    printf("  Link: %p\n", link);
-
-    struct bpf_map *map;
+    if (seed_fs_rules(obj) < 0 || seed_suffix_classes(obj) < 0)
+        return 1;
 
-    map = bpf_object__find_map_by_name(obj, "inode_policies");
-    if (!map) {
-        fprintf(stderr, "map 'inode_policies' not found\n");
+    // The specialized programs addagent loads fall back to this one. It is
+    // not attached: the prog array keeps it loaded.
+    struct bpf_program *generic = bpf_object__find_program_by_name(obj,
+                                                                   "aid_file_permission_generic");
+    struct bpf_map *progs_map = bpf_object__find_map_by_name(obj, "agent_progs");
+    __u32 generic_slot = AID_SPEC_GENERIC;
+    int generic_fd = generic ? bpf_program__fd(generic) : -1;
+    if (!progs_map || generic_fd < 0 ||
+        bpf_map_update_elem(bpf_map__fd(progs_map), &generic_slot, &generic_fd, BPF_ANY) < 0) {
+        fprintf(stderr, "failed to install aid_file_permission_generic: %s\n", strerror(errno));
         return 1;
     }
 
-    err = bpf_map__pin(map, AID_MAP_PATH);
-    if (err) {
-        fprintf(stderr, "failed to pin map: %d\n", err);
+    int cgroup_fd = open(AID_CGROUP_ROOT, O_RDONLY | O_DIRECTORY);
+    if (cgroup_fd < 0) {
+        fprintf(stderr, "failed to open %s: %s\n", AID_CGROUP_ROOT, strerror(errno));
         return 1;
     }
 
-    // Pin network_policies map
-    struct bpf_map *net_map = bpf_object__find_map_by_name(obj, "network_policies");
-    if (!net_map) {
-        fprintf(stderr, "map 'network_policies' not found\n");
-        return 1;
+    // Attach LSM and cgroup programs
+    struct bpf_link *links[NR_LSM_PROGRAMS];
+
+    for (size_t i = 0; i < NR_LSM_PROGRAMS; i++) {
+        struct bpf_program *prog = bpf_object__find_program_by_name(obj, lsm_programs[i].name);
+        if (!prog) {
+            fprintf(stderr, "Failed to find BPF program '%s'\n", lsm_programs[i].name);
+            return 1;
+        }
+        links[i] = NULL;
+        if (lsm_programs[i].labels && !xattr_labels)
+            continue;
+
+        if (lsm_programs[i].cgroup)
+            links[i] = bpf_program__attach_cgroup(prog, cgroup_fd);
+        else
+            links[i] = bpf_program__attach(prog);
+        err = libbpf_get_error(links[i]);
+        if (err) {
+            fprintf(stderr, "Failed to attach %s program '%s': %d (%s)\n",
+                    lsm_programs[i].cgroup ? "cgroup" : "LSM", lsm_programs[i].name,
+                    err, strerror(-err));
+            return 1;
+        }
+
+        int prog_fd = bpf_program__fd(prog);
+        struct bpf_prog_info info = {};
+        __u32 info_len = sizeof(info);
+
+        err = bpf_obj_get_info_by_fd(prog_fd, &info, &info_len);
+        if (err) {
+            fprintf(stderr, "Warning: failed to get prog info: %d\n", err);
+        }
+
+        printf("[aid_lsm_loader] %s program '%s' attached successfully\n",
+               lsm_programs[i].cgroup ? "cgroup" : "LSM", lsm_programs[i].name);
+        printf("  Program FD: %d, ID: %u, Type: %u\n", prog_fd, info.id, info.type);
     }
 
-    err = bpf_map__pin(net_map, AID_NETWORK_MAP_PATH);
-    if (err) {
-        fprintf(stderr, "failed to pin network map: %d\n", err);
-        return 1;
+    for (size_t i = 0; i < NR_PINNED_MAPS; i++) {
+        struct bpf_map *map = bpf_object__find_map_by_name(obj, pinned_maps[i].name);
+        if (!map) {
+            fprintf(stderr, "map '%s' not found\n", pinned_maps[i].name);
+            return 1;
+        }
+
+        err = bpf_map__pin(map, pinned_maps[i].path);
+        if (err) {
+            fprintf(stderr, "failed to pin map '%s': %d\n", pinned_maps[i].name, err);
+            return 1;
+        }
     }
 
-    // Pin the link to keep LSM attached
-    err = bpf_link__pin(link, "/sys/fs/bpf/aid_lsm_link");
-    if (err) {
-        fprintf(stderr, "failed to pin link: %d\n", err);
-        return 1;
+    close(cgroup_fd);
+
+    // Pin the links to keep LSM attached
+    for (size_t i = 0; i < NR_LSM_PROGRAMS; i++) {
+        if (!links[i])
+            continue;
+        err = bpf_link__pin(links[i], lsm_programs[i].link_path);
+        if (err) {
+            fprintf(stderr, "failed to pin link %s: %d\n", lsm_programs[i].link_path, err);
+            return 1;
+        }
     }
 
-    printf("[aid_lsm_loader] AID LSM BPF loaded successfully.\n");
+    printf("[aid_lsm_loader] AID LSM BPF loaded successfully (printk off, enforcing; see aid_ctl).\n");
     // LSM BPF is attached to kernel, safe to exit process now.
     return 0;
 }
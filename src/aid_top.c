@@ -0,0 +1,567 @@
+// src/aid_top.c
+#include <errno.h>
+#include <pwd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "../include/aid_shared.h"
+#include "aid_util.h"
+
+#define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
+#define AGENT_USER_PREFIX "agent_"
+
+#define MAX_AGENTS 1024
+#define MAX_PROGS  32
+#define PROG_PREFIX "aid_"
+
+// Column headers for the live view, indexed by AID_REASON_*
+static const char *reason_cols[AID_REASON_MAX] = {
+    [AID_REASON_NO_INODE]      = "noino",
+    [AID_REASON_DEVICE]        = "dev",
+    [AID_REASON_SOCKET]        = "sock",
+    [AID_REASON_SOCKET_DENIED] = "sock!",
+    [AID_REASON_EXEC]          = "exec",
+    [AID_REASON_NOT_SENSITIVE] = "!sens",
+    [AID_REASON_EXEC_BIT]      = "xbit",
+    [AID_REASON_NO_POLICY]     = "nopol",
+    [AID_REASON_READ_DENIED]   = "rd!",
+    [AID_REASON_WRITE_DENIED]  = "wr!",
+    [AID_REASON_POLICY_MATCH]  = "match",
+    [AID_REASON_EXEC_DENIED]   = "exec!",
+    [AID_REASON_TRUNC_DENIED]  = "trunc!",
+    [AID_REASON_CREATE_DENIED] = "creat!",
+    [AID_REASON_UNLINK_DENIED] = "unlnk!",
+    [AID_REASON_FS_MATCH]      = "fs",
+    [AID_REASON_FS_DENIED]     = "fs!",
+    [AID_REASON_INHERIT_FULL]  = "inh!",
+};
+
+struct agent_row {
+    uint32_t uid;
+    uint64_t count[AID_REASON_MAX];
+};
+
+struct map_usage {
+    const char *name;
+    const char *path;
+    uint32_t entries;
+    uint32_t max_entries;
+    long memlock;       // bytes charged to the map, -1 if unknown
+    int inner;          // sum over the inner maps of the hash of maps at path
+};
+
+// Kernel statistics of one loaded AID program
+struct prog_row {
+    char name[BPF_OBJ_NAME_LEN];
+    uint32_t verified_insns;
+    uint32_t jited_len;
+    uint64_t run_cnt;       // only counted while BPF run-time stats are enabled
+    uint64_t run_time_ns;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s [-i seconds] [-n iterations] [-o | -H]\n", prog);
+    fprintf(stderr, "Live per-agent hook decision rates and map occupancy/memory\n");
+    fprintf(stderr, "  -i  refresh interval (default 1)\n");
+    fprintf(stderr, "  -n  stop after n refreshes (default: run forever)\n");
+    fprintf(stderr, "  -o  print one OpenMetrics text snapshot and exit\n");
+    fprintf(stderr, "  -H  hook cost: file_permission latency per exit reason (aid_ctl latency on)\n");
+    fprintf(stderr, "      and run count/time, JIT size, verified insns of each program, with\n");
+    fprintf(stderr, "      BPF run-time stats enabled for one interval\n");
+    exit(1);
+}
+
+static const char *agent_name(uint32_t uid)
+{
+    struct passwd *pw = getpwuid(uid);
+    if (!pw)
+        return "?";
+    if (strncmp(pw->pw_name, AGENT_USER_PREFIX, strlen(AGENT_USER_PREFIX)) == 0)
+        return pw->pw_name + strlen(AGENT_USER_PREFIX);
+    return pw->pw_name;
+}
+
+// Sum every CPU's counters for every agent in the verdict_stats map
+static int read_stats(int map_fd, struct agent_row *rows, int max_rows)
+{
+    int ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0)
+        return -1;
+
+    struct aid_verdict_stats *percpu = calloc(ncpus, sizeof(*percpu));
+    if (!percpu)
+        return -1;
+
+    uint32_t key, next_key;
+    uint32_t *prev = NULL;
+    int n = 0;
+
+    while (n < max_rows && bpf_map_get_next_key(map_fd, prev, &next_key) == 0) {
+        if (bpf_map_lookup_elem(map_fd, &next_key, percpu) == 0) {
+            struct agent_row *row = &rows[n++];
+            memset(row, 0, sizeof(*row));
+            row->uid = next_key;
+            for (int cpu = 0; cpu < ncpus; cpu++) {
+                for (int r = 0; r < AID_REASON_MAX; r++)
+                    row->count[r] += percpu[cpu].count[r];
+            }
+        }
+        key = next_key;
+        prev = &key;
+    }
+
+    free(percpu);
+    return n;
+}
+
+// Kernel memory charged to a map, from /proc/self/fdinfo
+static long map_memlock(int fd)
+{
+    char path[64], line[128];
+    long memlock = -1;
+
+    snprintf(path, sizeof(path), "/proc/self/fdinfo/%d", fd);
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "memlock: %ld", &memlock) == 1)
+            break;
+    }
+    fclose(f);
+    return memlock;
+}
+
+static void count_usage(int fd, struct map_usage *m)
+{
+    struct bpf_map_info info = {};
+    uint32_t info_len = sizeof(info);
+    if (bpf_obj_get_info_by_fd(fd, &info, &info_len) == 0)
+        m->max_entries += info.max_entries;
+
+    char key[64], next_key[64];
+    void *prev = NULL;
+    if (info.key_size <= sizeof(key)) {
+        while (bpf_map_get_next_key(fd, prev, next_key) == 0) {
+            m->entries++;
+            memcpy(key, next_key, info.key_size);
+            prev = key;
+        }
+    }
+}
+
+static void read_usage(struct map_usage *m)
+{
+    m->entries = 0;
+    m->max_entries = 0;
+    m->memlock = -1;
+
+    int fd = bpf_obj_get(m->path);
+    if (fd < 0)
+        return;
+
+    if (!m->inner) {
+        m->memlock = map_memlock(fd);
+        count_usage(fd, m);
+        close(fd);
+        return;
+    }
+
+    // Outer map of uid -> inner map id: total over every agent's map
+    uint32_t uid, next_uid, *prev = NULL, inner_id;
+    m->memlock = 0;
+    while (bpf_map_get_next_key(fd, prev, &next_uid) == 0) {
+        uid = next_uid;
+        prev = &uid;
+        if (bpf_map_lookup_elem(fd, &uid, &inner_id) < 0)
+            continue;
+        int inner_fd = bpf_map_get_fd_by_id(inner_id);
+        if (inner_fd < 0)
+            continue;
+        m->memlock += map_memlock(inner_fd);
+        count_usage(inner_fd, m);
+        close(inner_fd);
+    }
+    close(fd);
+}
+
+// Every loaded program whose name starts with "aid_"
+static int read_progs(struct prog_row *out, int max)
+{
+    uint32_t id = 0;
+    int n = 0;
+
+    while (n < max && bpf_prog_get_next_id(id, &id) == 0) {
+        int fd = bpf_prog_get_fd_by_id(id);
+        if (fd < 0)
+            continue;
+
+        struct bpf_prog_info info = {};
+        uint32_t info_len = sizeof(info);
+        if (bpf_obj_get_info_by_fd(fd, &info, &info_len) == 0 &&
+            strncmp(info.name, PROG_PREFIX, strlen(PROG_PREFIX)) == 0) {
+            struct prog_row *p = &out[n++];
+            memcpy(p->name, info.name, sizeof(p->name));
+            p->verified_insns = info.verified_insns;
+            p->jited_len = info.jited_prog_len;
+            p->run_cnt = info.run_cnt;
+            p->run_time_ns = info.run_time_ns;
+        }
+        close(fd);
+    }
+    return n;
+}
+
+// Sum every CPU's file_permission histogram of each exit reason; -1 if the
+// map is not there
+static int read_latency(struct aid_latency_hist *hist)
+{
+    int fd = bpf_obj_get(AID_LATENCY_MAP_PATH);
+    if (fd < 0)
+        return -1;
+
+    int ncpus = libbpf_num_possible_cpus();
+    struct aid_latency_hist *percpu = ncpus > 0 ? calloc(ncpus, sizeof(*percpu)) : NULL;
+    if (!percpu) {
+        close(fd);
+        return -1;
+    }
+
+    memset(hist, 0, sizeof(*hist) * AID_REASON_MAX);
+    for (uint32_t r = 0; r < AID_REASON_MAX; r++) {
+        if (bpf_map_lookup_elem(fd, &r, percpu) < 0)
+            continue;
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            for (int i = 0; i < AID_HIST_SLOTS; i++)
+                hist[r].slot[i] += percpu[cpu].slot[i];
+            hist[r].total_ns += percpu[cpu].total_ns;
+        }
+    }
+
+    free(percpu);
+    close(fd);
+    return 0;
+}
+
+static uint64_t hist_count(const struct aid_latency_hist *h)
+{
+    uint64_t n = 0;
+    for (int i = 0; i < AID_HIST_SLOTS; i++)
+        n += h->slot[i];
+    return n;
+}
+
+// Upper bound (ns) of the slot holding quantile q
+static uint64_t hist_quantile(const struct aid_latency_hist *h, double q)
+{
+    uint64_t n = hist_count(h), seen = 0;
+    for (int i = 0; i < AID_HIST_SLOTS; i++) {
+        seen += h->slot[i];
+        if (seen && seen >= q * n)
+            return 2ULL << i;
+    }
+    return 0;
+}
+
+static void print_hist_bars(const struct aid_latency_hist *h)
+{
+    uint64_t max = 0;
+    int first = -1, last = -1;
+
+    for (int i = 0; i < AID_HIST_SLOTS; i++) {
+        if (!h->slot[i])
+            continue;
+        if (first < 0)
+            first = i;
+        last = i;
+        if (h->slot[i] > max)
+            max = h->slot[i];
+    }
+    for (int i = first; i >= 0 && i <= last; i++) {
+        int width = (int)(40 * h->slot[i] / max);
+        printf("  [%8llu, %8llu) %10llu |%-40.*s|\n", 1ULL << i, 2ULL << i,
+               (unsigned long long)h->slot[i], width,
+               "****************************************");
+    }
+}
+
+// aid_top -H: cumulative latency histograms, and each program's kernel
+// run-time stats over one interval
+static int print_latency_report(double interval, const struct timespec *ts)
+{
+    static struct aid_latency_hist hist[AID_REASON_MAX];
+    static struct prog_row before[MAX_PROGS], after[MAX_PROGS];
+
+    // Run-time stats stay enabled only while this fd is open
+    int stats_fd = bpf_enable_stats(BPF_STATS_RUN_TIME);
+    if (stats_fd < 0) {
+        fprintf(stderr, "[aid_top] bpf_enable_stats failed: %s (run as root)\n", strerror(errno));
+        return 1;
+    }
+    int nbefore = read_progs(before, MAX_PROGS);
+    nanosleep(ts, NULL);
+    int nafter = read_progs(after, MAX_PROGS);
+    close(stats_fd);
+
+    printf("AID programs (run-time stats over %.1fs)\n", interval);
+    printf("  %-16s %9s %9s %12s %9s %8s\n", "program", "verified", "jited", "runs", "ns/run", "cpu%");
+    for (int i = 0; i < nafter; i++) {
+        uint64_t cnt = after[i].run_cnt, time_ns = after[i].run_time_ns;
+        for (int j = 0; j < nbefore; j++) {
+            if (strcmp(before[j].name, after[i].name) == 0) {
+                cnt -= before[j].run_cnt;
+                time_ns -= before[j].run_time_ns;
+                break;
+            }
+        }
+        printf("  %-16s %9u %9u %12llu %9.1f %7.3f%%\n", after[i].name,
+               after[i].verified_insns, after[i].jited_len, (unsigned long long)cnt,
+               cnt ? (double)time_ns / cnt : 0.0, 100.0 * time_ns / (interval * 1e9));
+    }
+    printf("\n");
+
+    if (read_latency(hist) < 0) {
+        printf("(no %s)\n", AID_LATENCY_MAP_PATH);
+        return 0;
+    }
+
+    struct aid_latency_hist all = {};
+    printf("file_permission latency by exit reason (since load, while aid_ctl latency on)\n");
+    printf("  %-14s %12s %9s %9s %9s %9s\n", "reason", "count", "mean_ns", "p50<=", "p90<=", "p99<=");
+    for (int r = 0; r < AID_REASON_MAX; r++) {
+        uint64_t n = hist_count(&hist[r]);
+        if (!n)
+            continue;
+        printf("  %-14s %12llu %9.1f %9llu %9llu %9llu\n", aid_reason_name(r),
+               (unsigned long long)n, (double)hist[r].total_ns / n,
+               (unsigned long long)hist_quantile(&hist[r], 0.5),
+               (unsigned long long)hist_quantile(&hist[r], 0.9),
+               (unsigned long long)hist_quantile(&hist[r], 0.99));
+        for (int i = 0; i < AID_HIST_SLOTS; i++)
+            all.slot[i] += hist[r].slot[i];
+        all.total_ns += hist[r].total_ns;
+    }
+    if (!hist_count(&all)) {
+        printf("  (no samples: aid_ctl latency on)\n");
+        return 0;
+    }
+    printf("\n  all reasons, ns:\n");
+    print_hist_bars(&all);
+    return 0;
+}
+
+static const struct agent_row *find_row(const struct agent_row *rows, int n, uint32_t uid)
+{
+    for (int i = 0; i < n; i++) {
+        if (rows[i].uid == uid)
+            return &rows[i];
+    }
+    return NULL;
+}
+
+static void print_openmetrics(const struct agent_row *rows, int n,
+                              const struct map_usage *maps, int nmaps)
+{
+    printf("# TYPE aid_verdicts counter\n");
+    printf("# HELP aid_verdicts AID hook decisions per agent and exit reason.\n");
+    for (int i = 0; i < n; i++) {
+        const char *name = agent_name(rows[i].uid);
+        for (int r = 0; r < AID_REASON_MAX; r++) {
+            printf("aid_verdicts_total{uid=\"%u\",agent=\"%s\",reason=\"%s\"} %llu\n",
+                   rows[i].uid, name, aid_reason_name(r),
+                   (unsigned long long)rows[i].count[r]);
+        }
+    }
+
+    printf("# TYPE aid_map_entries gauge\n");
+    printf("# HELP aid_map_entries Entries currently in an AID map.\n");
+    for (int i = 0; i < nmaps; i++)
+        printf("aid_map_entries{map=\"%s\"} %u\n", maps[i].name, maps[i].entries);
+
+    printf("# TYPE aid_map_max_entries gauge\n");
+    printf("# HELP aid_map_max_entries Capacity of an AID map.\n");
+    for (int i = 0; i < nmaps; i++)
+        printf("aid_map_max_entries{map=\"%s\"} %u\n", maps[i].name, maps[i].max_entries);
+
+    printf("# TYPE aid_map_memlock_bytes gauge\n");
+    printf("# UNIT aid_map_memlock_bytes bytes\n");
+    printf("# HELP aid_map_memlock_bytes Kernel memory charged to an AID map.\n");
+    for (int i = 0; i < nmaps; i++) {
+        if (maps[i].memlock >= 0)
+            printf("aid_map_memlock_bytes{map=\"%s\"} %ld\n", maps[i].name, maps[i].memlock);
+    }
+
+    static struct aid_latency_hist hist[AID_REASON_MAX];
+    if (read_latency(hist) == 0) {
+        printf("# TYPE aid_hook_latency_seconds histogram\n");
+        printf("# UNIT aid_hook_latency_seconds seconds\n");
+        printf("# HELP aid_hook_latency_seconds file_permission duration per exit reason.\n");
+        for (int r = 0; r < AID_REASON_MAX; r++) {
+            uint64_t cum = 0;
+            for (int i = 0; i < AID_HIST_SLOTS - 1; i++) {
+                cum += hist[r].slot[i];
+                printf("aid_hook_latency_seconds_bucket{reason=\"%s\",le=\"%g\"} %llu\n",
+                       aid_reason_name(r), (double)(2ULL << i) / 1e9, (unsigned long long)cum);
+            }
+            cum += hist[r].slot[AID_HIST_SLOTS - 1];
+            printf("aid_hook_latency_seconds_bucket{reason=\"%s\",le=\"+Inf\"} %llu\n",
+                   aid_reason_name(r), (unsigned long long)cum);
+            printf("aid_hook_latency_seconds_count{reason=\"%s\"} %llu\n",
+                   aid_reason_name(r), (unsigned long long)cum);
+            printf("aid_hook_latency_seconds_sum{reason=\"%s\"} %.9f\n",
+                   aid_reason_name(r), hist[r].total_ns / 1e9);
+        }
+    }
+
+    // run_cnt/run_time_ns only grow while kernel.bpf_stats_enabled is set
+    static struct prog_row progs[MAX_PROGS];
+    int nprogs = read_progs(progs, MAX_PROGS);
+    printf("# TYPE aid_prog_verified_insns gauge\n");
+    printf("# HELP aid_prog_verified_insns Instructions the verifier processed for an AID program.\n");
+    for (int i = 0; i < nprogs; i++)
+        printf("aid_prog_verified_insns{prog=\"%s\"} %u\n", progs[i].name, progs[i].verified_insns);
+    printf("# TYPE aid_prog_jited_bytes gauge\n");
+    printf("# UNIT aid_prog_jited_bytes bytes\n");
+    printf("# HELP aid_prog_jited_bytes JIT-compiled image size of an AID program.\n");
+    for (int i = 0; i < nprogs; i++)
+        printf("aid_prog_jited_bytes{prog=\"%s\"} %u\n", progs[i].name, progs[i].jited_len);
+    printf("# TYPE aid_prog_runs counter\n");
+    printf("# HELP aid_prog_runs Runs of an AID program while BPF stats were enabled.\n");
+    for (int i = 0; i < nprogs; i++)
+        printf("aid_prog_runs_total{prog=\"%s\"} %llu\n", progs[i].name,
+               (unsigned long long)progs[i].run_cnt);
+    printf("# TYPE aid_prog_run_time_seconds counter\n");
+    printf("# UNIT aid_prog_run_time_seconds seconds\n");
+    printf("# HELP aid_prog_run_time_seconds Time spent in an AID program while BPF stats were enabled.\n");
+    for (int i = 0; i < nprogs; i++)
+        printf("aid_prog_run_time_seconds_total{prog=\"%s\"} %.9f\n", progs[i].name,
+               progs[i].run_time_ns / 1e9);
+
+    printf("# EOF\n");
+}
+
+static void print_live(const struct agent_row *rows, int n,
+                       const struct agent_row *prev, int nprev, double interval,
+                       const struct map_usage *maps, int nmaps)
+{
+    char tbuf[32];
+    time_t now = time(NULL);
+    struct tm tm;
+    localtime_r(&now, &tm);
+    strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", &tm);
+
+    // Clear screen and home cursor
+    printf("\033[H\033[2J");
+    printf("AID top - %s  (interval %.1fs, rates per second)\n\n", tbuf, interval);
+
+    for (int i = 0; i < nmaps; i++) {
+        printf("%-18s %8u / %-8u (%5.1f%%)  memlock %ld KiB\n", maps[i].name,
+               maps[i].entries, maps[i].max_entries,
+               maps[i].max_entries ? 100.0 * maps[i].entries / maps[i].max_entries : 0.0,
+               maps[i].memlock >= 0 ? maps[i].memlock / 1024 : -1);
+    }
+    printf("\n");
+
+    printf("%-6s %-14s %9s", "UID", "AGENT", "TOTAL");
+    for (int r = 0; r < AID_REASON_MAX; r++)
+        printf(" %7s", reason_cols[r]);
+    printf("\n");
+
+    for (int i = 0; i < n; i++) {
+        const struct agent_row *old = find_row(prev, nprev, rows[i].uid);
+        double rate[AID_REASON_MAX];
+        double total = 0;
+
+        for (int r = 0; r < AID_REASON_MAX; r++) {
+            uint64_t before = old ? old->count[r] : 0;
+            rate[r] = (rows[i].count[r] - before) / interval;
+            total += rate[r];
+        }
+
+        printf("%-6u %-14.14s %9.0f", rows[i].uid, agent_name(rows[i].uid), total);
+        for (int r = 0; r < AID_REASON_MAX; r++)
+            printf(" %7.0f", rate[r]);
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv)
+{
+    double interval = 1.0;
+    long iterations = 0;
+    int openmetrics = 0;
+    int latency = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "i:n:oH")) != -1) {
+        switch (opt) {
+        case 'i': interval = atof(optarg); break;
+        case 'n': iterations = atol(optarg); break;
+        case 'o': openmetrics = 1; break;
+        case 'H': latency = 1; break;
+        default: usage(argv[0]);
+        }
+    }
+    if (optind != argc || interval <= 0 || (openmetrics && latency))
+        usage(argv[0]);
+
+    struct timespec ts = {
+        .tv_sec = (time_t)interval,
+        .tv_nsec = (long)((interval - (time_t)interval) * 1e9),
+    };
+
+    if (latency)
+        return print_latency_report(interval, &ts);
+
+    int stats_fd = bpf_obj_get(AID_STATS_MAP_PATH);
+    if (stats_fd < 0) {
+        fprintf(stderr, "bpf_obj_get(%s) failed: %s\n", AID_STATS_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    struct map_usage maps[] = {
+        { "inode_policies",   AID_MAP_PATH },             // agents
+        { "agent_policies",   AID_MAP_PATH, .inner = 1 }, // their entries
+        { "verdict_stats",    AID_STATS_MAP_PATH },
+    };
+    int nmaps = sizeof(maps) / sizeof(maps[0]);
+
+    static struct agent_row rows[MAX_AGENTS], prev[MAX_AGENTS];
+    int n = read_stats(stats_fd, rows, MAX_AGENTS);
+    if (n < 0) {
+        fprintf(stderr, "[aid_top] failed to read %s\n", AID_STATS_MAP_PATH);
+        return 1;
+    }
+
+    if (openmetrics) {
+        for (int i = 0; i < nmaps; i++)
+            read_usage(&maps[i]);
+        print_openmetrics(rows, n, maps, nmaps);
+        close(stats_fd);
+        return 0;
+    }
+
+    for (long it = 0; iterations == 0 || it < iterations; it++) {
+        memcpy(prev, rows, sizeof(rows[0]) * n);
+        int nprev = n;
+
+        nanosleep(&ts, NULL);
+
+        n = read_stats(stats_fd, rows, MAX_AGENTS);
+        if (n < 0)
+            break;
+        for (int i = 0; i < nmaps; i++)
+            read_usage(&maps[i]);
+        print_live(rows, n, prev, nprev, interval, maps, nmaps);
+    }
+
+    close(stats_fd);
+    return 0;
+}
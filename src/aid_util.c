@@ -0,0 +1,175 @@
+// src/aid_util.c
+// Userspace helpers the tools share: names and parsers for the values in
+// include/aid_shared.h.
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "aid_util.h"
+
+void aid_policy_key_stat(struct inode_key *key, const struct stat *st)
+{
+    aid_policy_key(key, st->st_ino, AID_KDEV(major(st->st_dev), minor(st->st_dev)));
+}
+
+const char *aid_reason_name(unsigned int reason)
+{
+    static const char *const names[AID_REASON_MAX] = {
+        [AID_REASON_NO_INODE]      = "no_inode",
+        [AID_REASON_DEVICE]        = "device",
+        [AID_REASON_SOCKET]        = "socket",
+        [AID_REASON_SOCKET_DENIED] = "socket_denied",
+        [AID_REASON_EXEC]          = "exec",
+        [AID_REASON_NOT_SENSITIVE] = "not_sensitive",
+        [AID_REASON_EXEC_BIT]      = "exec_bit",
+        [AID_REASON_NO_POLICY]     = "no_policy",
+        [AID_REASON_READ_DENIED]   = "read_denied",
+        [AID_REASON_WRITE_DENIED]  = "write_denied",
+        [AID_REASON_POLICY_MATCH]  = "policy_match",
+        [AID_REASON_EXEC_DENIED]   = "exec_denied",
+        [AID_REASON_TRUNC_DENIED]  = "truncate_denied",
+        [AID_REASON_CREATE_DENIED] = "create_denied",
+        [AID_REASON_UNLINK_DENIED] = "unlink_denied",
+        [AID_REASON_FS_MATCH]      = "fs_match",
+        [AID_REASON_FS_DENIED]     = "fs_denied",
+        [AID_REASON_INHERIT_FULL]  = "inherit_full",
+    };
+    return reason < AID_REASON_MAX ? names[reason] : "unknown";
+}
+
+const char *aid_perm_str(uint8_t allow, char buf[8])
+{
+    static const struct { uint8_t bit; char c; } verbs[7] = {
+        { AID_PERM_READ, 'r' }, { AID_PERM_WRITE, 'w' }, { AID_PERM_APPEND, 'a' },
+        { AID_PERM_TRUNCATE, 't' }, { AID_PERM_CREATE, 'c' }, { AID_PERM_UNLINK, 'u' },
+        { AID_PERM_EXEC, 'x' },
+    };
+    for (int i = 0; i < 7; i++)
+        buf[i] = (allow & verbs[i].bit) ? verbs[i].c : '-';
+    buf[7] = '\0';
+    return buf;
+}
+
+int aid_perm_parse(const char *s)
+{
+    static const char letters[] = "rwatcux";
+    static const uint8_t bits[] = {
+        AID_PERM_READ, AID_PERM_WRITE, AID_PERM_APPEND, AID_PERM_TRUNCATE,
+        AID_PERM_CREATE, AID_PERM_UNLINK, AID_PERM_EXEC,
+    };
+    int allow = 0;
+
+    for (; *s; s++) {
+        if (*s == '-')
+            continue;
+        const char *c = strchr(letters, *s);
+        if (!c)
+            return -1;
+        allow |= bits[c - letters];
+    }
+    return allow;
+}
+
+// Filesystem names fs rules accept in place of a magic number
+static const struct {
+    const char *name;
+    uint32_t magic;
+} aid_fs_names[] = {
+    { "pipefs",   0x50495045 },   // PIPEFS_MAGIC
+    { "sockfs",   0x534f434b },   // SOCKFS_MAGIC
+    { "anon_inodefs", 0x09041934 },
+    { "proc",     0x9fa0 },       // PROC_SUPER_MAGIC
+    { "sysfs",    0x62656572 },
+    { "tmpfs",    0x01021994 },
+    { "devpts",   0x1cd1 },
+    { "cgroup2",  0x63677270 },
+    { "debugfs",  0x64626720 },
+    { "tracefs",  0x74726163 },
+    { "securityfs", 0x73636673 },
+    { "bpf",      0xcafe4a11 },
+};
+
+const char *aid_fs_name(uint32_t magic)
+{
+    for (size_t i = 0; i < sizeof(aid_fs_names) / sizeof(aid_fs_names[0]); i++) {
+        if (aid_fs_names[i].magic == magic)
+            return aid_fs_names[i].name;
+    }
+    return NULL;
+}
+
+int aid_fs_rule_key_parse(const char *target, struct fs_rule_key *key)
+{
+    if (target[0] == '/') {
+        struct stat st;
+        if (stat(target, &st) < 0)
+            return -1;
+        key->kind = AID_FS_KIND_DEV;
+        key->id = AID_KDEV(major(st.st_dev), minor(st.st_dev));
+        return 0;
+    }
+
+    key->kind = AID_FS_KIND_MAGIC;
+    if (strncmp(target, "0x", 2) == 0) {
+        char *end;
+        unsigned long magic = strtoul(target, &end, 16);
+        if (*end != '\0' || magic > 0xffffffffUL)
+            return -1;
+        key->id = (uint32_t)magic;
+        return 0;
+    }
+    for (size_t i = 0; i < sizeof(aid_fs_names) / sizeof(aid_fs_names[0]); i++) {
+        if (strcmp(target, aid_fs_names[i].name) == 0) {
+            key->id = aid_fs_names[i].magic;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int aid_suffix_key_parse(const char *suffix, uint32_t uid, struct suffix_key *key)
+{
+    size_t len = strlen(suffix);
+
+    if (suffix[0] != '.' || len > AID_SUFFIX_LEN || strchr(suffix + 1, '.'))
+        return -1;
+    memset(key, 0, sizeof(*key));
+    key->uid = uid;
+    memcpy(key->suffix, suffix, len);
+    return 0;
+}
+
+int aid_label_key_parse(const char *label, uint32_t uid, struct label_key *key)
+{
+    size_t len = strlen(label);
+
+    if (len == 0 || len > AID_LABEL_LEN ||
+        strspn(label, "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789._-") != len)
+        return -1;
+    memset(key, 0, sizeof(*key));
+    key->uid = uid;
+    memcpy(key->label, label, len);
+    return 0;
+}
+
+const char *aid_net_rule_str(const struct net_rule_key *key, char *buf, size_t len)
+{
+    static const uint8_t v4_mapped[12] = { [10] = 0xff, [11] = 0xff };
+    char addr[INET6_ADDRSTRLEN];
+    unsigned int bits = key->prefixlen - AID_NET_PREFIX_BASE;
+    char port[8] = "*";
+
+    if (key->port)
+        snprintf(port, sizeof(port), "%u", key->port);
+    if (bits >= AID_NET_V4_BITS && memcmp(key->addr, v4_mapped, sizeof(v4_mapped)) == 0) {
+        inet_ntop(AF_INET, &key->addr[12], addr, sizeof(addr));
+        snprintf(buf, len, "%s/%u:%s", addr, bits - AID_NET_V4_BITS, port);
+    } else {
+        inet_ntop(AF_INET6, key->addr, addr, sizeof(addr));
+        snprintf(buf, len, "[%s]/%u:%s", addr, bits, port);
+    }
+    return buf;
+}
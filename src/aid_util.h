@@ -0,0 +1,38 @@
+// src/aid_util.h
+// Userspace helpers the tools share (src/aid_util.c)
+#ifndef AID_UTIL_H
+#define AID_UTIL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+#include "../include/aid_shared.h"
+
+// Policy key for a file the tools stat()ed
+void aid_policy_key_stat(struct inode_key *key, const struct stat *st);
+
+const char *aid_reason_name(unsigned int reason);
+
+// "rwatcux" with '-' for each verb not granted
+const char *aid_perm_str(uint8_t allow, char buf[8]);
+// Inverse of aid_perm_str: letters of "rwatcux" in any order, '-' ignored;
+// -1 on any other character
+int aid_perm_parse(const char *s);
+
+// Name of a filesystem magic fs rules accept, NULL if it has none
+const char *aid_fs_name(uint32_t magic);
+// fs rule target: a filesystem name, a 0x magic number, or a path whose
+// mounted device the rule covers. -1 if it is none of those.
+int aid_fs_rule_key_parse(const char *target, struct fs_rule_key *key);
+
+// suffix_classes key for ".ext"; -1 unless it is a '.' and at most
+// AID_SUFFIX_LEN bytes with no other '.'
+int aid_suffix_key_parse(const char *suffix, uint32_t uid, struct suffix_key *key);
+// label_rules key; -1 unless label is 1..AID_LABEL_LEN of [A-Za-z0-9._-]
+int aid_label_key_parse(const char *label, uint32_t uid, struct label_key *key);
+
+// "addr/bits:port" of a net_rules key, IPv4-mapped entries as plain IPv4
+const char *aid_net_rule_str(const struct net_rule_key *key, char *buf, size_t len);
+
+#endif // AID_UTIL_H
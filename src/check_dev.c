@@ -3,6 +3,8 @@
 #include <sys/stat.h>
 #include <sys/sysmacros.h>
 
+#include "../include/aid_shared.h"
+
 int main(int argc, char **argv)
 {
     if (argc != 2) {
@@ -23,6 +25,9 @@ int main(int argc, char **argv)
     printf("Major:           %u\n", major(st.st_dev));
     printf("Minor:           %u\n", minor(st.st_dev));
     printf("st_ino:          %llu\n", (unsigned long long)st.st_ino);
+    printf("AID key dev:     %u (0x%x, kernel encoding)\n",
+           AID_KDEV(major(st.st_dev), minor(st.st_dev)),
+           AID_KDEV(major(st.st_dev), minor(st.st_dev)));
 
     return 0;
 }
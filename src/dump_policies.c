@@ -1,15 +1,140 @@
 // src/dump_policies.c
 #include <stdio.h>
 #include <errno.h>
+#include <pwd.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <bpf/bpf.h>
 #include <bpf/libbpf.h>
 #include "../include/aid_shared.h"
+#include "aid_util.h"
 
 #define AID_MAP_PATH "/sys/fs/bpf/aid_inode_policies"
+#define AGENT_USER_PREFIX "agent_"
 
-int main(void)
+static const char *verdict_names[] = { "allow", "deny", "permissive" };
+
+struct recent {
+    struct aid_flight_rec rec;
+    int cpu;
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "Usage: %s                            every agent's policy entries\n", prog);
+    fprintf(stderr, "       %s --recent [agentname|uid]   last decisions of the flight recorder\n", prog);
+    exit(1);
+}
+
+static int64_t clock_ns(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int cmp_ts(const void *a, const void *b)
+{
+    uint64_t x = ((const struct recent *)a)->rec.ts_ns;
+    uint64_t y = ((const struct recent *)b)->rec.ts_ns;
+    return (x > y) - (x < y);
+}
+
+// Merge every CPU's ring into one timeline, oldest first. uid 0: all agents.
+static int dump_recent(uint32_t uid)
+{
+    int fd = bpf_obj_get(AID_FLIGHT_MAP_PATH);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open map at %s: %s\n", AID_FLIGHT_MAP_PATH, strerror(errno));
+        return 1;
+    }
+
+    int ncpus = libbpf_num_possible_cpus();
+    if (ncpus <= 0) {
+        close(fd);
+        return 1;
+    }
+    struct aid_flight_rec *percpu = calloc(ncpus, sizeof(*percpu));
+    struct recent *all = calloc((size_t)ncpus * AID_FLIGHT_LEN, sizeof(*all));
+    if (!percpu || !all) {
+        close(fd);
+        return 1;
+    }
+
+    size_t n = 0;
+    for (uint32_t idx = 0; idx < AID_FLIGHT_LEN; idx++) {
+        if (bpf_map_lookup_elem(fd, &idx, percpu) < 0)
+            continue;
+        for (int cpu = 0; cpu < ncpus; cpu++) {
+            if (!percpu[cpu].ts_ns || (uid && percpu[cpu].uid != uid))
+                continue;
+            all[n].rec = percpu[cpu];
+            all[n].cpu = cpu;
+            n++;
+        }
+    }
+    close(fd);
+    qsort(all, n, sizeof(*all), cmp_ts);
+
+    int64_t boot_to_real = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_BOOTTIME);
+    printf("%-15s %-3s %-6s %-7s %-9s %-12s %-5s %-14s %s\n",
+           "TIME", "CPU", "UID", "PID", "DEV", "INO", "MASK", "REASON", "VERDICT");
+    for (size_t i = 0; i < n; i++) {
+        const struct aid_flight_rec *r = &all[i].rec;
+        int64_t real = (int64_t)r->ts_ns + boot_to_real;
+        time_t sec = real / 1000000000LL;
+        struct tm tm;
+        char tbuf[16], dev[16], ino[24], verbs[8];
+
+        localtime_r(&sec, &tm);
+        strftime(tbuf, sizeof(tbuf), "%H:%M:%S", &tm);
+        if (r->reason == AID_REASON_SOCKET_DENIED) {
+            // Network decisions: no inode, mask is the destination port
+            snprintf(dev, sizeof(dev), "-");
+            snprintf(ino, sizeof(ino), "-");
+            snprintf(verbs, sizeof(verbs), "%u", r->mask);
+        } else {
+            snprintf(dev, sizeof(dev), "%u:%u", r->dev >> 20, r->dev & 0xfffff);
+            snprintf(ino, sizeof(ino), "%llu", (unsigned long long)r->ino);
+            aid_perm_str((uint8_t)r->mask, verbs);
+        }
+        printf("%s.%06ld %-3d %-6u %-7u %-9s %-12s %-5s %-14s %s\n", tbuf,
+               (long)(real % 1000000000LL) / 1000, all[i].cpu, r->uid, r->pid, dev,
+               ino, verbs,
+               aid_reason_name(r->reason),
+               r->verdict < 3 ? verdict_names[r->verdict] : "?");
+    }
+    printf("%zu decisions (%d CPUs x %d slots)\n", n, ncpus, AID_FLIGHT_LEN);
+
+    free(percpu);
+    free(all);
+    return 0;
+}
+
+// Accept either a numeric uid or an agent name (agent_<name>)
+static int resolve_uid(const char *arg, uint32_t *uid)
+{
+    char *end;
+    unsigned long v = strtoul(arg, &end, 10);
+    if (*arg && *end == '\0') {
+        *uid = (uint32_t)v;
+        return 0;
+    }
+
+    char username[256];
+    snprintf(username, sizeof(username), "%s%s", AGENT_USER_PREFIX, arg);
+    struct passwd *pw = getpwnam(username);
+    if (!pw) {
+        fprintf(stderr, "No such agent '%s'\n", arg);
+        return -1;
+    }
+    *uid = pw->pw_uid;
+    return 0;
+}
+
+static int dump_policy_map(void)
 {
     int map_fd = bpf_obj_get(AID_MAP_PATH);
     if (map_fd < 0) {
@@ -19,31 +144,69 @@ int main(void)
     }
 
     printf("Dumping policies from %s:\n", AID_MAP_PATH);
-    printf("%-6s %-20s %-20s %-6s %-6s\n",
-           "UID", "DEV", "INO", "READ", "WRITE");
-    printf("---------------------------------------------------------------\n");
-
-    struct inode_uid_key key = {0}, next_key;
-    struct file_perm perm;
-    int count = 0;
-
-    // Iterate through all entries
-    while (bpf_map_get_next_key(map_fd, &key, &next_key) == 0) {
-        if (bpf_map_lookup_elem(map_fd, &next_key, &perm) == 0) {
-            printf("%-6u %-20llu %-20llu %-6d %-6d\n",
-                   next_key.uid,
-                   (unsigned long long)next_key.dev,
-                   (unsigned long long)next_key.ino,
-                   perm.allow_read,
-                   perm.allow_write);
-            count++;
+    printf("%-6s %-12s %-20s %-8s %-7s %-9s %-10s %s\n",
+           "UID", "DEV", "INO", "ALLOW", "SUBTREE", "INHERITED", "HITS", "IDLE");
+    printf("-------------------------------------------------------------------------------------\n");
+
+    // last_use is in CLOCK_BOOTTIME seconds, like the hook's clock
+    uint32_t now = (uint32_t)(clock_ns(CLOCK_BOOTTIME) / 1000000000LL);
+
+    uint32_t uid, next_uid, *prev_uid = NULL;
+    int count = 0, agents = 0;
+
+    // One inner map per agent: outer key is the uid, value the inner map id
+    while (bpf_map_get_next_key(map_fd, prev_uid, &next_uid) == 0) {
+        uid = next_uid;
+        prev_uid = &uid;
+
+        uint32_t inner_id;
+        if (bpf_map_lookup_elem(map_fd, &uid, &inner_id) < 0)
+            continue;
+        int inner_fd = bpf_map_get_fd_by_id(inner_id);
+        if (inner_fd < 0) {
+            fprintf(stderr, "uid=%u: inner map id %u: %s\n", uid, inner_id, strerror(errno));
+            continue;
         }
-        key = next_key;
+        agents++;
+
+        struct inode_key key, next_key, *prev = NULL;
+        struct file_perm perm;
+        while (bpf_map_get_next_key(inner_fd, prev, &next_key) == 0) {
+            if (bpf_map_lookup_elem(inner_fd, &next_key, &perm) == 0) {
+                char dev[16], verbs[8];
+                snprintf(dev, sizeof(dev), "%u:%u", next_key.dev >> 20, next_key.dev & 0xfffff);
+                printf("%-6u %-12s %-20llu %-8s %-7d %-9d %-10u %us\n",
+                       uid,
+                       dev,
+                       (unsigned long long)next_key.ino,
+                       aid_perm_str(perm.allow, verbs),
+                       !!(perm.flags & AID_POLICY_SUBTREE),
+                       !!(perm.flags & AID_POLICY_INHERITED),
+                       perm.hits, now - perm.last_use);
+                count++;
+            }
+            key = next_key;
+            prev = &key;
+        }
+        close(inner_fd);
     }
 
-    printf("---------------------------------------------------------------\n");
-    printf("Total entries: %d\n", count);
+    printf("-------------------------------------------------------------------------------------\n");
+    printf("Total entries: %d (%d agents)\n", count, agents);
 
     close(map_fd);
     return 0;
 }
+
+int main(int argc, char **argv)
+{
+    if (argc >= 2 && strcmp(argv[1], "--recent") == 0) {
+        uint32_t uid = 0;
+        if (argc > 3 || (argc == 3 && resolve_uid(argv[2], &uid) < 0))
+            usage(argv[0]);
+        return dump_recent(uid);
+    }
+    if (argc != 1)
+        usage(argv[0]);
+    return dump_policy_map();
+}
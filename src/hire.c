@@ -4,7 +4,12 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <unistd.h>
+#include <bpf/bpf.h>
 
 #include "../include/aid_shared.h"
 
@@ -19,6 +24,58 @@ static void usage(const char *prog)
     exit(1);
 }
 
+// Take a new session id from aid_config.next_session. Returns 0 if the
+// loader is not running (the hooks then go by uid alone).
+static uint32_t new_session(void)
+{
+    int cfg_fd = bpf_obj_get(AID_CONFIG_MAP_PATH);
+    uint32_t session = 0;
+
+    if (cfg_fd < 0) {
+        fprintf(stderr, "[hire] Warning: %s not found, no session (is aid_lsm_loader running?)\n",
+                AID_CONFIG_MAP_PATH);
+        return 0;
+    }
+
+    // The map is BPF_F_MMAPABLE: slot 0 starts at offset 0
+    size_t map_len = (sizeof(struct aid_config) + getpagesize() - 1) & ~(getpagesize() - 1);
+    struct aid_config *cfg = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, cfg_fd, 0);
+    if (cfg == MAP_FAILED) {
+        fprintf(stderr, "[hire] Warning: mmap(%s) failed: %s\n",
+                AID_CONFIG_MAP_PATH, strerror(errno));
+    } else {
+        do {
+            session = __atomic_add_fetch(&cfg->next_session, 1, __ATOMIC_SEQ_CST);
+        } while (session == 0);
+        munmap(cfg, map_len);
+    }
+    close(cfg_fd);
+    return session;
+}
+
+// Tag pid with its agent and session in aid_tasks. The entry survives the
+// exec and the hooks copy it to every task it forks.
+static int tag_session(pid_t pid, uint32_t uid, uint32_t session)
+{
+    int task_fd = bpf_obj_get(AID_TASKS_MAP_PATH);
+    if (task_fd < 0) {
+        fprintf(stderr, "[hire] Warning: %s not found: %s\n", AID_TASKS_MAP_PATH, strerror(errno));
+        return -1;
+    }
+
+    int pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+    struct aid_task task = { .agent = uid, .session = session };
+    int ret = 0;
+    if (pidfd < 0 || bpf_map_update_elem(task_fd, &pidfd, &task, BPF_ANY) < 0) {
+        fprintf(stderr, "[hire] Warning: failed to start a session: %s\n", strerror(errno));
+        ret = -1;
+    }
+    if (pidfd >= 0)
+        close(pidfd);
+    close(task_fd);
+    return ret;
+}
+
 int main(int argc, char **argv)
 {
     if (argc < 3) {
@@ -57,6 +114,57 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    uint32_t session = new_session();
+    if (session) {
+        char id[16];
+        snprintf(id, sizeof(id), "%u", session);
+        setenv("AID_SESSION", id, 1);
+        printf("[hire] Session %u (aid_ctl session %s %u ...)\n", session, agentname, session);
+    }
+
+    // The command runs in a child. Only the child's entry in aid_tasks
+    // marks it as the agent, and the entry goes in after the child has
+    // dropped to the agent's uid, so nothing hire does as root is enforced
+    // or audited as the agent. Writing aid_tasks needs root, so the parent
+    // writes it. The child waits for it before the exec, so the whole
+    // command runs in the session.
+    int ready[2], go[2];
+    if (pipe(ready) < 0 || pipe(go) < 0) {
+        fprintf(stderr, "[hire] Error: pipe failed: %s\n", strerror(errno));
+        return 1;
+    }
+
+    fflush(stdout);
+    pid_t child = fork();
+    if (child < 0) {
+        fprintf(stderr, "[hire] Error: fork failed: %s\n", strerror(errno));
+        return 1;
+    }
+    if (child > 0) {
+        char c;
+        close(ready[1]);
+        close(go[0]);
+        if (read(ready[0], &c, 1) == 1 && session)
+            tag_session(child, pw->pw_uid, session);
+        close(go[1]);
+
+        // Terminal signals reach the command through the process group
+        signal(SIGINT, SIG_IGN);
+        signal(SIGQUIT, SIG_IGN);
+        int status;
+        while (waitpid(child, &status, 0) < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "[hire] Error: waitpid failed: %s\n", strerror(errno));
+                return 1;
+            }
+        }
+        if (WIFSIGNALED(status))
+            return 128 + WTERMSIG(status);
+        return WEXITSTATUS(status);
+    }
+    close(ready[0]);
+    close(go[1]);
+
     // Switch to agent user
     if (setgid(pw->pw_gid) != 0) {
         fprintf(stderr, "[hire] Error: Failed to set gid=%d: %s\n",
@@ -70,6 +178,16 @@ int main(int argc, char **argv)
         return 1;
     }
 
+    // Tell the parent the credentials are dropped, then wait until it has
+    // written the session entry (it closes go either way)
+    char c = 1;
+    if (write(ready[1], &c, 1) != 1)
+        return 1;
+    close(ready[1]);
+    while (read(go[0], &c, 1) < 0 && errno == EINTR)
+        ;
+    close(go[0]);
+
     // Execute the command
     execvp(command, command_args);
 
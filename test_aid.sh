@@ -6,6 +6,44 @@ set -e
 echo "=== AID 테스트 스크립트 ==="
 echo
 
+TEST_DIR=/tmp/aid_test
+MANIFEST=$TEST_DIR/manifest.yaml
+PORT_ALLOWED=39001   # manifest의 network 허용 목록에 있는 포트
+PORT_DENIED=39002
+AGENT="sudo -u agent_testagent"
+FAILED=0
+TEST_NO=0
+
+# 다음 테스트 번호와 설명 출력
+next_test() {
+    TEST_NO=$((TEST_NO + 1))
+    echo "테스트 $TEST_NO: $1"
+}
+
+# 명령이 성공해야 하는 테스트
+expect_ok() {
+    next_test "$1 (성공해야 함)"
+    shift
+    if "$@" &>/dev/null; then
+        echo "  ✅ 성공"
+    else
+        echo "  ❌ 실패 (성공해야 함)"
+        FAILED=$((FAILED + 1))
+    fi
+}
+
+# 명령이 거부되어야 하는 테스트
+expect_denied() {
+    next_test "$1 (실패해야 함)"
+    shift
+    if "$@" &>/dev/null; then
+        echo "  ❌ 성공 (실패해야 함)"
+        FAILED=$((FAILED + 1))
+    else
+        echo "  ✅ 거부됨"
+    fi
+}
+
 # Root 권한 체크
 if [ "$EUID" -ne 0 ]; then
     echo "❌ 이 스크립트는 root 권한으로 실행해야 합니다."
@@ -19,7 +57,61 @@ echo "This file allows read only" > /tmp/allowed_read.txt
 echo "This file allows read and write" > /tmp/allowed_write.txt
 echo "This file is denied" > /tmp/denied.txt
 chmod 666 /tmp/allowed_*.txt /tmp/denied.txt
-echo "✅ 테스트 파일 생성 완료"
+
+# 규칙별 테스트 디렉토리 (sticky bit가 없어야 에이전트가 unlink 가능)
+if mountpoint -q $TEST_DIR/fs 2>/dev/null; then
+    umount $TEST_DIR/fs
+fi
+rm -rf $TEST_DIR
+mkdir -p $TEST_DIR $TEST_DIR/tree/sub $TEST_DIR/scratch $TEST_DIR/fs $TEST_DIR/labeled
+echo "inside the tree" > $TEST_DIR/tree/sub/deep.txt
+echo "outside the tree" > $TEST_DIR/outside.txt
+echo "notes" > $TEST_DIR/tree/notes.txt
+echo "append only" > $TEST_DIR/append.txt
+echo "read and write" > $TEST_DIR/rw.txt
+echo "not granted" > $TEST_DIR/other.txt
+echo "unlink me" > $TEST_DIR/scratch/victim.txt
+echo "SECRET=1" > $TEST_DIR/secret.env
+echo "log line" > $TEST_DIR/app.log
+echo "labeled" > $TEST_DIR/labeled/doc.txt
+echo "other label" > $TEST_DIR/labeled_other.txt
+echo "{}" > $TEST_DIR/key.json
+echo "weights" > $TEST_DIR/model.bin
+chmod -R a+rwX $TEST_DIR
+
+cat > $MANIFEST <<EOF
+agentname: testagent
+permissions:
+  files:
+    - path: /tmp/allowed_read.txt
+      read: true
+      write: false
+    - path: /tmp/allowed_write.txt
+      read: true
+      write: true
+    - path: $TEST_DIR/tree/**
+      read: true
+    - path: $TEST_DIR/tree/notes.txt   # tree/** 뒤의 파일 규칙이 tree의 엔트리를 덮으면 안 됨
+      read: true
+      write: true
+    - path: $TEST_DIR/scratch
+      read: true
+      write: true
+    - path: $TEST_DIR/append.txt
+      read: true
+      write: false
+      append: true
+    - path: $TEST_DIR/rw.txt
+      read: true
+      write: true
+    - path: $TEST_DIR/labeled/**
+      read: true
+      label: aidtest
+  network:
+    - 127.0.0.1:$PORT_ALLOWED
+    dns: false
+EOF
+echo "✅ 테스트 파일 생성 완료 (manifest: $MANIFEST)"
 echo
 
 # 2. eBPF LSM 로드
@@ -45,7 +137,7 @@ echo
 
 # 4. 에이전트 등록
 echo "[4/6] 에이전트 등록..."
-if ./src/addagent example_manifest.yaml; then
+if ./src/addagent $MANIFEST; then
     echo "✅ 에이전트 등록 완료"
 else
     echo "❌ 에이전트 등록 실패"
@@ -68,44 +160,142 @@ echo
 echo "[6/6] 권한 테스트..."
 echo
 
-echo "테스트 1: 읽기 허용 파일 읽기 (성공해야 함)"
-if sudo -u agent_testagent cat /tmp/allowed_read.txt &>/dev/null; then
-    echo "  ✅ 읽기 성공"
+expect_ok "읽기 허용 파일 읽기" $AGENT cat /tmp/allowed_read.txt
+expect_denied "읽기 허용 파일 쓰기" $AGENT sh -c 'echo "test" > /tmp/allowed_read.txt'
+expect_ok "읽기/쓰기 허용 파일 읽기" $AGENT cat /tmp/allowed_write.txt
+expect_ok "읽기/쓰기 허용 파일 쓰기" $AGENT sh -c 'echo "modified" > /tmp/allowed_write.txt'
+expect_denied "거부된 파일 읽기" $AGENT cat /tmp/denied.txt
+echo
+echo "--- 하위 트리 규칙 (tree/**, 읽기만) ---"
+expect_ok "트리 안의 파일 읽기" $AGENT cat $TEST_DIR/tree/sub/deep.txt
+expect_denied "트리 안의 파일 쓰기" $AGENT sh -c "echo x > $TEST_DIR/tree/sub/deep.txt"
+expect_denied "트리 밖의 파일 읽기" $AGENT cat $TEST_DIR/outside.txt
+expect_ok "tree/** 뒤에 규칙이 있는 파일 쓰기" $AGENT sh -c "echo x > $TEST_DIR/tree/notes.txt"
+expect_ok "그 뒤에도 트리 안의 다른 파일 읽기" $AGENT cat $TEST_DIR/tree/sub/deep.txt
+echo
+echo "--- 생성한 파일의 권한 상속 (scratch: read, write) ---"
+expect_ok "허용된 디렉토리에 파일 생성" $AGENT sh -c "echo new > $TEST_DIR/scratch/new.txt"
+expect_ok "생성한 파일 덮어쓰기" $AGENT sh -c "echo again > $TEST_DIR/scratch/new.txt"
+expect_ok "생성한 파일 읽기" $AGENT cat $TEST_DIR/scratch/new.txt
+echo
+echo "--- 덧붙이기 전용 (append: true, write: false) ---"
+expect_ok ">>로 덧붙이기" $AGENT sh -c "echo more >> $TEST_DIR/append.txt"
+expect_denied ">로 덮어쓰기" $AGENT sh -c "echo rewrite > $TEST_DIR/append.txt"
+expect_denied "truncate" $AGENT truncate -s 0 $TEST_DIR/append.txt
+# O_APPEND로 열어 write 검사를 통과한 뒤의 truncate (file_truncate 훅)
+expect_denied "O_APPEND|O_TRUNC로 열기" $AGENT dd if=/dev/null of=$TEST_DIR/append.txt oflag=append
+expect_denied "O_APPEND로 연 fd에 ftruncate" \
+    $AGENT dd if=/dev/null of=$TEST_DIR/append.txt oflag=append bs=1 seek=1
+echo
+echo "--- 디렉토리 verb (unlink/create) ---"
+expect_ok "허용된 디렉토리에서 unlink" $AGENT rm -f $TEST_DIR/scratch/victim.txt
+expect_denied "파일 규칙의 부모 디렉토리에서 unlink" $AGENT rm -f $TEST_DIR/other.txt
+expect_denied "파일 규칙의 부모 디렉토리에 파일 생성" $AGENT sh -c "echo new > $TEST_DIR/created.txt"
+echo
+echo "--- fs 규칙 (tmpfs 전체 읽기 전용) ---"
+if mount -t tmpfs aid_test $TEST_DIR/fs; then
+    echo "fs data" > $TEST_DIR/fs/data.txt
+    cp /bin/true $TEST_DIR/fs/true
+    chmod 666 $TEST_DIR/fs/data.txt
+    chmod 755 $TEST_DIR/fs/true
+    ./src/aid_ctl fs $TEST_DIR/fs r >/dev/null
+    expect_ok "fs 규칙 아래 파일 읽기" $AGENT cat $TEST_DIR/fs/data.txt
+    expect_denied "fs 규칙 아래 파일 쓰기" $AGENT sh -c "echo x > $TEST_DIR/fs/data.txt"
+    expect_ok "fs 규칙 아래 바이너리 실행" $AGENT $TEST_DIR/fs/true
+    ./src/aid_ctl fs $TEST_DIR/fs del >/dev/null
+    umount $TEST_DIR/fs
 else
-    echo "  ❌ 읽기 실패 (성공해야 함)"
+    echo "  ⏭️  tmpfs를 마운트할 수 없어 건너뜀"
 fi
-
-echo "테스트 2: 읽기 허용 파일 쓰기 (실패해야 함)"
-if sudo -u agent_testagent sh -c 'echo "test" > /tmp/allowed_read.txt' 2>/dev/null; then
-    echo "  ❌ 쓰기 성공 (실패해야 함)"
+echo
+echo "--- 네트워크 허용 목록 (connect) ---"
+# 리스너가 없으므로 허용된 포트는 ECONNREFUSED, 거부된 포트는 EPERM
+next_test "허용된 포트로 connect (EPERM이 아니어야 함)"
+if $AGENT bash -c "echo > /dev/tcp/127.0.0.1/$PORT_ALLOWED" 2>&1 | grep -q "Operation not permitted"; then
+    echo "  ❌ EPERM (허용되어야 함)"
+    FAILED=$((FAILED + 1))
 else
-    echo "  ✅ 쓰기 거부됨 (Permission denied)"
+    echo "  ✅ 허용됨"
 fi
-
-echo "테스트 3: 읽기/쓰기 허용 파일 읽기 (성공해야 함)"
-if sudo -u agent_testagent cat /tmp/allowed_write.txt &>/dev/null; then
-    echo "  ✅ 읽기 성공"
+next_test "목록에 없는 포트로 connect (EPERM이어야 함)"
+if $AGENT bash -c "echo > /dev/tcp/127.0.0.1/$PORT_DENIED" 2>&1 | grep -q "Operation not permitted"; then
+    echo "  ✅ 거부됨 (EPERM)"
 else
-    echo "  ❌ 읽기 실패 (성공해야 함)"
+    echo "  ❌ EPERM이 아님 (거부되어야 함)"
+    FAILED=$((FAILED + 1))
 fi
-
-echo "테스트 4: 읽기/쓰기 허용 파일 쓰기 (성공해야 함)"
-if sudo -u agent_testagent sh -c 'echo "modified" > /tmp/allowed_write.txt' 2>/dev/null; then
-    echo "  ✅ 쓰기 성공"
+next_test "거부된 connect가 flight recorder에 기록됨 (recorder가 켜져 있을 때)"
+if ! ./src/aid_ctl status | grep -Eq '^recorder: +on'; then
+    echo "  ⏭️  recorder가 꺼져 있어 건너뜀"
+elif ./src/dump_policies --recent testagent | grep -E "socket_denied" | grep -q " $PORT_DENIED "; then
+    echo "  ✅ 기록됨"
 else
-    echo "  ❌ 쓰기 실패 (성공해야 함)"
+    echo "  ❌ 기록 없음"
+    FAILED=$((FAILED + 1))
 fi
-
-echo "테스트 5: 거부된 파일 읽기 (실패해야 함)"
-if sudo -u agent_testagent cat /tmp/denied.txt 2>/dev/null; then
-    echo "  ❌ 읽기 성공 (실패해야 함)"
+echo
+echo "--- suffix class (정책 없는 파일) ---"
+expect_denied "sensitive 확장자(.env) 읽기" $AGENT cat $TEST_DIR/secret.env
+expect_denied "sensitive 확장자(.json) 읽기" $AGENT cat $TEST_DIR/key.json
+expect_denied "sensitive 확장자(.bin) 읽기" $AGENT cat $TEST_DIR/model.bin
+expect_ok "그 밖의 확장자(.log) 읽기" $AGENT cat $TEST_DIR/app.log
+echo
+echo "--- xattr 라벨 ---"
+if [ -e /sys/fs/bpf/aid_file_label_link ] && command -v setfattr &>/dev/null; then
+    setfattr -n security.bpf.aid -v other $TEST_DIR/labeled_other.txt
+    expect_ok "라벨 규칙이 있는 파일 읽기" $AGENT cat $TEST_DIR/labeled/doc.txt
+    expect_denied "다른 라벨의 파일 읽기" $AGENT cat $TEST_DIR/labeled_other.txt
 else
-    echo "  ✅ 읽기 거부됨 (Permission denied)"
+    echo "  ⏭️  xattr_labels가 꺼져 있거나 setfattr가 없어 건너뜀"
 fi
+echo
+echo "--- hire 세션 ---"
+expect_ok "hire가 AID_SESSION 설정" ./src/hire testagent sh -c 'test -n "$AID_SESSION"'
+expect_denied "hire 아래에서 거부된 파일 읽기" ./src/hire testagent cat /tmp/denied.txt
+next_test "세션 override(mode permissive) 후 거부된 파일 읽기 (성공해야 함)"
+./src/hire testagent sh -c 'sleep 2; cat /tmp/denied.txt' > $TEST_DIR/hire.log 2>&1 &
+HIRE_PID=$!
+SESSION=""
+for i in $(seq 10); do
+    SESSION=$(sed -n 's/^\[hire\] Session \([0-9]*\).*/\1/p' $TEST_DIR/hire.log)
+    [ -n "$SESSION" ] && break
+    sleep 0.1
+done
+if [ -z "$SESSION" ]; then
+    wait $HIRE_PID || true
+    echo "  ❌ hire가 세션을 시작하지 않음"
+    FAILED=$((FAILED + 1))
+else
+    ./src/aid_ctl session testagent $SESSION mode permissive >/dev/null
+    if wait $HIRE_PID; then
+        echo "  ✅ 성공 (세션 $SESSION)"
+    else
+        echo "  ❌ 실패 (성공해야 함)"
+        FAILED=$((FAILED + 1))
+    fi
+    ./src/aid_ctl session testagent $SESSION del >/dev/null
+fi
+echo
+echo "--- 특화 프로그램 (aid_ctl specialize on) ---"
+SPECIALIZE=$(./src/aid_ctl status | sed -n 's/^specialize: //p')
+./src/aid_ctl specialize on >/dev/null
+expect_ok "읽기 허용 파일 읽기" $AGENT cat /tmp/allowed_read.txt
+expect_denied "읽기 허용 파일 쓰기" $AGENT sh -c 'echo test > /tmp/allowed_read.txt'
+expect_ok ">>로 덧붙이기" $AGENT sh -c "echo more >> $TEST_DIR/append.txt"
+expect_denied ">로 덮어쓰기" $AGENT sh -c "echo rewrite > $TEST_DIR/append.txt"
+expect_denied "거부된 파일 읽기" $AGENT cat /tmp/denied.txt
+./src/aid_ctl specialize ${SPECIALIZE:-off} >/dev/null
 
 echo
 echo "=== 테스트 완료 ==="
 echo
 echo "정리 방법:"
+echo "  sudo ./src/aid_ctl revoke testagent"
 echo "  sudo userdel agent_testagent"
-echo "  rm /tmp/allowed_*.txt /tmp/denied.txt"
+echo "  rm -rf /tmp/allowed_*.txt /tmp/denied.txt $TEST_DIR"
+
+if [ $FAILED -gt 0 ]; then
+    echo
+    echo "❌ 실패한 테스트: $FAILED개"
+    exit 1
+fi